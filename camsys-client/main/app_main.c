@@ -10,6 +10,8 @@
 #include "esp_log.h"
 #include "esp_event.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_vfs_common.h"
 #include "esp_vfs_dev.h"
 #include "esp_websocket_client.h"
@@ -25,6 +27,20 @@
 #include "driver/sdspi_host.h"
 #include "driver/spi_common.h"
 #include "sdmmc_cmd.h"
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "record.h"
+#include "avi.h"
+#include "sad.h"
+#include "zone.h"
+#include "bg.h"
+#include "jpeg_dc.h"
+#include "heatmap.h"
+#include "sat.h"
+#include "event.h"
 
 // ------------------------- CAMERA INCLUDES --------------------------
 #define CONFIG_OV2640_SUPPORT true
@@ -332,75 +348,1736 @@ long int get_file_size(const char* filename)
     return res; 
 } 
 
+// ------------------------------------------------------
+// CLOCK
+// ------------------------------------------------------
+
+// The device has no RTC, its clock starts at 0 on every boot. The server sets it
+// on every connect (!TIME <unix-ms>); records and seek indexes store this time,
+// so nothing is recorded (nor kept in the preroll) before it is set.
+
+#define CAMSYS_CLOCK_VALID_MS 1577836800000ULL // 2020-01-01
+#define CAMSYS_CLOCK_STEP_MS 2000 // smaller differences are not corrected, the clock rather not steps back
+
+uint64_t camsys_clock_ms() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000ULL + now.tv_usec / 1000;
+}
+
+bool camsys_clock_valid() {
+    return camsys_clock_ms() >= CAMSYS_CLOCK_VALID_MS;
+}
+
+esp_err_t camsys_clock_set(uint64_t ms) {
+    if (ms < CAMSYS_CLOCK_VALID_MS) return ESP_ERR_INVALID_ARG;
+    int64_t diff = (int64_t)(ms - camsys_clock_ms());
+    if (camsys_clock_valid() && diff > -CAMSYS_CLOCK_STEP_MS && diff < CAMSYS_CLOCK_STEP_MS) return ESP_OK;
+    struct timeval tv = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    if (settimeofday(&tv, NULL)) return ESP_FAIL;
+    ESP_LOGI(TAG, "clock set: %llu (%+lld ms)", ms, diff);
+    return ESP_OK;
+}
+
+// ------------------------------------------------------
+// SEGMENTS
+// ------------------------------------------------------
+
+// Recordings are split into numbered segment files (8.3 names, LFN is off):
+// /sdcard/rec/00000001.vid + 00000001.idx, 00000002.vid + ...
+// A segment is closed after RECORD_SEGMENT_SIZE bytes or RECORD_SEGMENT_DURATION_MS,
+// the oldest ones are deleted while the card is filled over the fill level (percent,
+// RECORD_FILL_LEVEL by default, see !RECORD FILL).
+
+#define RECORD_DIR SDCARD_MOUNT_POINT"/rec"
+#define RECORD_VID_FMT RECORD_DIR"/%08u.vid"
+#define RECORD_IDX_FMT RECORD_DIR"/%08u.idx"
+#define RECORD_PATH_SIZE 32
+#define RECORD_SEGMENT_SIZE (64L * 1024 * 1024)
+#define RECORD_SEGMENT_DURATION_MS (10ULL * 60 * 1000)
+#define RECORD_SEGMENT_ALIGN (16 * 1024) // allocation unit of sdcard_init(), frame data starts here
+#define RECORD_FILL_LEVEL 90 // default, see !RECORD FILL
+#define RECORD_FILL_LEVEL_MIN 10
+#define RECORD_FILL_LEVEL_MAX 99
+#define RECORD_INDEX_INTERVAL_MS 1000 // default, see !INDEX INTERVAL
+#define RECORD_INDEX_INTERVAL_MS_MIN 100
+
+#define RECORD_READER_REPLAY 0
+#define RECORD_READER_DOWNLOAD 1
+#define RECORD_READERS 2
+
+// segments a reader may open, never evicted (first > last when none)
+struct record_segments_range_s {
+    uint32_t first;
+    uint32_t last;
+};
+
+typedef struct record_segments_range_s record_segments_range_t;
+
+struct record_segments_s {
+    uint32_t first;
+    uint32_t last; // first > last when there is no segment
+    uint8_t fill_level; // eviction starts over this card fill level, percent
+    record_segments_range_t busy[RECORD_READERS];
+    SemaphoreHandle_t lock; // the busy ranges, eviction holds it from the check to the delete
+};
+
+typedef struct record_segments_s record_segments_t;
+
+void record_segment_path(char* path, const char* fmt, uint32_t segment) {
+    snprintf(path, RECORD_PATH_SIZE, fmt, segment);
+}
+
+void record_segments_init(record_segments_t* segs) {
+    segs->first = 1;
+    segs->last = 0;
+    segs->fill_level = RECORD_FILL_LEVEL;
+    for (int r=0; r<RECORD_READERS; r++) {
+        segs->busy[r].first = 1;
+        segs->busy[r].last = 0;
+    }
+    segs->lock = xSemaphoreCreateMutex();
+}
+
+// Keeps [first, last] from eviction for the reader, in place of its previous range.
+// Set it before opening the segments: one evicted before is not there to open,
+// one after is not evicted.
+void record_segments_busy_set(record_segments_t* segs, int reader, uint32_t first, uint32_t last) {
+    xSemaphoreTake(segs->lock, portMAX_DELAY);
+    segs->busy[reader].first = first;
+    segs->busy[reader].last = last;
+    xSemaphoreGive(segs->lock);
+}
+
+void record_segments_busy_clear(record_segments_t* segs, int reader) {
+    record_segments_busy_set(segs, reader, 1, 0);
+}
+
+// call with the lock taken
+bool record_segments_busy_locked(record_segments_t* segs, uint32_t segment) {
+    for (int r=0; r<RECORD_READERS; r++) if (segment >= segs->busy[r].first && segment <= segs->busy[r].last) return true;
+    return false;
+}
+
+// must not run while the recorder is attached to segs
+esp_err_t record_segments_scan(record_segments_t* segs) {
+    uint32_t first = 1, last = 0;
+    DIR* dir = opendir(RECORD_DIR);
+    if (!dir) {
+        if (mkdir(RECORD_DIR, 0777)) {
+            ESP_LOGE(TAG, "rec dir err: %d", errno);
+            return ESP_FAIL;
+        }
+    } else {
+        bool found = false;
+        struct dirent* ent;
+        while ((ent = readdir(dir))) {
+            unsigned int n;
+            char ext[4];
+            if (2 != sscanf(ent->d_name, "%8u.%3s", &n, ext) || strcasecmp(ext, "vid")) continue;
+            if (!found || n < first) first = n;
+            if (!found || n > last) last = n;
+            found = true;
+        }
+        closedir(dir);
+    }
+    segs->first = first;
+    segs->last = last;
+    return ESP_OK;
+}
+
+int sdcard_fill_level() {
+    FATFS* fs;
+    DWORD free_clusters;
+    if (FR_OK != f_getfree("0:", &free_clusters, &fs)) return -1;
+    uint64_t total = fs->n_fatent - 2;
+    return total ? 100 - (int)((uint64_t)free_clusters * 100 / total) : -1;
+}
+
+bool record_segment_exists(uint32_t segment) {
+    char path[RECORD_PATH_SIZE];
+    struct stat st;
+    record_segment_path(path, RECORD_VID_FMT, segment);
+    return !stat(path, &st);
+}
+
+void record_segment_remove(uint32_t segment) {
+    char path[RECORD_PATH_SIZE];
+    record_segment_path(path, RECORD_VID_FMT, segment);
+    if (unlink(path)) ESP_LOGW(TAG, "rm %s err: %d", path, errno);
+    record_segment_path(path, RECORD_IDX_FMT, segment);
+    unlink(path);
+}
+
+// Creates the video file preallocated to RECORD_SEGMENT_SIZE, so FAT allocates
+// the cluster chain once instead of on every append (the .idx is written on close).
+// The file is positioned to the first frame at RECORD_SEGMENT_ALIGN.
+esp_err_t record_segment_create(uint32_t segment, FILE** file) {
+    char path[RECORD_PATH_SIZE];
+    record_segment_path(path, RECORD_VID_FMT, segment);
+    *file = fopen(path, "w+b");
+    if (!*file) {
+        ESP_LOGE(TAG, "fopen %s err: %d", path, errno);
+        return ESP_FAIL;
+    }
+    // the recorder task writes whole bursts, stdio buffering would only split them
+    setvbuf(*file, NULL, _IONBF, 0);
+    int err = record_write_file_header(*file, RECORD_SEGMENT_ALIGN);
+    if (err == RECORD_OK && (
+        fseek(*file, RECORD_SEGMENT_SIZE - 1, SEEK_SET) || EOF == fputc(0, *file) ||
+        fseek(*file, RECORD_SEGMENT_ALIGN, SEEK_SET))) err = RECORD_ERR_IO;
+    if (err != RECORD_OK) {
+        ESP_LOGE(TAG, "seg create err: %s", record_strerror(err));
+        fclose(*file);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// stores the frame data size and gives back the unused preallocated space
+esp_err_t record_segment_finish(FILE* file, uint32_t max_len, uint32_t data_len) {
+    int err = record_update_file_header(file, max_len, data_len);
+    if (err == RECORD_OK && ftruncate(fileno(file), RECORD_SEGMENT_ALIGN + data_len)) err = RECORD_ERR_IO;
+    if (err != RECORD_OK) ESP_LOGW(TAG, "seg finish err: %s", record_strerror(err));
+    if (fclose(file)) err = RECORD_ERR_IO;
+    return err == RECORD_OK ? ESP_OK : ESP_FAIL;
+}
+
+// ------------------------------------------------------
+// INDEX CACHE
+// ------------------------------------------------------
+
+// The seek index of all segments is kept in RAM, so ?INDEX, !INDEX and !SEEK
+// never touch the card. It is loaded once from the .idx files, the recorder
+// appends to it and writes a segment's entries to its .idx when closing it.
+// The entries are in segment and offset order. Their timestamps only rise within
+// a run: a recording made before a clock step (or with the boot time stamps of
+// older firmware) starts a new run, so time searches look into every run.
+
+#define RECORD_INDEX_CACHE_GROW 256
+#define RECORD_INDEX_CACHE_INTERNAL_MAX (16 * 1024) // bigger caches go to PSRAM
+#define RECORD_INDEX_CACHE_MAX (64L * 1024) // oldest entries are dropped over this
+#define RECORD_INDEX_CACHE_LOAD_CHUNK 32
+#define RECORD_INDEX_CACHE_RUNS_GROW 8
+
+struct record_index_item_s {
+    uint32_t segment;
+    record_index_entry_t entry;
+};
+
+typedef struct record_index_item_s record_index_item_t;
+
+struct record_index_cache_s {
+    record_index_item_t* items; // ascending segment and offset
+    long cnt;
+    long size;
+    long* runs; // first item of every run of ascending timestamps
+    int runs_cnt;
+    int runs_size;
+    bool loaded;
+    SemaphoreHandle_t lock;
+};
+
+typedef struct record_index_cache_s record_index_cache_t;
+
+esp_err_t record_index_cache_reserve(record_index_cache_t* cache, long cnt) {
+    if (cnt <= cache->size) return ESP_OK;
+    long size = cache->size + RECORD_INDEX_CACHE_GROW;
+    if (size < cnt) size = cnt;
+    size_t bytes = size * sizeof(record_index_item_t);
+    record_index_item_t* items = heap_caps_realloc(cache->items, bytes,
+        bytes > RECORD_INDEX_CACHE_INTERNAL_MAX ? MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT : MALLOC_CAP_8BIT);
+    if (!items) {
+        ESP_LOGE(TAG, "idx cache alloc err: %ld", size);
+        return ESP_ERR_NO_MEM;
+    }
+    cache->items = items;
+    cache->size = size;
+    return ESP_OK;
+}
+
+// call with the lock taken
+esp_err_t record_index_cache_run_add(record_index_cache_t* cache, long first) {
+    if (cache->runs_cnt == cache->runs_size) {
+        int size = cache->runs_size + RECORD_INDEX_CACHE_RUNS_GROW;
+        long* runs = realloc(cache->runs, size * sizeof(long));
+        if (!runs) {
+            ESP_LOGE(TAG, "idx runs alloc err: %d", size);
+            return ESP_ERR_NO_MEM;
+        }
+        cache->runs = runs;
+        cache->runs_size = size;
+    }
+    cache->runs[cache->runs_cnt++] = first;
+    return ESP_OK;
+}
+
+// call with the lock taken, a new item starts a run when its time goes back
+esp_err_t record_index_cache_run_check(record_index_cache_t* cache, long n) {
+    if (n && cache->items[n].entry.timestamp >= cache->items[n - 1].entry.timestamp) return ESP_OK;
+    return record_index_cache_run_add(cache, n);
+}
+
+// call with the lock taken, after items were dropped or removed
+esp_err_t record_index_cache_runs_rebuild(record_index_cache_t* cache) {
+    esp_err_t err = ESP_OK;
+    cache->runs_cnt = 0;
+    for (long i=0; err == ESP_OK && i<cache->cnt; i++) err = record_index_cache_run_check(cache, i);
+    return err;
+}
+
+// call with the lock taken, the entries of a segment are contiguous
+void record_index_cache_remove(record_index_cache_t* cache, uint32_t segment) {
+    long first = 0;
+    while (first < cache->cnt && cache->items[first].segment < segment) first++;
+    long last = first;
+    while (last < cache->cnt && cache->items[last].segment == segment) last++;
+    memmove(cache->items + first, cache->items + last, (cache->cnt - last) * sizeof(record_index_item_t));
+    cache->cnt -= last - first;
+    record_index_cache_runs_rebuild(cache);
+}
+
+// call with the lock taken
+void record_index_cache_drop(record_index_cache_t* cache, long cnt) {
+    if (cnt > cache->cnt) cnt = cache->cnt;
+    cache->cnt -= cnt;
+    memmove(cache->items, cache->items + cnt, cache->cnt * sizeof(record_index_item_t));
+    record_index_cache_runs_rebuild(cache);
+}
+
+void record_index_cache_init(record_index_cache_t* cache) {
+    cache->items = NULL;
+    cache->cnt = 0;
+    cache->size = 0;
+    cache->runs = NULL;
+    cache->runs_cnt = 0;
+    cache->runs_size = 0;
+    cache->loaded = false;
+    cache->lock = xSemaphoreCreateMutex();
+}
+
+void record_index_cache_clear(record_index_cache_t* cache) {
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    cache->cnt = 0;
+    cache->runs_cnt = 0;
+    cache->loaded = true;
+    xSemaphoreGive(cache->lock);
+}
+
+esp_err_t record_index_cache_append(record_index_cache_t* cache, uint32_t segment, const record_index_entry_t* entries, long cnt) {
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    if (cache->cnt + cnt > RECORD_INDEX_CACHE_MAX) {
+        ESP_LOGW(TAG, "idx cache full, drop oldest");
+        record_index_cache_drop(cache, cache->cnt + cnt - RECORD_INDEX_CACHE_MAX);
+    }
+    esp_err_t err = record_index_cache_reserve(cache, cache->cnt + cnt);
+    for (long i=0; err == ESP_OK && i<cnt; i++) {
+        cache->items[cache->cnt].segment = segment;
+        cache->items[cache->cnt].entry = entries[i];
+        err = record_index_cache_run_check(cache, cache->cnt);
+        if (err == ESP_OK) cache->cnt++;
+    }
+    xSemaphoreGive(cache->lock);
+    return err;
+}
+
+// reads the .idx files of segs once, a missing or broken .idx only loses the seek points of its segment
+esp_err_t record_index_cache_load(record_index_cache_t* cache, record_segments_t* segs) {
+    if (cache->loaded) return ESP_OK;
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    cache->cnt = 0;
+    esp_err_t ret = ESP_OK;
+    for (uint32_t s=segs->first; ret == ESP_OK && s<=segs->last; s++) {
+        char path[RECORD_PATH_SIZE];
+        record_segment_path(path, RECORD_IDX_FMT, s);
+        FILE* idxf = fopen(path, "rb");
+        if (!idxf) continue;
+        long count = 0;
+        record_index_entry_t entries[RECORD_INDEX_CACHE_LOAD_CHUNK];
+        int err = record_read_index_header(idxf, &count);
+        if (err == RECORD_OK && count > RECORD_INDEX_CACHE_MAX) count = RECORD_INDEX_CACHE_MAX;
+        if (err == RECORD_OK && cache->cnt + count > RECORD_INDEX_CACHE_MAX) record_index_cache_drop(cache, cache->cnt + count - RECORD_INDEX_CACHE_MAX);
+        if (err == RECORD_OK) ret = record_index_cache_reserve(cache, cache->cnt + count);
+        for (long n=0; err == RECORD_OK && ret == ESP_OK && n<count; n+=RECORD_INDEX_CACHE_LOAD_CHUNK) {
+            long chunk = count - n < RECORD_INDEX_CACHE_LOAD_CHUNK ? count - n : RECORD_INDEX_CACHE_LOAD_CHUNK;
+            err = record_read_index_entries(idxf, n, entries, chunk);
+            for (long i=0; err == RECORD_OK && i<chunk; i++) {
+                cache->items[cache->cnt].segment = s;
+                cache->items[cache->cnt].entry = entries[i];
+                cache->cnt++;
+            }
+        }
+        if (err != RECORD_OK) ESP_LOGW(TAG, "idx %08u err: %s", s, record_strerror(err));
+        fclose(idxf);
+    }
+    if (ret == ESP_OK) ret = record_index_cache_runs_rebuild(cache);
+    if (ret == ESP_OK) cache->loaded = true;
+    xSemaphoreGive(cache->lock);
+    ESP_LOGI(TAG, "idx cache: %ld (%d runs)", cache->cnt, cache->runs_cnt);
+    return ret;
+}
+
+// appends the cached entries of a segment to its .idx, *persisted counts the ones already there
+esp_err_t record_index_cache_persist(record_index_cache_t* cache, uint32_t segment, long* persisted) {
+    char path[RECORD_PATH_SIZE];
+    record_segment_path(path, RECORD_IDX_FMT, segment);
+    FILE* idxf = fopen(path, *persisted ? "ab" : "wb");
+    if (!idxf) {
+        ESP_LOGE(TAG, "idx fopen err: %d", errno);
+        return ESP_FAIL;
+    }
+    int err = *persisted ? RECORD_OK : record_write_index_header(idxf);
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    long first = cache->cnt;
+    while (first > 0 && cache->items[first - 1].segment >= segment) first--;
+    for (long i=first+*persisted; err == RECORD_OK && i<cache->cnt && cache->items[i].segment == segment; i++) {
+        err = record_write_index_entries(idxf, &cache->items[i].entry, 1);
+        if (err == RECORD_OK) (*persisted)++;
+    }
+    xSemaphoreGive(cache->lock);
+    if (fflush(idxf) || fsync(fileno(idxf))) err = RECORD_ERR_IO;
+    if (fclose(idxf)) err = RECORD_ERR_IO;
+    if (err != RECORD_OK) ESP_LOGW(TAG, "idx write err: %s", record_strerror(err));
+    return err == RECORD_OK ? ESP_OK : ESP_FAIL;
+}
+
+long record_index_cache_size(record_index_cache_t* cache) {
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    long cnt = cache->cnt;
+    xSemaphoreGive(cache->lock);
+    return cnt;
+}
+
+esp_err_t record_index_cache_get(record_index_cache_t* cache, long n, record_index_item_t* item) {
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    if (n >= 0 && n < cache->cnt) {
+        *item = cache->items[n];
+        err = ESP_OK;
+    }
+    xSemaphoreGive(cache->lock);
+    return err;
+}
+
+// Last entry at or before timestamp over all segments: the latest such time of
+// all runs, of the later run on a tie.
+esp_err_t record_index_cache_search(record_index_cache_t* cache, uint64_t timestamp, record_index_item_t* item) {
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    long best = -1;
+    for (int r=0; r<cache->runs_cnt; r++) {
+        long first = cache->runs[r];
+        long lo = first, hi = r + 1 < cache->runs_cnt ? cache->runs[r + 1] : cache->cnt; // answer is lo - 1
+        while (lo < hi) {
+            long mid = lo + (hi - lo) / 2;
+            if (cache->items[mid].entry.timestamp <= timestamp) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo > first && (best < 0 || cache->items[lo - 1].entry.timestamp >= cache->items[best].entry.timestamp)) best = lo - 1;
+    }
+    if (best >= 0) *item = cache->items[best];
+    xSemaphoreGive(cache->lock);
+    return best >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// first entry at or after offset of segment (or in a later segment), so in file
+// order whatever the timestamps
+esp_err_t record_index_cache_next(record_index_cache_t* cache, uint32_t segment, uint32_t offset, record_index_item_t* item) {
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    long lo = 0, hi = cache->cnt;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        const record_index_item_t* it = &cache->items[mid];
+        if (it->segment < segment || (it->segment == segment && it->entry.offset < offset)) lo = mid + 1;
+        else hi = mid;
+    }
+    bool found = lo < cache->cnt;
+    if (found) *item = cache->items[lo];
+    xSemaphoreGive(cache->lock);
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+// Deletes the oldest segments but always keeps the latest one. A segment in the
+// busy range of a replay or download is skipped and the next oldest goes instead,
+// the skipped one is deleted by a later call once it is released (the gap it leaves
+// is skipped by every reader, like any missing segment).
+void record_segments_evict(record_segments_t* segs, record_index_cache_t* cache) {
+    int level;
+    for (uint32_t s=segs->first; s<segs->last && (level = sdcard_fill_level()) > segs->fill_level; s++) {
+        xSemaphoreTake(segs->lock, portMAX_DELAY);
+        bool busy = record_segments_busy_locked(segs, s);
+        bool evict = !busy && record_segment_exists(s);
+        if (evict) {
+            ESP_LOGW(TAG, "card %d%% full, evict %08u", level, s);
+            record_segment_remove(s);
+        }
+        xSemaphoreGive(segs->lock);
+        if (busy) continue;
+        if (evict) {
+            xSemaphoreTake(cache->lock, portMAX_DELAY);
+            record_index_cache_remove(cache, s);
+            xSemaphoreGive(cache->lock);
+        }
+        if (s == segs->first) segs->first++;
+    }
+}
+
+// ------------------------------------------------------
+// METRICS
+// ------------------------------------------------------
+
+// Timings of the capture path kept as fixed-bucket histograms, plus dropped frame
+// counters. Any task may update them, a spinlock keeps the counts consistent.
+// Read by ?STATS (JSON) and /metrics (Prometheus text).
+
+#define METRICS_BUCKETS 12 // the last one counts everything over the largest bound
+
+#define METRICS_CAPTURE 0       // capture to esp_camera_fb_get() return
+#define METRICS_HOLD_STREAM 1   // frame held by a live stream viewer
+#define METRICS_HOLD_SNAPSHOT 2 // frame held by /snapshot
+#define METRICS_HOLD_MOTION 3   // frame held by the motion analyser
+#define METRICS_SD_WRITE 4      // one burst written to the card
+#define METRICS_HTTP_SEND 5     // one stream frame sent
+#define METRICS_HIST_COUNT 6
+
+#define METRICS_DROP_FPS 0      // skipped by the fps limit
+#define METRICS_DROP_HUB 1      // no free frame slot
+#define METRICS_DROP_RECORDER 2 // recorder ring or index queue full
+#define METRICS_DROP_VIEWER 3   // newer frame published before a viewer took it
+#define METRICS_DROP_COUNT 4
+
+static const uint32_t metrics_bounds_us[METRICS_BUCKETS - 1] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000
+};
+
+static const char* metrics_hist_names[METRICS_HIST_COUNT] = {
+    "capture", "hold_stream", "hold_snapshot", "hold_motion", "sd_write", "http_send"
+};
+
+static const char* metrics_drop_names[METRICS_DROP_COUNT] = {
+    "fps", "hub", "recorder", "viewer"
+};
+
+struct metrics_hist_s {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[METRICS_BUCKETS];
+};
+
+typedef struct metrics_hist_s metrics_hist_t;
+
+struct metrics_s {
+    metrics_hist_t hists[METRICS_HIST_COUNT];
+    uint32_t drops[METRICS_DROP_COUNT];
+};
+
+typedef struct metrics_s metrics_t;
+
+metrics_t camsys_metrics;
+portMUX_TYPE camsys_metrics_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void metrics_observe(int hist, int64_t us) {
+    uint32_t v = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    int b = 0;
+    while (b < METRICS_BUCKETS - 1 && v > metrics_bounds_us[b]) b++;
+    portENTER_CRITICAL(&camsys_metrics_mux);
+    metrics_hist_t* h = &camsys_metrics.hists[hist];
+    h->count++;
+    h->sum_us += v;
+    if (v > h->max_us) h->max_us = v;
+    h->buckets[b]++;
+    portEXIT_CRITICAL(&camsys_metrics_mux);
+}
+
+void metrics_since(int hist, int64_t start_us) {
+    metrics_observe(hist, esp_timer_get_time() - start_us);
+}
+
+void metrics_drop(int drop, uint32_t cnt) {
+    portENTER_CRITICAL(&camsys_metrics_mux);
+    camsys_metrics.drops[drop] += cnt;
+    portEXIT_CRITICAL(&camsys_metrics_mux);
+}
+
+void metrics_copy(metrics_t* out) {
+    portENTER_CRITICAL(&camsys_metrics_mux);
+    *out = camsys_metrics;
+    portEXIT_CRITICAL(&camsys_metrics_mux);
+}
+
+// {"func":"stats",...}, truncated to size (at most 1400 chars with 10 digit counts)
+// appends at *len until buf is full, false on an encoding error
+bool metrics_append(char* buf, size_t size, size_t* len, const char* fmt, ...) {
+    if (*len >= size) return true;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, args);
+    va_end(args);
+    if (n < 0) return false;
+    *len += (size_t)n;
+    return true;
+}
+
+// the JSON of ?STATS, cut at size - 1 characters, -1 on an encoding error
+int metrics_json(char* buf, size_t size) {
+    metrics_t m;
+    metrics_copy(&m);
+    size_t len = 0;
+    bool ok = metrics_append(buf, size, &len, "{\"func\":\"stats\",\"bounds_us\":[");
+    for (int b=0; b<METRICS_BUCKETS - 1 && ok; b++)
+        ok = metrics_append(buf, size, &len, "%s%u", b ? "," : "", metrics_bounds_us[b]);
+    for (int i=0; i<METRICS_HIST_COUNT && ok; i++) {
+        metrics_hist_t* h = &m.hists[i];
+        ok = metrics_append(buf, size, &len, "%s\"%s\":{\"n\":%u,\"avg_us\":%u,\"max_us\":%u,\"b\":[",
+            i ? "]}," : "],", metrics_hist_names[i], h->count, h->count ? (uint32_t)(h->sum_us / h->count) : 0, h->max_us);
+        for (int b=0; b<METRICS_BUCKETS && ok; b++)
+            ok = metrics_append(buf, size, &len, "%s%u", b ? "," : "", h->buckets[b]);
+    }
+    if (ok) ok = metrics_append(buf, size, &len, "]},\"dropped\":{");
+    for (int i=0; i<METRICS_DROP_COUNT && ok; i++)
+        ok = metrics_append(buf, size, &len, "%s\"%s\":%u", i ? "," : "", metrics_drop_names[i], m.drops[i]);
+    if (ok) ok = metrics_append(buf, size, &len, "}}");
+    if (!ok) return -1;
+    return (int)(len < size ? len : size - 1);
+}
+
+// ------------------------------------------------------
+// RECORDER
+// ------------------------------------------------------
+
+// Frames are copied into a PSRAM ring by the capture path and written to the
+// SD card by a separate task, so card latency never stalls capture/stream.
+// Positions are counted in bytes pushed since the recorder was attached.
+
+#define RECORDER_BURST_SIZE (2 * RECORD_SEGMENT_ALIGN)
+#define RECORDER_RING_SIZE (32 * RECORDER_BURST_SIZE)
+#define RECORDER_INDEX_PENDING_MAX 16
+#define RECORDER_ROTATE_PENDING_MAX 4
+#define RECORDER_SYNC_INTERVAL_MS 5000
+#define RECORDER_TASK_STACK_SIZE 4096
+#define RECORDER_TASK_PRIORITY 4
+
+struct recorder_rotate_s {
+    long pos;         // first byte of the next segment
+    uint32_t max_len; // largest frame of the finished segment
+};
+
+typedef struct recorder_rotate_s recorder_rotate_t;
+
+struct recorder_index_s {
+    long pos;
+    uint64_t timestamp;
+    uint32_t frame;
+};
+
+typedef struct recorder_index_s recorder_index_t;
+
+struct recorder_s {
+    uint8_t* ring;
+    size_t head;
+    size_t tail;
+    size_t used;
+    bool active;
+    bool flush;
+    bool held;      // reserved frames are being filled, nothing is written meanwhile
+    bool failed;
+    long pushed;
+    long written;
+    recorder_index_t index_pending[RECORDER_INDEX_PENDING_MAX];
+    int index_pending_cnt;
+    recorder_rotate_t rotate_pending[RECORDER_ROTATE_PENDING_MAX];
+    int rotate_pending_cnt;
+    uint32_t dropped;
+
+    // segment being filled by the capture path
+    long push_seg_start;
+    uint64_t push_seg_first_ts;
+    uint32_t push_seg_max_len;
+    uint32_t push_seg_frames;
+
+    // segment being written by the task
+    long seg_start;
+    long sync_pos;       // start of the last indexed frame handed to the card
+    long index_synced;   // entries of the segment in its .idx
+    int64_t synced_us;
+    uint32_t segment;
+    FILE* file;
+    record_segments_t* segments;
+    record_index_cache_t* index;
+
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t wakeup;
+    SemaphoreHandle_t flushed;
+    TaskHandle_t task;
+};
+
+typedef struct recorder_s recorder_t;
+
+// index entries are kept as positions until the frame they point to is written
+void recorder_write_index(recorder_t* rec) {
+    recorder_index_t pending[RECORDER_INDEX_PENDING_MAX];
+    record_index_entry_t entries[RECORDER_INDEX_PENDING_MAX];
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    int cnt = 0;
+    while (cnt < rec->index_pending_cnt && rec->index_pending[cnt].pos < rec->written) cnt++;
+    memcpy(pending, rec->index_pending, cnt * sizeof(recorder_index_t));
+    rec->index_pending_cnt -= cnt;
+    memmove(rec->index_pending, rec->index_pending + cnt, rec->index_pending_cnt * sizeof(recorder_index_t));
+    xSemaphoreGive(rec->lock);
+    if (!cnt || !rec->file) return;
+    rec->sync_pos = pending[cnt - 1].pos;
+    for (int i=0; i<cnt; i++) {
+        entries[i].timestamp = pending[i].timestamp;
+        entries[i].offset = RECORD_SEGMENT_ALIGN + pending[i].pos - rec->seg_start;
+        entries[i].frame = pending[i].frame;
+    }
+    if (ESP_OK != record_index_cache_append(rec->index, rec->segment, entries, cnt)) rec->failed = true;
+}
+
+esp_err_t recorder_segment_open(recorder_t* rec) {
+    record_segments_evict(rec->segments, rec->index);
+    uint32_t segment = rec->segments->last + 1;
+    rec->seg_start = rec->written;
+    if (ESP_OK != record_segment_create(segment, &rec->file)) {
+        rec->file = NULL;
+        rec->failed = true;
+        return ESP_FAIL;
+    }
+    if (rec->segments->first > rec->segments->last) rec->segments->first = segment;
+    rec->segments->last = segment;
+    rec->segment = segment;
+    rec->sync_pos = rec->seg_start;
+    rec->index_synced = 0;
+    ESP_LOGI(TAG, "rec seg %08u", segment);
+    return ESP_OK;
+}
+
+esp_err_t recorder_segment_close(recorder_t* rec, uint32_t max_len) {
+    if (!rec->file) return ESP_FAIL;
+    recorder_write_index(rec);
+    esp_err_t err = record_segment_finish(rec->file, max_len, rec->written - rec->seg_start);
+    rec->file = NULL;
+    if (ESP_OK != record_index_cache_persist(rec->index, rec->segment, &rec->index_synced)) err = ESP_FAIL;
+    if (err != ESP_OK) rec->failed = true;
+    return err;
+}
+
+// writes at most one burst, returns false when there was nothing to do
+bool recorder_write_burst(recorder_t* rec) {
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    if (rec->held) {
+        xSemaphoreGive(rec->lock);
+        return false;
+    }
+    size_t used = rec->used;
+    size_t tail = rec->tail;
+    bool flush = rec->flush;
+    bool rotate = rec->rotate_pending_cnt > 0;
+    recorder_rotate_t next = rec->rotate_pending[0];
+    xSemaphoreGive(rec->lock);
+
+    if (rotate && next.pos == rec->written) {
+        recorder_segment_close(rec, next.max_len);
+        recorder_segment_open(rec);
+        xSemaphoreTake(rec->lock, portMAX_DELAY);
+        rec->rotate_pending_cnt--;
+        memmove(rec->rotate_pending, rec->rotate_pending + 1, rec->rotate_pending_cnt * sizeof(recorder_rotate_t));
+        xSemaphoreGive(rec->lock);
+        return true;
+    }
+
+    size_t limit = used;
+    bool seg_end = rotate && next.pos - rec->written <= used;
+    if (seg_end) limit = next.pos - rec->written;
+    if (!limit || (!flush && !seg_end && limit < RECORDER_BURST_SIZE)) return false;
+
+    size_t chunk = RECORDER_RING_SIZE - tail;
+    if (chunk > limit) chunk = limit;
+    if (chunk > RECORDER_BURST_SIZE) chunk = RECORDER_BURST_SIZE;
+    // end every full burst on a cluster boundary of the segment file
+    if (chunk == RECORDER_BURST_SIZE) chunk -= (rec->written - rec->seg_start + chunk) % RECORD_SEGMENT_ALIGN;
+
+    // without a segment file (create failed) the data is discarded
+    if (rec->file) {
+        int64_t start_us = esp_timer_get_time();
+        if (chunk != fwrite(rec->ring + tail, sizeof(uint8_t), chunk, rec->file)) {
+            ESP_LOGW(TAG, "rec write err: %d", ferror(rec->file));
+            rec->failed = true;
+        }
+        metrics_since(METRICS_SD_WRITE, start_us);
+    }
+    rec->written += chunk;
+
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->tail = (tail + chunk) % RECORDER_RING_SIZE;
+    rec->used -= chunk;
+    xSemaphoreGive(rec->lock);
+    return true;
+}
+
+// Sync point: the frame data up to the last indexed frame on the card is committed
+// in the header and the new index entries are appended to the .idx, so a reset
+// loses at most the frames after it (see record_recover()).
+void recorder_sync(recorder_t* rec) {
+    rec->synced_us = esp_timer_get_time();
+    if (!rec->file || rec->sync_pos <= rec->seg_start) return;
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    uint32_t max_len = rec->rotate_pending_cnt ? rec->rotate_pending[0].max_len : rec->push_seg_max_len;
+    xSemaphoreGive(rec->lock);
+    int err = RECORD_OK;
+    if (fsync(fileno(rec->file))) err = RECORD_ERR_IO;
+    if (err == RECORD_OK) err = record_update_file_header(rec->file, max_len, rec->sync_pos - rec->seg_start);
+    if (err == RECORD_OK && fsync(fileno(rec->file))) err = RECORD_ERR_IO;
+    if (err != RECORD_OK) ESP_LOGW(TAG, "rec sync err: %s", record_strerror(err));
+    if (err != RECORD_OK || ESP_OK != record_index_cache_persist(rec->index, rec->segment, &rec->index_synced)) rec->failed = true;
+}
+
+void recorder_task(void* arg) {
+    recorder_t* rec = arg;
+    while (true) {
+        xSemaphoreTake(rec->wakeup, pdMS_TO_TICKS(RECORDER_SYNC_INTERVAL_MS));
+        if (!rec->active) continue;
+        // a flush requested after this point comes with its own wakeup
+        xSemaphoreTake(rec->lock, portMAX_DELAY);
+        bool flush = rec->flush && !rec->held;
+        xSemaphoreGive(rec->lock);
+        while (recorder_write_burst(rec));
+        recorder_write_index(rec);
+        if (esp_timer_get_time() - rec->synced_us >= RECORDER_SYNC_INTERVAL_MS * 1000LL) recorder_sync(rec);
+        if (flush) {
+            xSemaphoreTake(rec->lock, portMAX_DELAY);
+            rec->flush = false;
+            xSemaphoreGive(rec->lock);
+            xSemaphoreGive(rec->flushed);
+        }
+    }
+}
+
+esp_err_t recorder_init(recorder_t* rec) {
+    if (rec->ring) return ESP_OK;
+    rec->ring = heap_caps_malloc(RECORDER_RING_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!rec->ring) {
+        ESP_LOGE(TAG, "rec ring alloc err");
+        return ESP_ERR_NO_MEM;
+    }
+    rec->active = false;
+    rec->file = NULL;
+    rec->lock = xSemaphoreCreateMutex();
+    rec->wakeup = xSemaphoreCreateBinary();
+    rec->flushed = xSemaphoreCreateBinary();
+    if (!rec->lock || !rec->wakeup || !rec->flushed ||
+        pdPASS != xTaskCreate(recorder_task, "recorder", RECORDER_TASK_STACK_SIZE, rec, RECORDER_TASK_PRIORITY, &rec->task)) {
+        ESP_LOGE(TAG, "rec task err");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// starts a new segment after segs->last, its seek points go to index
+esp_err_t recorder_attach(recorder_t* rec, record_segments_t* segs, record_index_cache_t* index) {
+    rec->head = rec->tail = rec->used = 0;
+    rec->flush = false;
+    rec->held = false;
+    rec->failed = false;
+    rec->pushed = rec->written = 0;
+    rec->index_pending_cnt = 0;
+    rec->rotate_pending_cnt = 0;
+    rec->dropped = 0;
+    rec->push_seg_start = 0;
+    rec->push_seg_max_len = 0;
+    rec->push_seg_frames = 0;
+    rec->segments = segs;
+    rec->index = index;
+    rec->synced_us = esp_timer_get_time();
+    esp_err_t err = recorder_segment_open(rec);
+    if (err != ESP_OK) return err;
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->active = true;
+    xSemaphoreGive(rec->lock);
+    return ESP_OK;
+}
+
+// blocks until everything pushed so far is on the card and closes the segment
+esp_err_t recorder_detach(recorder_t* rec) {
+    if (!rec->active) return ESP_OK;
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->flush = true;
+    xSemaphoreGive(rec->lock);
+    xSemaphoreGive(rec->wakeup);
+    xSemaphoreTake(rec->flushed, portMAX_DELAY);
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->active = false;
+    xSemaphoreGive(rec->lock);
+    recorder_segment_close(rec, rec->push_seg_max_len);
+    if (rec->dropped) ESP_LOGW(TAG, "rec dropped %u frames", rec->dropped);
+    return rec->failed ? ESP_FAIL : ESP_OK;
+}
+
+size_t recorder_space(recorder_t* rec) {
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    size_t free_size = RECORDER_RING_SIZE - rec->used;
+    xSemaphoreGive(rec->lock);
+    return free_size;
+}
+
+// writes len bytes at pos of the ring, gives the position after them
+size_t recorder_ring_write(recorder_t* rec, size_t pos, const uint8_t* data, size_t len) {
+    size_t first = RECORDER_RING_SIZE - pos;
+    if (first > len) first = len;
+    memcpy(rec->ring + pos, data, first);
+    memcpy(rec->ring, data + first, len - first);
+    return (pos + len) % RECORDER_RING_SIZE;
+}
+
+// drops (and counts) the frame when the writer has fallen behind, an indexed
+// frame also when its entry does not fit the pending queue (an entry is never lost),
+// *rotate when the frame starts a new segment
+esp_err_t recorder_frame_check(recorder_t* rec, const record_frame_header_t* hdr, bool index, bool* rotate) {
+    size_t total = RECORD_FRAME_HEADER_SIZE + hdr->len;
+
+    if (!rec->active) return ESP_ERR_INVALID_STATE;
+
+    long seg_len = rec->pushed - rec->push_seg_start;
+    *rotate = seg_len && (
+        RECORD_SEGMENT_ALIGN + seg_len + (long)total > RECORD_SEGMENT_SIZE ||
+        hdr->timestamp - rec->push_seg_first_ts >= RECORD_SEGMENT_DURATION_MS);
+    // every segment starts with an indexed frame, see recorder_frame_book()
+    if (*rotate || !seg_len) index = true;
+
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    size_t free_size = RECORDER_RING_SIZE - rec->used;
+    bool rotate_full = rec->rotate_pending_cnt >= RECORDER_ROTATE_PENDING_MAX;
+    bool index_full = rec->index_pending_cnt >= RECORDER_INDEX_PENDING_MAX;
+    xSemaphoreGive(rec->lock);
+    if (total > free_size || (*rotate && rotate_full) || (index && index_full)) {
+        if (!rec->dropped++) ESP_LOGW(TAG, "rec falls behind, dropping frames");
+        metrics_drop(METRICS_DROP_RECORDER, 1);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// the frame (header and data) at pos of the ring
+void recorder_frame_fill(recorder_t* rec, size_t pos, record_frame_header_t* hdr, const uint8_t* buf) {
+    uint8_t raw[RECORD_FRAME_HEADER_SIZE];
+    hdr->crc = record_crc32(0, buf, hdr->len);
+    record_frame_header_encode(hdr, raw);
+    pos = recorder_ring_write(rec, pos, raw, RECORD_FRAME_HEADER_SIZE);
+    recorder_ring_write(rec, pos, buf, hdr->len);
+}
+
+// books the frame at the head of the ring: segment rotation, seek index, counts
+void recorder_frame_book(recorder_t* rec, const record_frame_header_t* hdr, bool index, bool rotate) {
+    size_t total = RECORD_FRAME_HEADER_SIZE + hdr->len;
+    rec->head = (rec->head + total) % RECORDER_RING_SIZE;
+
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    if (rotate) {
+        recorder_rotate_t next = { rec->pushed, rec->push_seg_max_len };
+        rec->rotate_pending[rec->rotate_pending_cnt++] = next;
+        rec->push_seg_start = rec->pushed;
+        rec->push_seg_max_len = 0;
+        rec->push_seg_frames = 0;
+    }
+    if (rec->pushed == rec->push_seg_start) {
+        // every segment starts with an indexed frame
+        rec->push_seg_first_ts = hdr->timestamp;
+        index = true;
+    }
+    if (index) {
+        // recorder_frame_check() made room for it
+        recorder_index_t entry = { rec->pushed, hdr->timestamp, rec->push_seg_frames };
+        rec->index_pending[rec->index_pending_cnt++] = entry;
+    }
+    if (rec->push_seg_max_len < hdr->len) rec->push_seg_max_len = hdr->len;
+    rec->push_seg_frames++;
+    rec->pushed += total;
+    rec->used += total;
+    bool wakeup = rec->used >= RECORDER_BURST_SIZE || rotate;
+    xSemaphoreGive(rec->lock);
+
+    if (wakeup || index) xSemaphoreGive(rec->wakeup);
+}
+
+// Copies the frame into the ring and returns immediately, the frame is
+// dropped (and counted) when the writer has fallen behind.
+// Only the capture path pushes, so the free space can only grow meanwhile.
+esp_err_t recorder_push_frame(recorder_t* rec, record_frame_header_t* hdr, const uint8_t* buf, bool index) {
+    bool rotate;
+    esp_err_t err = recorder_frame_check(rec, hdr, index, &rotate);
+    if (err != ESP_OK) return err;
+    recorder_frame_fill(rec, rec->head, hdr, buf);
+    recorder_frame_book(rec, hdr, index, rotate);
+    return ESP_OK;
+}
+
+// Books the frame like recorder_push_frame() but only reserves its space at *pos,
+// the data is filled in later (recorder_frame_fill()), out of the capture path.
+// Call between recorder_hold() and recorder_release().
+esp_err_t recorder_reserve_frame(recorder_t* rec, const record_frame_header_t* hdr, bool index, size_t* pos) {
+    bool rotate;
+    esp_err_t err = recorder_frame_check(rec, hdr, index, &rotate);
+    if (err != ESP_OK) return err;
+    *pos = rec->head;
+    recorder_frame_book(rec, hdr, index, rotate);
+    return ESP_OK;
+}
+
+// the writer (and a flush) waits until the reserved frames are filled
+void recorder_hold(recorder_t* rec) {
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->held = true;
+    xSemaphoreGive(rec->lock);
+}
+
+void recorder_release(recorder_t* rec) {
+    xSemaphoreTake(rec->lock, portMAX_DELAY);
+    rec->held = false;
+    xSemaphoreGive(rec->lock);
+    xSemaphoreGive(rec->wakeup);
+}
+
+// ------------------------------------------------------
+// REPLAY BUFFERS
+// ------------------------------------------------------
+
+// Replayed frames are read into a fixed pool of frame buffers, sized from the
+// max_len of the segment headers, so replay does not allocate per frame.
+// The pool only grows (once per larger max_len) and is kept between replays.
+
+#define REPLAY_FB_POOL_SIZE 2
+#define REPLAY_FB_BUF_ALIGN 4096
+
+struct replay_fb_pool_s {
+    camera_fb_t fbs[REPLAY_FB_POOL_SIZE];
+    bool busy[REPLAY_FB_POOL_SIZE];
+    uint8_t* bufs; // REPLAY_FB_POOL_SIZE * buf_size
+    size_t buf_size;
+};
+
+typedef struct replay_fb_pool_s replay_fb_pool_t;
+
+void replay_fb_pool_init(replay_fb_pool_t* pool) {
+    pool->bufs = NULL;
+    pool->buf_size = 0;
+    for (int i=0; i<REPLAY_FB_POOL_SIZE; i++) pool->busy[i] = false;
+}
+
+// makes every buffer hold at least len bytes, fails while a buffer is taken
+esp_err_t replay_fb_pool_reserve(replay_fb_pool_t* pool, size_t len) {
+    if (len <= pool->buf_size) return ESP_OK;
+    for (int i=0; i<REPLAY_FB_POOL_SIZE; i++) if (pool->busy[i]) return ESP_ERR_INVALID_STATE;
+    size_t buf_size = (len + REPLAY_FB_BUF_ALIGN - 1) / REPLAY_FB_BUF_ALIGN * REPLAY_FB_BUF_ALIGN;
+    heap_caps_free(pool->bufs);
+    pool->bufs = heap_caps_malloc(REPLAY_FB_POOL_SIZE * buf_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!pool->bufs) {
+        ESP_LOGE(TAG, "replay pool alloc err: %u", REPLAY_FB_POOL_SIZE * buf_size);
+        pool->buf_size = 0;
+        return ESP_ERR_NO_MEM;
+    }
+    pool->buf_size = buf_size;
+    for (int i=0; i<REPLAY_FB_POOL_SIZE; i++) pool->fbs[i].buf = pool->bufs + i * buf_size;
+    ESP_LOGI(TAG, "replay pool: %u", buf_size);
+    return ESP_OK;
+}
+
+camera_fb_t* replay_fb_pool_take(replay_fb_pool_t* pool) {
+    for (int i=0; i<REPLAY_FB_POOL_SIZE; i++) {
+        if (!pool->busy[i]) {
+            pool->busy[i] = true;
+            return &pool->fbs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t replay_fb_pool_give(replay_fb_pool_t* pool, camera_fb_t* fb) {
+    for (int i=0; i<REPLAY_FB_POOL_SIZE; i++) {
+        if (fb == &pool->fbs[i] && pool->busy[i]) {
+            pool->busy[i] = false;
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+// ------------------------------------------------------
+// PREROLL
+// ------------------------------------------------------
+
+// The last PREROLL_DURATION_MS of JPEG frames are kept in a PSRAM ring while
+// not recording, and go to the recording ahead of the live frames when it starts,
+// so the seconds before a (late) alert are on the card too.
+// A frame never wraps around the ring end, the recorder takes it in one piece.
+// The handoff never waits for the card: the recorder ring space of the frames is
+// reserved with the capture lock taken, the copy runs after it (the oldest frames
+// that do not fit are dropped).
+
+#define PREROLL_DURATION_MS 3000
+#define PREROLL_RING_SIZE (1024 * 1024)
+#define PREROLL_FRAMES_MAX 64
+#define PREROLL_RECORDER_HEADROOM (RECORDER_RING_SIZE / 4) // left for the live frames
+
+struct preroll_frame_s {
+    size_t pos;
+    size_t rec_pos; // in the recorder ring, during the handoff
+    record_frame_header_t hdr;
+};
+
+typedef struct preroll_frame_s preroll_frame_t;
+
+struct preroll_s {
+    uint8_t* ring;
+    bool disabled; // no PSRAM for the ring
+    bool handoff;  // being copied to the recorder, nothing is pushed meanwhile
+    size_t head;
+    preroll_frame_t frames[PREROLL_FRAMES_MAX]; // fifo, oldest first
+    int first;
+    int cnt;
+};
+
+typedef struct preroll_s preroll_t;
+
+void preroll_clear(preroll_t* pre) {
+    pre->head = 0;
+    pre->first = 0;
+    pre->cnt = 0;
+}
+
+esp_err_t preroll_init(preroll_t* pre) {
+    if (pre->ring) return ESP_OK;
+    if (pre->disabled) return ESP_ERR_NO_MEM;
+    pre->ring = heap_caps_malloc(PREROLL_RING_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!pre->ring) {
+        ESP_LOGE(TAG, "preroll alloc err");
+        pre->disabled = true;
+        return ESP_ERR_NO_MEM;
+    }
+    preroll_clear(pre);
+    return ESP_OK;
+}
+
+preroll_frame_t* preroll_frame(preroll_t* pre, int n) {
+    return &pre->frames[(pre->first + n) % PREROLL_FRAMES_MAX];
+}
+
+void preroll_drop_oldest(preroll_t* pre) {
+    pre->first = (pre->first + 1) % PREROLL_FRAMES_MAX;
+    if (!--pre->cnt) pre->head = 0;
+}
+
+// gives where len bytes fit without overwriting kept frames, or -1
+long preroll_free_pos(preroll_t* pre, size_t len) {
+    if (!pre->cnt) return len <= PREROLL_RING_SIZE ? 0 : -1;
+    size_t tail = preroll_frame(pre, 0)->pos;
+    if (pre->head > tail) {
+        if (pre->head + len <= PREROLL_RING_SIZE) return pre->head;
+        return len <= tail ? 0 : -1;
+    }
+    return pre->head + len <= tail ? (long)pre->head : -1;
+}
+
+void preroll_push(preroll_t* pre, const record_frame_header_t* hdr, const uint8_t* buf) {
+    if (!pre->ring || hdr->format != PIXFORMAT_JPEG || hdr->len > PREROLL_RING_SIZE) return;
+    while (pre->cnt && (pre->cnt == PREROLL_FRAMES_MAX ||
+        hdr->timestamp - preroll_frame(pre, 0)->hdr.timestamp > PREROLL_DURATION_MS)) preroll_drop_oldest(pre);
+    long pos;
+    while ((pos = preroll_free_pos(pre, hdr->len)) < 0) preroll_drop_oldest(pre);
+    memcpy(pre->ring + pos, buf, hdr->len);
+    preroll_frame_t* frame = preroll_frame(pre, pre->cnt++);
+    frame->pos = pos;
+    frame->hdr = *hdr;
+    pre->head = pos + hdr->len;
+}
+
+// ------------------------------------------------------
+// DOWNLOAD
+// ------------------------------------------------------
+
+// /download exports a time range of the recordings as MJPEG AVI (see avi.h).
+// The frame table is built by walking the frame headers from the index entry
+// before the range, and kept for the next request of the same range, so a
+// resumed (HTTP Range) download does not walk the recordings again.
+
+#define DOWNLOAD_FRAMES_MAX (32 * 1024)
+
+struct download_s {
+    record_segments_t* segments; // the frame table's segments are busy while it is read
+    avi_frame_t* frames; // DOWNLOAD_FRAMES_MAX, PSRAM
+    avi_file_t avi;
+    bool valid;
+    uint64_t from;
+    uint64_t to;
+    // payload reader
+    FILE* file;
+    uint32_t segment;
+    long pos;
+};
+
+typedef struct download_s download_t;
+
+void download_init(download_t* dl, record_segments_t* segs) {
+    dl->segments = segs;
+    dl->frames = NULL;
+    dl->valid = false;
+    dl->file = NULL;
+}
+
+void download_close(download_t* dl) {
+    if (dl->file) fclose(dl->file);
+    dl->file = NULL;
+    record_segments_busy_clear(dl->segments, RECORD_READER_DOWNLOAD);
+}
+
+int download_read_payload(void* arg, const avi_frame_t* frame, uint32_t delta, uint8_t* buf, size_t len) {
+    download_t* dl = arg;
+    long pos = frame->offset + delta;
+    if (!dl->file || dl->segment != frame->src) {
+        // the busy range stays, it covers the whole table until download_close()
+        if (dl->file) fclose(dl->file);
+        dl->file = NULL;
+        char path[RECORD_PATH_SIZE];
+        record_segment_path(path, RECORD_VID_FMT, frame->src);
+        dl->file = fopen(path, "rb");
+        if (!dl->file) return AVI_ERR_READ;
+        dl->segment = frame->src;
+        dl->pos = -1;
+    }
+    if (dl->pos != pos && fseek(dl->file, pos, SEEK_SET)) return AVI_ERR_READ;
+    if (len != fread(buf, sizeof(uint8_t), len, dl->file)) {
+        dl->pos = -1;
+        return AVI_ERR_READ;
+    }
+    dl->pos = pos + len;
+    return 0;
+}
+
 // ------------------------------------------------------
 // CAMERA
 // ------------------------------------------------------
 
 struct camsys_camera_s {
-    FILE* file;
-    FILE* idxf;
+    bool recording;
+    bool event;      // a motion event started the recording, its end stops it
+    SemaphoreHandle_t lock; // recording start/stop/delete, from the main loop and the websocket task
+    FILE* file;      // segment open for replay
+    SemaphoreHandle_t replay_lock; // the replay position, moved by stream and seek commands
+    uint32_t segment;
+    long end;        // end of the frame data in the replay segment
+    uint32_t max_len;
+    uint32_t index_interval_ms; // time between seek index entries
+    uint64_t index_last_ts;
+    record_segments_t segments;
+    record_index_cache_t index;
+    replay_fb_pool_t replay_pool;
+    preroll_t preroll;
+    recorder_t recorder;
+    download_t download;
+    SemaphoreHandle_t capture_lock; // capture side: recorder/preroll push, recording start/stop
 };
 
 typedef struct camsys_camera_s camsys_camera_t;
 
-bool camsys_fb_hold = false;
+// Frame buffers: in camera mode the capture task is the only taker, it fans the
+// frames out to the stream, the recorder and the snapshot, which hold them by
+// reference count (see FRAME HUB). With fb_count >= 2 the driver captures into a
+// free buffer meanwhile. In motion mode the driver's single buffer goes to one
+// taker at a time, esp_camera_fb_get() waits until it is returned.
+
+#define CAMSYS_FB_COUNT_CAMERA 3   // JPEG, continuous capture into PSRAM buffers: latest, in use, capturing
+#define CAMSYS_FB_COUNT_MOTION 1   // the driver only runs continuously with JPEG
 
 void camera_recording_init(camsys_camera_t* camera) {
+    camera->recording = false;
+    camera->event = false;
+    camera->lock = xSemaphoreCreateMutex();
     camera->file = NULL;
-    camera->idxf = NULL;
+    camera->replay_lock = xSemaphoreCreateMutex();
+    camera->segment = 0;
+    camera->end = 0;
+    camera->max_len = 0;
+    camera->index_interval_ms = RECORD_INDEX_INTERVAL_MS;
+    camera->index_last_ts = 0;
+    record_segments_init(&camera->segments);
+    record_index_cache_init(&camera->index);
+    replay_fb_pool_init(&camera->replay_pool);
+    camera->preroll.ring = NULL;
+    camera->preroll.disabled = false;
+    camera->preroll.handoff = false;
+    camera->recorder.ring = NULL;
+    camera->recorder.active = false;
+    download_init(&camera->download, &camera->segments);
+    camera->capture_lock = xSemaphoreCreateMutex();
 }
 
-esp_err_t camera_recording_stop(camsys_camera_t* camera) {
-    esp_err_t ret = ESP_OK;
+// call with camera->lock taken
+esp_err_t camera_recording_stop_locked(camsys_camera_t* camera) {
+    camera->event = false;
+    if (!camera->recording) return ESP_OK;
     ESP_LOGI(TAG, "STP REC..");
-    while(camsys_fb_hold) ESP_LOGI(TAG, "FB HOLD..");
-    ESP_LOGI(TAG, "FCLOSE..");
-    if (fclose(camera->file) || fclose(camera->idxf)) ret = ESP_FAIL;
-    camera->file = NULL;
-    camera->idxf = NULL;
+    xSemaphoreTake(camera->capture_lock, portMAX_DELAY);
+    camera->recording = false;
+    xSemaphoreGive(camera->capture_lock);
+    esp_err_t ret = recorder_detach(&camera->recorder);
     ESP_LOGI(TAG, "REC STP.");
     return ret;
 }
 
+// every start continues in a new segment, a running recording is kept as is
+// capture path only, indexes a frame every index_interval_ms
+// buf NULL reserves the frame's space at *pos instead (see recorder_reserve_frame())
+esp_err_t camera_record_frame_at(camsys_camera_t* camera, record_frame_header_t* hdr, const uint8_t* buf, size_t* pos) {
+    // a dropped frame leaves index_last_ts as is, so the next one is indexed instead,
+    // a frame before it (the clock was set back) starts a new run and the interval over
+    int64_t delta = (int64_t)(hdr->timestamp - camera->index_last_ts);
+    bool index = delta < 0 || delta >= camera->index_interval_ms;
+    esp_err_t err = buf ? recorder_push_frame(&camera->recorder, hdr, buf, index) :
+        recorder_reserve_frame(&camera->recorder, hdr, index, pos);
+    if (err == ESP_OK) {
+        if (camera->max_len < hdr->len) camera->max_len = hdr->len;
+        if (index) camera->index_last_ts = hdr->timestamp;
+    }
+    return err;
+}
 
-esp_err_t camera_recording_open(camsys_camera_t* camera, const char* mode) {
-    if (camera->file && ESP_OK != camera_recording_stop(camera)) return ESP_FAIL;
-    
-    camera->file = fopen(SDCARD_MOUNT_POINT"/record.vid", mode);
-    if (!camera->file) {
-        ESP_LOGE(TAG, "fopen err: %d", errno);
-        return ESP_FAIL;
+esp_err_t camera_record_frame(camsys_camera_t* camera, record_frame_header_t* hdr, const uint8_t* buf) {
+    return camera_record_frame_at(camera, hdr, buf, NULL);
+}
+
+// Call with the capture lock taken and the recorder held: reserves the recorder
+// ring space of the newest preroll frames that fit, drops the others.
+void camera_preroll_reserve(camsys_camera_t* camera) {
+    preroll_t* pre = &camera->preroll;
+    size_t space = recorder_space(&camera->recorder);
+    size_t budget = space > PREROLL_RECORDER_HEADROOM ? space - PREROLL_RECORDER_HEADROOM : 0;
+    size_t total = 0;
+    int keep = 0;
+    while (keep < pre->cnt) {
+        size_t len = RECORD_FRAME_HEADER_SIZE + preroll_frame(pre, pre->cnt - 1 - keep)->hdr.len;
+        if (total + len > budget) break;
+        total += len;
+        keep++;
     }
+    if (keep < pre->cnt) ESP_LOGW(TAG, "preroll: %d frames dropped", pre->cnt - keep);
+    while (pre->cnt > keep) preroll_drop_oldest(pre);
+    int n = 0;
+    while (n < pre->cnt && ESP_OK == camera_record_frame_at(camera, &preroll_frame(pre, n)->hdr, NULL, &preroll_frame(pre, n)->rec_pos)) n++;
+    pre->cnt = n;
+    pre->handoff = true;
+}
 
-    if (mode[0] != 'r') {
-        camera->idxf = fopen(SDCARD_MOUNT_POINT"/record.idx", mode);
-        if (!camera->idxf) {
-            ESP_LOGE(TAG, "idx fopen err: %d", errno);
-            return ESP_FAIL;
+// copies the reserved frames, without the capture lock
+void camera_preroll_fill(camsys_camera_t* camera) {
+    preroll_t* pre = &camera->preroll;
+    for (int i=0; i<pre->cnt; i++) {
+        preroll_frame_t* frame = preroll_frame(pre, i);
+        recorder_frame_fill(&camera->recorder, frame->rec_pos, &frame->hdr, pre->ring + frame->pos);
+    }
+    ESP_LOGI(TAG, "preroll: %d frames", pre->cnt);
+}
+
+// call with camera->lock taken
+esp_err_t camera_recording_start_locked(camsys_camera_t* camera) {
+    if (camera->recording) return ESP_OK;
+    if (!camsys_clock_valid()) {
+        ESP_LOGW(TAG, "clock not set, no recording");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ESP_OK != recorder_init(&camera->recorder)) return ESP_FAIL;
+    if (ESP_OK != record_segments_scan(&camera->segments)) return ESP_FAIL;
+    if (ESP_OK != record_index_cache_load(&camera->index, &camera->segments)) return ESP_FAIL;
+    esp_err_t err = recorder_attach(&camera->recorder, &camera->segments, &camera->index);
+    if (err != ESP_OK) return err;
+    // the preroll goes first: its space is taken before any live frame is pushed
+    recorder_hold(&camera->recorder);
+    xSemaphoreTake(camera->capture_lock, portMAX_DELAY);
+    camera_preroll_reserve(camera);
+    camera->recording = true;
+    xSemaphoreGive(camera->capture_lock);
+    camera_preroll_fill(camera);
+    xSemaphoreTake(camera->capture_lock, portMAX_DELAY);
+    preroll_clear(&camera->preroll);
+    camera->preroll.handoff = false;
+    xSemaphoreGive(camera->capture_lock);
+    recorder_release(&camera->recorder);
+    return ESP_OK;
+}
+
+// A start by a motion event (event true) leaves a running recording to its owner,
+// a start by the server takes the recording over, so the event end does not stop it.
+esp_err_t camera_recording_start(camsys_camera_t* camera, bool event) {
+    xSemaphoreTake(camera->lock, portMAX_DELAY);
+    bool started = !camera->recording;
+    esp_err_t err = camera_recording_start_locked(camera);
+    if (err == ESP_OK && (started || !event)) camera->event = event;
+    xSemaphoreGive(camera->lock);
+    return err;
+}
+
+// the end of a motion event (event true) only stops the recording it started
+esp_err_t camera_recording_stop(camsys_camera_t* camera, bool event) {
+    xSemaphoreTake(camera->lock, portMAX_DELAY);
+    esp_err_t err = event && !camera->event ? ESP_OK : camera_recording_stop_locked(camera);
+    xSemaphoreGive(camera->lock);
+    return err;
+}
+
+#define RECORD_RECOVER_BUF_SIZE (64 * 1024)
+
+// repairs the segments left open by a reset, run at boot before recording
+esp_err_t camera_recording_recover(camsys_camera_t* camera) {
+    if (ESP_OK != record_segments_scan(&camera->segments)) return ESP_FAIL;
+    uint8_t* buf = heap_caps_malloc(RECORD_RECOVER_BUF_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!buf) {
+        ESP_LOGE(TAG, "recover alloc err");
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = ESP_OK;
+    for (uint32_t s=camera->segments.first; s<=camera->segments.last; s++) {
+        char path[RECORD_PATH_SIZE];
+        record_segment_path(path, RECORD_VID_FMT, s);
+        FILE* vid = fopen(path, "r+b");
+        if (!vid) continue;
+        record_segment_path(path, RECORD_IDX_FMT, s);
+        FILE* idx = fopen(path, "r+b");
+        if (!idx) idx = fopen(path, "w+b");
+        if (!idx) {
+            fclose(vid);
+            ret = ESP_FAIL;
+            continue;
+        }
+        record_recover_t rec;
+        int err = record_recover(vid, idx, camera->index_interval_ms, buf, RECORD_RECOVER_BUF_SIZE, &rec);
+        if (fclose(idx) || fclose(vid)) err = RECORD_ERR_IO;
+        if (err != RECORD_OK) {
+            ESP_LOGE(TAG, "recover %08u err: %s", s, record_strerror(err));
+            ret = ESP_FAIL;
+        } else if (rec.repaired) {
+            ESP_LOGW(TAG, "recovered %08u: synced %ld, end %ld, %u frames scanned", s, rec.committed, rec.end, rec.frames);
         }
     }
-    return ESP_OK;  
+    heap_caps_free(buf);
+    return ret;
+}
+
+esp_err_t camera_replay_close(camsys_camera_t* camera) {
+    if (!camera->file) return ESP_OK;
+    esp_err_t ret = fclose(camera->file) ? ESP_FAIL : ESP_OK;
+    camera->file = NULL;
+    record_segments_busy_clear(&camera->segments, RECORD_READER_REPLAY);
+    return ret;
+}
+
+// opens a segment for reading at its first frame, *end is the end of the frame data
+FILE* record_segment_open_read(uint32_t segment, record_file_header_t* hdr, long* end) {
+    char path[RECORD_PATH_SIZE];
+    record_segment_path(path, RECORD_VID_FMT, segment);
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    int err = record_read_file_header(f, hdr);
+    *end = -1;
+    if (err == RECORD_OK) {
+        if (hdr->data_len) *end = hdr->hdr_size + hdr->data_len;
+        else if (!fseek(f, 0L, SEEK_END)) *end = ftell(f);
+        if (*end < 0 || fseek(f, hdr->hdr_size, SEEK_SET)) err = RECORD_ERR_IO;
+    }
+    if (err != RECORD_OK) {
+        ESP_LOGE(TAG, "rec hdr err %s: %s", path, record_strerror(err));
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+esp_err_t camera_replay_open_segment(camsys_camera_t* camera, uint32_t segment) {
+    camera_replay_close(camera);
+    record_file_header_t hdr;
+    long end;
+    record_segments_busy_set(&camera->segments, RECORD_READER_REPLAY, segment, segment);
+    FILE* f = record_segment_open_read(segment, &hdr, &end);
+    if (!f) {
+        record_segments_busy_clear(&camera->segments, RECORD_READER_REPLAY);
+        return ESP_FAIL;
+    }
+    camera->file = f;
+    camera->segment = segment;
+    camera->end = end;
+    camera->max_len = hdr.max_len;
+    // segments without max_len (not closed) grow the pool in replay_fb_get()
+    if (hdr.max_len) replay_fb_pool_reserve(&camera->replay_pool, hdr.max_len);
+    return ESP_OK;
+}
+
+// opens the first readable segment after the given one
+esp_err_t camera_replay_next(camsys_camera_t* camera, uint32_t after) {
+    for (uint32_t s=after+1; s<=camera->segments.last; s++) {
+        if (ESP_OK == camera_replay_open_segment(camera, s)) return ESP_OK;
+    }
+    return ESP_FAIL;
 }
 
-esp_err_t camera_recording_start(camsys_camera_t* camera) {
-    return camera_recording_open(camera, "ab");
+esp_err_t camera_replay_open(camsys_camera_t* camera) {
+    if (!camera->recording && ESP_OK != record_segments_scan(&camera->segments)) return ESP_FAIL;
+    return camera_replay_next(camera, camera->segments.first - 1);
 }
 
+// Refused while a download is running (the /download task owns its file), a
+// running replay is closed under replay_lock and ends at its next frame.
 esp_err_t camera_recording_delete(camsys_camera_t* camera) {
-    esp_err_t err_open = camera_recording_open(camera, "w+");
-    esp_err_t err_stop = camera_recording_stop(camera);
-    return err_open ? err_open : err_stop;
+    record_segments_t* segs = &camera->segments;
+    xSemaphoreTake(camera->lock, portMAX_DELAY);
+    esp_err_t err_stop = camera_recording_stop_locked(camera);
+    xSemaphoreTake(camera->replay_lock, portMAX_DELAY);
+    esp_err_t err_close = camera_replay_close(camera);
+    esp_err_t err_scan = record_segments_scan(segs);
+    if (err_scan == ESP_OK) {
+        // a download setting its range meanwhile waits here and finds nothing left
+        xSemaphoreTake(segs->lock, portMAX_DELAY);
+        if (segs->busy[RECORD_READER_DOWNLOAD].first <= segs->busy[RECORD_READER_DOWNLOAD].last) err_scan = ESP_ERR_INVALID_STATE;
+        else {
+            for (uint32_t s=segs->first; s<=segs->last; s++) record_segment_remove(s);
+            segs->first = 1;
+            segs->last = 0;
+            record_index_cache_clear(&camera->index);
+            camera->download.valid = false;
+        }
+        xSemaphoreGive(segs->lock);
+    }
+    xSemaphoreGive(camera->replay_lock);
+    xSemaphoreGive(camera->lock);
+    return err_stop ? err_stop : (err_close ? err_close : err_scan);
+}
+
+// loads the index cache on the first query
+long camera_index_size(camsys_camera_t* camera) {
+    if (!camera->index.loaded && (
+        (!camera->recording && ESP_OK != record_segments_scan(&camera->segments)) ||
+        ESP_OK != record_index_cache_load(&camera->index, &camera->segments))) return -1;
+    return record_index_cache_size(&camera->index);
+}
+
+esp_err_t camera_replay_seek_offset(camsys_camera_t* camera, uint32_t segment, uint32_t offset) {
+    if ((!camera->file || camera->segment != segment) && ESP_OK != camera_replay_open_segment(camera, segment)) return ESP_FAIL;
+    return fseek(camera->file, offset, SEEK_SET) ? ESP_FAIL : ESP_OK;
+}
+
+// positions the replay to the n-th index entry counted over all segments
+esp_err_t camera_index_seek(camsys_camera_t* camera, long n) {
+    record_index_item_t item;
+    if (camera_index_size(camera) < 0) return ESP_FAIL;
+    esp_err_t err = record_index_cache_get(&camera->index, n, &item);
+    if (err != ESP_OK) return err;
+    return camera_replay_seek_offset(camera, item.segment, item.entry.offset);
+}
+
+// Positions the replay to the last frame at or before timestamp (ms since unix epoch):
+// the index cache is binary searched and the frames after the found entry
+// are stepped through by their headers.
+esp_err_t camera_seek(camsys_camera_t* camera, uint64_t timestamp) {
+    record_index_item_t item;
+    if (camera_index_size(camera) < 0) return ESP_FAIL;
+    esp_err_t err = record_index_cache_search(&camera->index, timestamp, &item);
+    if (err != ESP_OK) return err;
+    if (ESP_OK != camera_replay_seek_offset(camera, item.segment, item.entry.offset)) return ESP_FAIL;
+
+    long pos = item.entry.offset, next = pos;
+    record_frame_header_t hdr;
+    while (next < camera->end) {
+        if (RECORD_OK != record_read_frame_header(camera->file, &hdr) || hdr.timestamp > timestamp) break;
+        pos = next;
+        if (RECORD_OK != record_skip_frame_payload(camera->file, &hdr)) break;
+        next = ftell(camera->file);
+        if (next < 0) break;
+    }
+    return fseek(camera->file, pos, SEEK_SET) ? ESP_FAIL : ESP_OK;
+}
+
+// Keeps the segments of the kept frame table from eviction, false if one of them
+// went meanwhile (the table has to be built again).
+bool camera_download_hold(camsys_camera_t* camera) {
+    download_t* dl = &camera->download;
+    const avi_frame_t* frames = dl->avi.frames;
+    uint32_t cnt = dl->avi.frames_cnt;
+    record_segments_busy_set(&camera->segments, RECORD_READER_DOWNLOAD, frames[0].src, frames[cnt - 1].src);
+    for (uint32_t i=0; i<cnt; i++) {
+        if ((!i || frames[i].src != frames[i - 1].src) && !record_segment_exists(frames[i].src)) {
+            download_close(dl);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Builds the frame table of [from, to], timestamps in ms since unix epoch. Its
+// segments stay busy (not evicted) until download_close(), so the file does not
+// change under a response whose size went out already.
+esp_err_t camera_download_prepare(camsys_camera_t* camera, uint64_t from, uint64_t to) {
+    download_t* dl = &camera->download;
+    if (dl->valid && dl->from == from && dl->to == to && camera_download_hold(camera)) return ESP_OK;
+    dl->valid = false;
+    download_close(dl);
+    if (!dl->frames) dl->frames = heap_caps_malloc(DOWNLOAD_FRAMES_MAX * sizeof(avi_frame_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!dl->frames) {
+        ESP_LOGE(TAG, "download alloc err");
+        return ESP_ERR_NO_MEM;
+    }
+
+    record_index_item_t item;
+    if (camera_index_size(camera) <= 0) return ESP_ERR_NOT_FOUND;
+    if (ESP_OK != record_index_cache_search(&camera->index, from, &item) &&
+        ESP_OK != record_index_cache_get(&camera->index, 0, &item)) return ESP_ERR_NOT_FOUND;
+
+    // the walk may go on into segments recorded meanwhile, narrowed to the table below
+    record_segments_busy_set(&camera->segments, RECORD_READER_DOWNLOAD, item.segment, UINT32_MAX);
+    uint32_t cnt = 0;
+    uint16_t width = 0, height = 0;
+    uint64_t first = 0, last = 0;
+    bool done = false;
+    for (uint32_t s=item.segment; !done && s<=camera->segments.last; s++) {
+        record_file_header_t fhdr;
+        long end;
+        FILE* f = record_segment_open_read(s, &fhdr, &end);
+        if (!f) continue;
+        long pos = s == item.segment ? (long)item.entry.offset : (long)fhdr.hdr_size;
+        if (fseek(f, pos, SEEK_SET)) pos = end;
+        record_frame_header_t hdr;
+        while (pos < end && RECORD_OK == record_read_frame_header(f, &hdr)) {
+            if (hdr.timestamp > to || cnt == DOWNLOAD_FRAMES_MAX) {
+                done = true;
+                break;
+            }
+            if (hdr.timestamp >= from && hdr.format == PIXFORMAT_JPEG) {
+                if (!cnt) {
+                    width = hdr.width;
+                    height = hdr.height;
+                    first = hdr.timestamp;
+                }
+                last = hdr.timestamp;
+                dl->frames[cnt].src = s;
+                dl->frames[cnt].offset = pos + RECORD_FRAME_HEADER_SIZE;
+                dl->frames[cnt].len = hdr.len;
+                cnt++;
+            }
+            if (RECORD_OK != record_skip_frame_payload(f, &hdr)) break;
+            pos += RECORD_FRAME_HEADER_SIZE + hdr.len;
+        }
+        fclose(f);
+    }
+    if (!cnt) {
+        download_close(dl);
+        return ESP_ERR_NOT_FOUND;
+    }
+    record_segments_busy_set(&camera->segments, RECORD_READER_DOWNLOAD, dl->frames[0].src, dl->frames[cnt - 1].src);
+    if (cnt == DOWNLOAD_FRAMES_MAX) ESP_LOGW(TAG, "download cut at %u frames", cnt);
+
+    uint32_t usec_per_frame = cnt > 1 ? (uint32_t)((last - first) * 1000 / (cnt - 1)) : 100000;
+    avi_file_init(&dl->avi, dl->frames, cnt, width, height, usec_per_frame, download_read_payload, dl);
+    dl->from = from;
+    dl->to = to;
+    dl->valid = true;
+    ESP_LOGI(TAG, "download: %u frames, %u bytes", dl->avi.frames_cnt, dl->avi.size);
+    return ESP_OK;
 }
 
 // ------------------------------------------------------
 // MOTION
 // ------------------------------------------------------
 
+// In motion mode the watcher reads the 96x96 grayscale frames of the camera. In camera
+// mode the 1/8 scale thumbnail of the JPEG frames (the DC coefficients only, see
+// jpeg_dc.h) is resampled to the same 96x96 image every motion_ms, so the watch window
+// and threshold mean the same in both modes. Frames the DC decoder does not take are
+// fully decoded at 1/8 scale instead.
+
+#define MOTION_SIZE 96
+#define MOTION_DECODE_SIZE_MAX (200 * 150) // UXGA / 8
+
 struct camsys_motion_s {
-    
+    uint8_t* gray;        // MOTION_SIZE x MOTION_SIZE
+    uint8_t* decoded;     // luma of the 1/8 scale decode
+    uint16_t width;       // of decoded
+    uint16_t height;
+    int64_t last_us;
+};
+
+typedef struct camsys_motion_s camsys_motion_t;
+
+void camsys_motion_init(camsys_motion_t* motion) {
+    motion->gray = NULL;
+    motion->decoded = NULL;
+    motion->width = 0;
+    motion->height = 0;
+    motion->last_us = 0;
+}
+
+esp_err_t camsys_motion_reserve(camsys_motion_t* motion) {
+    if (!motion->gray) motion->gray = heap_caps_malloc(MOTION_SIZE * MOTION_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!motion->decoded) motion->decoded = heap_caps_malloc(MOTION_DECODE_SIZE_MAX, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!motion->gray || !motion->decoded) {
+        ESP_LOGE(TAG, "motion alloc err");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+struct camsys_motion_jpeg_s {
+    camsys_motion_t* motion;
+    const uint8_t* buf;
+    size_t len;
 };
 
-typedef struct camsys_motion_s camsys_motion_t;
+size_t camsys_motion_jpeg_read(void* arg, size_t index, uint8_t* buf, size_t len) {
+    struct camsys_motion_jpeg_s* jpeg = arg;
+    if (index + len > jpeg->len) len = jpeg->len - index;
+    if (buf) memcpy(buf, jpeg->buf + index, len);
+    return len;
+}
+
+// the decoder hands out RGB888 blocks, only the luma is kept
+bool camsys_motion_jpeg_write(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+    camsys_motion_t* motion = ((struct camsys_motion_jpeg_s*)arg)->motion;
+    if (!data) {
+        // called with the image size first (x = y = 0) and once at the end
+        if (!x && !y) {
+            if ((size_t)w * h > MOTION_DECODE_SIZE_MAX) return false;
+            motion->width = w;
+            motion->height = h;
+        }
+        return true;
+    }
+    for (int j=0; j<h; j++) {
+        uint8_t* dst = motion->decoded + (y + j) * motion->width + x;
+        for (int i=0; i<w; i++) {
+            dst[i] = (data[0] * 77 + data[1] * 150 + data[2] * 29) >> 8;
+            data += 3;
+        }
+    }
+    return true;
+}
+
+// decodes a JPEG frame into the MOTION_SIZE x MOTION_SIZE grayscale image
+esp_err_t camsys_motion_decode(camsys_motion_t* motion, const uint8_t* buf, size_t len) {
+    if (ESP_OK != camsys_motion_reserve(motion)) return ESP_ERR_NO_MEM;
+    jpeg_dc_info_t info;
+    int jerr = jpeg_dc_thumbnail(buf, len, motion->decoded, MOTION_DECODE_SIZE_MAX, &info);
+    if (jerr == JPEG_DC_OK) {
+        motion->width = info.thumb_width;
+        motion->height = info.thumb_height;
+    } else {
+        ESP_LOGD(TAG, "jpeg dc: %s", jpeg_dc_strerror(jerr));
+        struct camsys_motion_jpeg_s jpeg = { .motion = motion, .buf = buf, .len = len };
+        motion->width = motion->height = 0;
+        esp_err_t err = esp_jpg_decode(len, JPG_SCALE_8X, camsys_motion_jpeg_read, camsys_motion_jpeg_write, &jpeg);
+        if (err != ESP_OK) return ESP_FAIL;
+    }
+    if (!motion->width || !motion->height) return ESP_FAIL;
+    for (int y=0; y<MOTION_SIZE; y++) {
+        const uint8_t* src = motion->decoded + (y * motion->height / MOTION_SIZE) * motion->width;
+        uint8_t* dst = motion->gray + y * MOTION_SIZE;
+        for (int x=0; x<MOTION_SIZE; x++) dst[x] = src[x * motion->width / MOTION_SIZE];
+    }
+    return ESP_OK;
+}
 
 // ------------------------------------------------------
 // CAMSYS
@@ -424,6 +2101,7 @@ struct camsys_s {
     camsys_motion_t* motion;
 
     httpd_handle_t server;
+    httpd_handle_t stream_server; // /stream and /replay, see camsys_httpd_server_init()
 };
 
 typedef struct camsys_s camsys_t;
@@ -608,10 +2286,81 @@ void gpio_pins_init(uint64_t _pin_bit_mask) {
     .pixel_format = PIXFORMAT_JPEG, \
     .frame_size = FRAMESIZE_QVGA, \
     .jpeg_quality = 12, \
-    .fb_count = 1 \
+    .fb_count = CAMSYS_FB_COUNT_MOTION \
+};
+
+// camera mode settings, changed live by !CONFIG and kept in NVS
+
+#define CAMSYS_QUALITY_MIN 4    // esp32-camera: lower is better quality, larger frames
+#define CAMSYS_QUALITY_MAX 63
+#define CAMSYS_FPS_MAX 30
+#define CAMSYS_ABR_MS_MAX 5000  // target frame send time of the bitrate control
+#define CAMSYS_MOTION_MS_MIN 100
+#define CAMSYS_MOTION_MS_MAX 10000
+
+struct camsys_camera_settings_s {
+    framesize_t framesize;
+    int quality;
+    int fps;                    // 0: as fast as the sensor runs
+    int abr_ms;                 // target frame send time of the live stream, 0: no bitrate control
+    int motion_ms;              // motion detection interval, 0: off
+    framesize_t fb_framesize;   // the frame buffers were sized for these
+    int fb_quality;
+};
+
+typedef struct camsys_camera_settings_s camsys_camera_settings_t;
+
+camsys_camera_settings_t camsys_settings = {
+    .framesize = FRAMESIZE_QVGA,
+    .quality = 12,
+    .fps = 0,
+    .abr_ms = 200,
+    .motion_ms = 0,
+    .fb_framesize = FRAMESIZE_QVGA,
+    .fb_quality = 12,
+};
+
+struct camsys_framesize_name_s {
+    const char* name;
+    framesize_t framesize;
+};
+
+static const struct camsys_framesize_name_s camsys_framesize_names[] = {
+    { "96X96", FRAMESIZE_96X96 },
+    { "QQVGA", FRAMESIZE_QQVGA },
+    { "QCIF", FRAMESIZE_QCIF },
+    { "HQVGA", FRAMESIZE_HQVGA },
+    { "240X240", FRAMESIZE_240X240 },
+    { "QVGA", FRAMESIZE_QVGA },
+    { "CIF", FRAMESIZE_CIF },
+    { "HVGA", FRAMESIZE_HVGA },
+    { "VGA", FRAMESIZE_VGA },
+    { "SVGA", FRAMESIZE_SVGA },
+    { "XGA", FRAMESIZE_XGA },
+    { "HD", FRAMESIZE_HD },
+    { "SXGA", FRAMESIZE_SXGA },
+    { "UXGA", FRAMESIZE_UXGA },
 };
 
-void camsys_camera_init(bool mode, bool power_up) {
+#define CAMSYS_FRAMESIZE_NAMES (sizeof(camsys_framesize_names) / sizeof(camsys_framesize_names[0]))
+
+framesize_t camsys_framesize_parse(const char* name) {
+    for (int i=0; i<CAMSYS_FRAMESIZE_NAMES; i++) if (!strcasecmp(name, camsys_framesize_names[i].name)) return camsys_framesize_names[i].framesize;
+    return FRAMESIZE_INVALID;
+}
+
+const char* camsys_framesize_name(framesize_t framesize) {
+    for (int i=0; i<CAMSYS_FRAMESIZE_NAMES; i++) if (framesize == camsys_framesize_names[i].framesize) return camsys_framesize_names[i].name;
+    return "?";
+}
+
+// sensor settings and driver reinit, see the bitrate control
+SemaphoreHandle_t camsys_camera_lock = NULL;
+
+esp_err_t camsys_camera_init(bool mode, bool power_up) {
+    if (!camsys_camera_lock) camsys_camera_lock = xSemaphoreCreateMutex();
+    if (!camsys_camera_lock) return ESP_ERR_NO_MEM;
+
     //power up the camera if PWDN pin is defined
     if(power_up && CAM_PIN_PWDN != -1){
         pinMode(CAM_PIN_PWDN, OUTPUT);
@@ -621,8 +2370,9 @@ void camsys_camera_init(bool mode, bool power_up) {
     camera_config_t config = CAMSYS_CAMERA_CONFIG_DEFAULT();
     CAMSYS_BY_MODE({
         config.pixel_format = PIXFORMAT_JPEG;
-        config.frame_size = FRAMESIZE_QVGA;
-        config.jpeg_quality = 12;
+        config.frame_size = camsys_settings.framesize;
+        config.jpeg_quality = camsys_settings.quality;
+        config.fb_count = CAMSYS_FB_COUNT_CAMERA;
     }, {
         config.pixel_format = PIXFORMAT_GRAYSCALE;
         config.frame_size = FRAMESIZE_96X96;
@@ -630,7 +2380,17 @@ void camsys_camera_init(bool mode, bool power_up) {
     });    
 
     //initialize the camera
-    ESP_ERROR_CHECK( esp_camera_init(&config) );
+    esp_err_t err = esp_camera_init(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "camera init err: %d", err);
+        return err;
+    }
+    if (mode == CAMSYS_MODE_CAMERA) {
+        // the frame buffers are sized for these, see camsys_camera_configure()
+        camsys_settings.fb_framesize = camsys_settings.framesize;
+        camsys_settings.fb_quality = camsys_settings.quality;
+    }
+    return ESP_OK;
 }
 
 // --- nvs ---
@@ -648,6 +2408,61 @@ esp_err_t camsys_app_mode_load(nvs_handle_t handle, uint8_t* mode) {
     return err;
 }
 
+esp_err_t camsys_camera_settings_save(nvs_handle_t handle, const camsys_camera_settings_t* settings) {
+    esp_err_t err = nvs_set_u8(handle, "fsize", (uint8_t)settings->framesize);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "quality", (uint8_t)settings->quality);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "fps", (uint8_t)settings->fps);
+    if (err == ESP_OK) err = nvs_set_u16(handle, "abr", (uint16_t)settings->abr_ms);
+    if (err == ESP_OK) err = nvs_set_u16(handle, "motion", (uint16_t)settings->motion_ms);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t camsys_camera_settings_load(nvs_handle_t handle, camsys_camera_settings_t* settings) {
+    uint8_t framesize = settings->framesize, quality = settings->quality, fps = settings->fps;
+    uint16_t abr_ms = settings->abr_ms;
+    uint16_t motion_ms = settings->motion_ms;
+    esp_err_t err = nvs_get_u8(handle, "fsize", &framesize);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "quality", &quality);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "fps", &fps);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u16(handle, "abr", &abr_ms);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u16(handle, "motion", &motion_ms);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (err != ESP_OK) return err;
+    if (framesize < FRAMESIZE_INVALID) settings->framesize = framesize;
+    if (quality >= CAMSYS_QUALITY_MIN && quality <= CAMSYS_QUALITY_MAX) settings->quality = quality;
+    if (fps <= CAMSYS_FPS_MAX) settings->fps = fps;
+    if (abr_ms <= CAMSYS_ABR_MS_MAX) settings->abr_ms = abr_ms;
+    if (!motion_ms || (motion_ms >= CAMSYS_MOTION_MS_MIN && motion_ms <= CAMSYS_MOTION_MS_MAX)) settings->motion_ms = motion_ms;
+    return ESP_OK;
+}
+
+esp_err_t camsys_index_interval_save(nvs_handle_t handle, uint32_t interval_ms) {
+    esp_err_t err = nvs_set_u32(handle, "idx_ivl", interval_ms);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t camsys_index_interval_load(nvs_handle_t handle, uint32_t* interval_ms) {
+    esp_err_t err = nvs_get_u32(handle, "idx_ivl", interval_ms);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    return err;
+}
+
+esp_err_t camsys_fill_level_save(nvs_handle_t handle, uint8_t fill_level) {
+    esp_err_t err = nvs_set_u8(handle, "rec_fill", fill_level);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t camsys_fill_level_load(nvs_handle_t handle, uint8_t* fill_level) {
+    uint8_t level = *fill_level;
+    esp_err_t err = nvs_get_u8(handle, "rec_fill", &level);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (err == ESP_OK && level >= RECORD_FILL_LEVEL_MIN && level <= RECORD_FILL_LEVEL_MAX) *fill_level = level;
+    return err;
+}
+
 
 // ---------------------------------------------------------------
 // CAMSYS APP (streaming)
@@ -660,47 +2475,487 @@ static const char* CAMSYS_CAMERA_STREAM_PART = "Content-Type: image/jpeg\r\nCont
 
 wifi_app_t* _app = NULL;
 
-#define RECORD_INDEX_CONTER_MAX 100
-int record_index_cnt = 0;
+// fb->timestamp is relative to boot, records store wall-clock time
+uint64_t camsys_fb_timestamp_ms(camera_fb_t* fb) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t boot_us = (int64_t)now.tv_sec * 1000000LL + now.tv_usec - esp_timer_get_time();
+    int64_t fb_us = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+    return (uint64_t)((boot_us + fb_us) / 1000LL);
+}
+
+// time since the frame was captured
+int64_t camsys_fb_age_us(camera_fb_t* fb) {
+    return esp_timer_get_time() - ((int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec);
+}
 
+// motion mode, camera mode frames come from the capture task (see FRAME HUB)
 camera_fb_t * camsys_fb_get(wifi_app_t* app) {
-    while(camsys_fb_hold);
-    camsys_fb_hold = true;
-    camera_fb_t * fb = esp_camera_fb_get();    
-    if (fb && app->ext->sys->mode == CAMSYS_MODE_CAMERA && app->ext->sys->camera->file) {
-
-        record_index_cnt--;
-        if (record_index_cnt<=0) {
-            record_index_cnt = RECORD_INDEX_CONTER_MAX;
-            long int pos = ftell(app->ext->sys->camera->file);
-            if (pos == 1L) ESP_LOGW(TAG, "Index retr fail");
-            else {
-                ESP_LOGI(TAG, "idxf(%d)", !!app->ext->sys->camera->idxf);
-                if (1 != fwrite(&pos, sizeof(long int), 1, app->ext->sys->camera->idxf)) 
-                    ESP_LOGW(TAG, "Index write fail: err: %d", ferror(app->ext->sys->camera->idxf));
-            }
+    camera_fb_t * fb = esp_camera_fb_get();
+    if (fb) metrics_observe(METRICS_CAPTURE, camsys_fb_age_us(fb));
+    return fb;
+}
+
+// capture path of camera mode: records the frame, or keeps it in the preroll
+void camsys_camera_capture_frame(camsys_camera_t* camera, camera_fb_t* fb) {
+    if (!camsys_clock_valid()) return;
+    record_frame_header_t hdr = {
+        .len = fb->len,
+        .timestamp = camsys_fb_timestamp_ms(fb),
+        .width = fb->width,
+        .height = fb->height,
+        .format = fb->format,
+        .flags = fb->format == PIXFORMAT_JPEG ? RECORD_FRAME_FLAG_KEY : 0,
+    };
+    xSemaphoreTake(camera->capture_lock, portMAX_DELAY);
+    if (camera->recording) camera_record_frame(camera, &hdr, fb->buf);
+    else if (!camera->preroll.handoff && ESP_OK == preroll_init(&camera->preroll)) preroll_push(&camera->preroll, &hdr, fb->buf);
+    xSemaphoreGive(camera->capture_lock);
+}
+
+esp_err_t camsys_fb_return(camera_fb_t * fb) {
+    if (!fb) return ESP_FAIL;
+    esp_camera_fb_return(fb);
+    return ESP_OK;
+}
+
+// ------------------------------------------------------
+// BITRATE CONTROL
+// ------------------------------------------------------
+
+// While a live stream runs, the time to send a frame is tracked (EMA). Above the
+// target the JPEG quality is lowered, then the frame size; well below it they step
+// back up towards the configured settings, which are never exceeded. Steps down
+// wait ABR_HOLD_FRAMES, steps up twice as long, so the setpoint does not oscillate.
+// The sensor is shared, so recordings made during a degraded stream degrade too.
+// The stream task and !CONFIG (websocket task) both set the sensor, and !CONFIG may
+// reinitialize the camera: camsys_camera_lock serializes every sensor access and the
+// bitrate state. A stream viewer releases its frame before it waits for the lock, so
+// a reinit (which waits for every frame to come back) never waits on it.
+
+#define ABR_HIGH_PCT 150
+#define ABR_LOW_PCT 50
+#define ABR_EMA_SHIFT 2          // weight of a new sample: 1/4
+#define ABR_HOLD_FRAMES 10
+#define ABR_QUALITY_STEP 5
+#define ABR_QUALITY_WORST 40     // larger numbers hardly shrink the frames further
+#define ABR_FRAMESIZE_MIN FRAMESIZE_QQVGA
+
+struct abr_s {
+    bool active;
+    int send_ms;             // EMA of the frame send time, << ABR_EMA_SHIFT
+    uint32_t frame_bytes;    // last frame size
+    int hold;
+    int quality;             // setpoint
+    framesize_t framesize;
+};
+
+typedef struct abr_s abr_t;
+
+abr_t camsys_abr = { .active = false };
+
+int abr_send_ms(const abr_t* abr) {
+    return abr->send_ms >> ABR_EMA_SHIFT;
+}
+
+// call with camsys_camera_lock taken
+esp_err_t abr_apply(abr_t* abr, int quality, framesize_t framesize) {
+    sensor_t* sensor = esp_camera_sensor_get();
+    if (!sensor) return ESP_FAIL;
+    if (framesize != abr->framesize && sensor->set_framesize(sensor, framesize)) return ESP_FAIL;
+    abr->framesize = framesize;
+    if (quality != abr->quality && sensor->set_quality(sensor, quality)) return ESP_FAIL;
+    abr->quality = quality;
+    ESP_LOGI(TAG, "abr: %s q%d (send %d ms)", camsys_framesize_name(framesize), quality, abr_send_ms(abr));
+    return ESP_OK;
+}
+
+// next frame size up or down, never above the configured one. 240x240 is skipped
+// to keep the aspect ratio, unless it is the configured size.
+framesize_t abr_framesize_step(framesize_t framesize, int dir) {
+    framesize += dir;
+    if (framesize == FRAMESIZE_240X240 && framesize != camsys_settings.framesize) framesize += dir;
+    if (framesize > camsys_settings.framesize) framesize = camsys_settings.framesize;
+    return framesize;
+}
+
+// starts from the configured settings, call with camsys_camera_lock taken
+void abr_start_locked(abr_t* abr) {
+    abr->active = camsys_settings.abr_ms > 0;
+    abr->send_ms = camsys_settings.abr_ms << ABR_EMA_SHIFT;
+    abr->frame_bytes = 0;
+    abr->hold = ABR_HOLD_FRAMES;
+    abr->quality = camsys_settings.quality;
+    abr->framesize = camsys_settings.framesize;
+}
+
+void abr_start(abr_t* abr) {
+    xSemaphoreTake(camsys_camera_lock, portMAX_DELAY);
+    abr_start_locked(abr);
+    xSemaphoreGive(camsys_camera_lock);
+}
+
+// restores the configured settings, call with camsys_camera_lock taken
+void abr_stop_locked(abr_t* abr) {
+    if (!abr->active) return;
+    abr->active = false;
+    if (abr->quality != camsys_settings.quality || abr->framesize != camsys_settings.framesize) {
+        if (ESP_OK != abr_apply(abr, camsys_settings.quality, camsys_settings.framesize)) ESP_LOGE(TAG, "abr restore err");
+    }
+}
+
+void abr_stop(abr_t* abr) {
+    xSemaphoreTake(camsys_camera_lock, portMAX_DELAY);
+    abr_stop_locked(abr);
+    xSemaphoreGive(camsys_camera_lock);
+}
+
+// call with camsys_camera_lock taken
+void abr_update_locked(abr_t* abr, int64_t send_us, uint32_t bytes) {
+    if (!abr->active) return;
+    int ms = (int)(send_us / 1000);
+    abr->send_ms += ms - (abr->send_ms >> ABR_EMA_SHIFT);
+    abr->frame_bytes = bytes;
+    if (abr->hold > 0) {
+        abr->hold--;
+        return;
+    }
+    int target = camsys_settings.abr_ms;
+    int avg = abr_send_ms(abr);
+    int quality = abr->quality;
+    framesize_t framesize = abr->framesize;
+    if (avg * 100 > target * ABR_HIGH_PCT) {
+        if (quality + ABR_QUALITY_STEP <= ABR_QUALITY_WORST) quality += ABR_QUALITY_STEP;
+        else if (framesize > ABR_FRAMESIZE_MIN) framesize = abr_framesize_step(framesize, -1);
+        else return;
+        abr->hold = ABR_HOLD_FRAMES;
+    } else if (avg * 100 < target * ABR_LOW_PCT) {
+        if (framesize < camsys_settings.framesize) framesize = abr_framesize_step(framesize, 1);
+        else if (quality - ABR_QUALITY_STEP >= camsys_settings.quality) quality -= ABR_QUALITY_STEP;
+        else if (quality > camsys_settings.quality) quality = camsys_settings.quality;
+        else return;
+        abr->hold = 2 * ABR_HOLD_FRAMES;
+    } else return;
+    if (ESP_OK != abr_apply(abr, quality, framesize)) ESP_LOGE(TAG, "abr apply err");
+}
+
+// called after every live frame sent, without a frame held
+void abr_update(abr_t* abr, int64_t send_us, uint32_t bytes) {
+    xSemaphoreTake(camsys_camera_lock, portMAX_DELAY);
+    abr_update_locked(abr, send_us, bytes);
+    xSemaphoreGive(camsys_camera_lock);
+}
+
+// ------------------------------------------------------
+// FRAME HUB
+// ------------------------------------------------------
+
+// One capture task takes every camera frame and publishes it to the consumers: the
+// recorder/preroll (copied in the capture task), the live stream viewers, and the
+// snapshot, which is the latest frame itself. A frame goes back to the driver when it
+// is no longer the latest one and its last consumer has released it.
+
+#define CAMSYS_FRAME_CONSUMERS_MAX 4
+#define CAMSYS_FRAME_WAIT_MS 1000
+#define CAPTURE_TASK_STACK_SIZE 4096
+#define CAPTURE_TASK_PRIORITY 5
+#define CAPTURE_RETRY_MS 100
+
+struct camsys_frame_s {
+    camera_fb_t* fb;   // NULL if the slot is free
+    int refs;          // consumers holding the frame
+    uint32_t seq;
+};
+
+typedef struct camsys_frame_s camsys_frame_t;
+
+struct camsys_frame_consumer_s {
+    SemaphoreHandle_t ready; // given on every published frame
+    uint32_t seq;            // last frame taken
+};
+
+typedef struct camsys_frame_consumer_s camsys_frame_consumer_t;
+
+struct camsys_frame_hub_s {
+    SemaphoreHandle_t lock;
+    camsys_frame_t frames[CAMSYS_FB_COUNT_CAMERA];
+    camsys_frame_t* latest;
+    uint32_t seq;
+    camsys_frame_consumer_t* consumers[CAMSYS_FRAME_CONSUMERS_MAX];
+    TaskHandle_t task;
+    wifi_app_t* app;
+    int64_t frame_interval_us;  // frames coming in faster are dropped (fps limit)
+    int64_t last_us;
+    bool pause;                 // the capture task stops, e.g. while the camera is reinitialized
+    SemaphoreHandle_t paused;
+    SemaphoreHandle_t resume;
+};
+
+typedef struct camsys_frame_hub_s camsys_frame_hub_t;
+
+camsys_frame_hub_t camsys_frames = { .lock = NULL, .task = NULL };
+
+// called with the lock held
+void camsys_frame_hub_free(camsys_frame_hub_t* hub, camsys_frame_t* frame) {
+    if (!frame || frame->refs || frame == hub->latest) return;
+    esp_camera_fb_return(frame->fb);
+    frame->fb = NULL;
+}
+
+void camsys_frame_hub_publish(camsys_frame_hub_t* hub, camera_fb_t* fb) {
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    camsys_frame_t* frame = NULL;
+    for (int i=0; i<CAMSYS_FB_COUNT_CAMERA; i++) if (!hub->frames[i].fb) {
+        frame = &hub->frames[i];
+        break;
+    }
+    if (!frame) {
+        // the driver never hands out more than fb_count buffers
+        xSemaphoreGive(hub->lock);
+        ESP_LOGE(TAG, "frame hub full");
+        esp_camera_fb_return(fb);
+        metrics_drop(METRICS_DROP_HUB, 1);
+        return;
+    }
+    frame->fb = fb;
+    frame->refs = 0;
+    frame->seq = ++hub->seq;
+    camsys_frame_t* prev = hub->latest;
+    hub->latest = frame;
+    camsys_frame_hub_free(hub, prev);
+    for (int i=0; i<CAMSYS_FRAME_CONSUMERS_MAX; i++) if (hub->consumers[i]) xSemaphoreGive(hub->consumers[i]->ready);
+    xSemaphoreGive(hub->lock);
+}
+
+void camsys_capture_task(void* arg) {
+    camsys_frame_hub_t* hub = arg;
+    camsys_camera_t* camera = hub->app->ext->sys->camera;
+    while (true) {
+        if (hub->pause) {
+            xSemaphoreGive(hub->paused);
+            xSemaphoreTake(hub->resume, portMAX_DELAY);
+            continue;
+        }
+        camera_fb_t* fb = esp_camera_fb_get();
+        if (!fb) {
+            ESP_LOGE(TAG, "Cam capture fail");
+            vTaskDelay(pdMS_TO_TICKS(CAPTURE_RETRY_MS));
+            continue;
+        }
+        metrics_observe(METRICS_CAPTURE, camsys_fb_age_us(fb));
+        int64_t now_us = esp_timer_get_time();
+        if (hub->frame_interval_us && now_us - hub->last_us < hub->frame_interval_us) {
+            esp_camera_fb_return(fb);
+            metrics_drop(METRICS_DROP_FPS, 1);
+            continue;
         }
+        hub->last_us = now_us;
+        camsys_camera_capture_frame(camera, fb);
+        camsys_frame_hub_publish(hub, fb);
+    }
+}
+
+esp_err_t camsys_frame_hub_start(camsys_frame_hub_t* hub, wifi_app_t* app) {
+    if (hub->task) return ESP_OK;
+    hub->lock = xSemaphoreCreateMutex();
+    hub->paused = xSemaphoreCreateBinary();
+    hub->resume = xSemaphoreCreateBinary();
+    if (!hub->lock || !hub->paused || !hub->resume) return ESP_ERR_NO_MEM;
+    hub->pause = false;
+    hub->last_us = 0;
+    hub->frame_interval_us = camsys_settings.fps ? 1000000LL / camsys_settings.fps : 0;
+    for (int i=0; i<CAMSYS_FB_COUNT_CAMERA; i++) hub->frames[i].fb = NULL;
+    for (int i=0; i<CAMSYS_FRAME_CONSUMERS_MAX; i++) hub->consumers[i] = NULL;
+    hub->latest = NULL;
+    hub->seq = 0;
+    hub->app = app;
+    if (pdPASS != xTaskCreate(camsys_capture_task, "capture", CAPTURE_TASK_STACK_SIZE, hub, CAPTURE_TASK_PRIORITY, &hub->task)) {
+        ESP_LOGE(TAG, "capture task err");
+        hub->task = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
 
-        ESP_LOGI(TAG, "write frame structure..");
-        size_t written = fwrite(fb, sizeof(camera_fb_t), 1, app->ext->sys->camera->file);
-        if (written != 1) {
-            ESP_LOGW(TAG, "write err: %d != 1, err: %d", written, ferror(app->ext->sys->camera->file));
+esp_err_t camsys_frame_consumer_add(camsys_frame_hub_t* hub, camsys_frame_consumer_t* consumer) {
+    if (!hub->task) return ESP_FAIL;
+    consumer->ready = xSemaphoreCreateBinary();
+    if (!consumer->ready) return ESP_ERR_NO_MEM;
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    consumer->seq = hub->latest ? hub->latest->seq : 0;
+    for (int i=0; i<CAMSYS_FRAME_CONSUMERS_MAX; i++) if (!hub->consumers[i]) {
+        hub->consumers[i] = consumer;
+        xSemaphoreGive(hub->lock);
+        return ESP_OK;
+    }
+    xSemaphoreGive(hub->lock);
+    vSemaphoreDelete(consumer->ready);
+    ESP_LOGE(TAG, "too many frame consumers");
+    return ESP_FAIL;
+}
+
+void camsys_frame_consumer_remove(camsys_frame_hub_t* hub, camsys_frame_consumer_t* consumer) {
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    for (int i=0; i<CAMSYS_FRAME_CONSUMERS_MAX; i++) if (hub->consumers[i] == consumer) hub->consumers[i] = NULL;
+    xSemaphoreGive(hub->lock);
+    vSemaphoreDelete(consumer->ready);
+}
+
+// takes a reference to the latest frame, NULL if there is none
+camsys_frame_t* camsys_frame_snapshot(camsys_frame_hub_t* hub) {
+    if (!hub->task) return NULL;
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    camsys_frame_t* frame = hub->latest;
+    if (frame) frame->refs++;
+    xSemaphoreGive(hub->lock);
+    return frame;
+}
+
+// waits for a frame newer than the one the consumer took last and takes a reference
+camsys_frame_t* camsys_frame_acquire(camsys_frame_hub_t* hub, camsys_frame_consumer_t* consumer) {
+    while (true) {
+        xSemaphoreTake(hub->lock, portMAX_DELAY);
+        camsys_frame_t* frame = hub->latest;
+        if (frame && frame->seq != consumer->seq) {
+            frame->refs++;
+            if (consumer->seq && frame->seq - consumer->seq > 1) metrics_drop(METRICS_DROP_VIEWER, frame->seq - consumer->seq - 1);
+            consumer->seq = frame->seq;
+            xSemaphoreGive(hub->lock);
+            return frame;
         }
-        else {
-            ESP_LOGI(TAG, "write frame buffer..");
-            written = fwrite(fb->buf, sizeof(uint8_t), fb->len, app->ext->sys->camera->file);
-            if (written != fb->len) {
-                ESP_LOGW(TAG, "write err: %d != fb->len: %d, err: %d", written, fb->len, ferror(app->ext->sys->camera->file));
+        xSemaphoreGive(hub->lock);
+        if (pdTRUE != xSemaphoreTake(consumer->ready, pdMS_TO_TICKS(CAMSYS_FRAME_WAIT_MS))) {
+            ESP_LOGW(TAG, "frame wait timeout");
+            return NULL;
+        }
+    }
+}
+
+void camsys_frame_release(camsys_frame_hub_t* hub, camsys_frame_t* frame) {
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    frame->refs--;
+    camsys_frame_hub_free(hub, frame);
+    xSemaphoreGive(hub->lock);
+}
+
+#define CAMSYS_FRAME_DRAIN_MS 2000
+#define CAMSYS_FRAME_DRAIN_STEP_MS 10
+
+// stops the capture task and waits until every frame went back to the driver
+esp_err_t camsys_frame_hub_pause(camsys_frame_hub_t* hub) {
+    if (!hub->task) return ESP_OK;
+    hub->pause = true;
+    if (pdTRUE != xSemaphoreTake(hub->paused, pdMS_TO_TICKS(CAMSYS_FRAME_DRAIN_MS))) {
+        hub->pause = false;
+        return ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreTake(hub->lock, portMAX_DELAY);
+    camsys_frame_t* latest = hub->latest;
+    hub->latest = NULL;
+    camsys_frame_hub_free(hub, latest);
+    xSemaphoreGive(hub->lock);
+    for (int waited = 0; waited < CAMSYS_FRAME_DRAIN_MS; waited += CAMSYS_FRAME_DRAIN_STEP_MS) {
+        bool drained = true;
+        xSemaphoreTake(hub->lock, portMAX_DELAY);
+        for (int i=0; i<CAMSYS_FB_COUNT_CAMERA; i++) if (hub->frames[i].fb) drained = false;
+        xSemaphoreGive(hub->lock);
+        if (drained) return ESP_OK;
+        vTaskDelay(pdMS_TO_TICKS(CAMSYS_FRAME_DRAIN_STEP_MS));
+    }
+    ESP_LOGE(TAG, "frames still in use");
+    return ESP_ERR_TIMEOUT;
+}
+
+void camsys_frame_hub_resume(camsys_frame_hub_t* hub) {
+    if (!hub->task || !hub->pause) return;
+    hub->pause = false;
+    xSemaphoreGive(hub->resume);
+}
+
+// call with camsys_camera_lock taken
+esp_err_t camsys_camera_configure_locked(camsys_frame_hub_t* hub, const camsys_camera_settings_t* next) {
+    esp_err_t err = ESP_OK;
+    // the sensor goes back to the configured settings before they change
+    bool abr = camsys_abr.active;
+    abr_stop_locked(&camsys_abr);
+    bool grow = next->framesize > camsys_settings.fb_framesize || next->quality < camsys_settings.fb_quality;
+    if (grow) {
+        err = camsys_frame_hub_pause(hub);
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "camera reinit: %s q%d", camsys_framesize_name(next->framesize), next->quality);
+            framesize_t framesize = camsys_settings.framesize;
+            int quality = camsys_settings.quality;
+            esp_camera_deinit();
+            camsys_settings.framesize = next->framesize;
+            camsys_settings.quality = next->quality;
+            err = camsys_camera_init(CAMSYS_MODE_CAMERA, false);
+            if (err != ESP_OK) {
+                // the larger frame buffers did not fit, go back to the ones that did
+                ESP_LOGW(TAG, "camera reinit failed, back to %s q%d", camsys_framesize_name(framesize), quality);
+                esp_camera_deinit();
+                camsys_settings.framesize = framesize;
+                camsys_settings.quality = quality;
+                ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_camera_init(CAMSYS_MODE_CAMERA, false) );
             }
         }
+        camsys_frame_hub_resume(hub);
+        if (err != ESP_OK) {
+            if (abr) abr_start_locked(&camsys_abr);
+            return err;
+        }
+    } else {
+        sensor_t* sensor = esp_camera_sensor_get();
+        if (!sensor) return ESP_FAIL;
+        if (next->framesize != camsys_settings.framesize && sensor->set_framesize(sensor, next->framesize)) err = ESP_FAIL;
+        if (next->quality != camsys_settings.quality && sensor->set_quality(sensor, next->quality)) err = ESP_FAIL;
+        if (err != ESP_OK) return err;
+        camsys_settings.framesize = next->framesize;
+        camsys_settings.quality = next->quality;
     }
-    return fb;
+    camsys_settings.fps = next->fps;
+    camsys_settings.abr_ms = next->abr_ms;
+    camsys_settings.motion_ms = next->motion_ms;
+    hub->frame_interval_us = next->fps ? 1000000LL / next->fps : 0;
+    if (abr) abr_start_locked(&camsys_abr);
+    return ESP_OK;
 }
 
-esp_err_t camsys_fb_return(camera_fb_t * fb) {
-    if(!camsys_fb_hold) return ESP_FAIL;
-    esp_camera_fb_return(fb);
-    camsys_fb_hold = false;
+// applies the camera settings live. The sensor switches frame size and quality on
+// the fly, the driver is reinitialized only when the frame buffers have to grow.
+esp_err_t camsys_camera_configure(camsys_frame_hub_t* hub, const camsys_camera_settings_t* next) {
+    xSemaphoreTake(camsys_camera_lock, portMAX_DELAY);
+    esp_err_t err = camsys_camera_configure_locked(hub, next);
+    xSemaphoreGive(camsys_camera_lock);
+    return err;
+}
+
+// parses "framesize=<name> quality=<4..63> fps=<0..30> abr=<ms> motion=<ms>", every key is optional
+esp_err_t camsys_camera_settings_parse(const char* params, camsys_camera_settings_t* settings) {
+    char buff[100];
+    strncpy(buff, params, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buff, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        char* val = strchr(tok, '=');
+        if (!val) return ESP_ERR_INVALID_ARG;
+        *val++ = '\0';
+        if (!strcmp(tok, "framesize")) {
+            settings->framesize = camsys_framesize_parse(val);
+            if (settings->framesize == FRAMESIZE_INVALID) return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "quality")) {
+            settings->quality = atoi(val);
+            if (settings->quality < CAMSYS_QUALITY_MIN || settings->quality > CAMSYS_QUALITY_MAX) return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "fps")) {
+            settings->fps = atoi(val);
+            if (settings->fps < 0 || settings->fps > CAMSYS_FPS_MAX) return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "abr")) {
+            settings->abr_ms = atoi(val);
+            if (settings->abr_ms < 0 || settings->abr_ms > CAMSYS_ABR_MS_MAX) return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "motion")) {
+            settings->motion_ms = atoi(val);
+            if (settings->motion_ms && (settings->motion_ms < CAMSYS_MOTION_MS_MIN || settings->motion_ms > CAMSYS_MOTION_MS_MAX)) return ESP_ERR_INVALID_ARG;
+        } else return ESP_ERR_INVALID_ARG;
+    }
     return ESP_OK;
 }
 
@@ -727,43 +2982,124 @@ bool camsys_check_secret(wifi_app_t* app, httpd_req_t* req) {
     return secret_ok;
 }
 
-camera_fb_t * replay_fb_get(wifi_app_t* app) {
-    camera_fb_t* fb = malloc(sizeof(camera_fb_t));
-    if (!fb) {
-        ESP_LOGE(TAG, "mem alloc fb err");
+camera_fb_t * replay_fb_get_locked(wifi_app_t* app) {
+    camsys_camera_t* camera = app->ext->sys->camera;
+    if (!camera->file) {
+        ESP_LOGE(TAG, "rec file is not open");
         return NULL;
     }
-    FILE* f = app->ext->sys->camera->file;
-    if (!f) {
-        ESP_LOGE(TAG, "rec file is not open");
-        free(fb);
+    // continue in the next segment at the end of the frame data
+    if (ftell(camera->file) >= camera->end && ESP_OK != camera_replay_next(camera, camera->segment)) {
+        ESP_LOGI(TAG, "rec end");
+        return NULL;
+    }
+    FILE* f = camera->file;
+    record_frame_header_t hdr;
+    int err = record_read_frame_header(f, &hdr);
+    if (err != RECORD_OK) {
+        ESP_LOGE(TAG, "rec fb read err: %s", record_strerror(err));
         return NULL;
     }
-    if (1 != fread(fb, sizeof(camera_fb_t), 1, f)) {
-        ESP_LOGE(TAG, "rec fb read err");
-        free(fb);
+    if (ESP_OK != replay_fb_pool_reserve(&camera->replay_pool, hdr.len)) {
+        ESP_LOGE(TAG, "replay fb too large: %u", hdr.len);
         return NULL;
     }
-    fb->buf = malloc(fb->len);
+    camera_fb_t* fb = replay_fb_pool_take(&camera->replay_pool);
     if (!fb) {
-        ESP_LOGE(TAG, "mem alloc fb->buf err");
-        free(fb);
+        ESP_LOGE(TAG, "replay pool empty");
         return NULL;
     }
-    if (fb->len != fread(fb->buf, sizeof(uint8_t), fb->len, f)) {
-        ESP_LOGE(TAG, "rec fb->buf read err");
-        free(fb->buf);
-        free(fb);
+    fb->len = hdr.len;
+    fb->width = hdr.width;
+    fb->height = hdr.height;
+    fb->format = hdr.format;
+    fb->timestamp.tv_sec = hdr.timestamp / 1000;
+    fb->timestamp.tv_usec = (hdr.timestamp % 1000) * 1000;
+    err = record_read_frame_payload(f, &hdr, fb->buf, camera->replay_pool.buf_size);
+    if (err != RECORD_OK) {
+        ESP_LOGE(TAG, "rec fb->buf read err: %s", record_strerror(err));
+        replay_fb_pool_give(&camera->replay_pool, fb);
         return NULL;
     }
 
     return fb;
 }
 
-esp_err_t replay_fb_return(camera_fb_t* fb) {
-    free(fb->buf);
-    free(fb);
-    return ESP_OK;
+camera_fb_t * replay_fb_get(wifi_app_t* app) {
+    camsys_camera_t* camera = app->ext->sys->camera;
+    xSemaphoreTake(camera->replay_lock, portMAX_DELAY);
+    camera_fb_t* fb = replay_fb_get_locked(app);
+    xSemaphoreGive(camera->replay_lock);
+    return fb;
+}
+
+esp_err_t replay_fb_return(wifi_app_t* app, camera_fb_t* fb) {
+    return replay_fb_pool_give(&app->ext->sys->camera->replay_pool, fb);
+}
+
+// Replay is paced by the recorded frame timestamps: /replay?speed=0.5|1|2|8&from=<unix-ms>
+// At REPLAY_TRICK_SPEED_PCT and above only the indexed frames are sent (trick-play).
+
+#define REPLAY_SPEED_PCT_MIN 25
+#define REPLAY_SPEED_PCT_MAX 1600
+#define REPLAY_TRICK_SPEED_PCT 400
+#define REPLAY_PACE_GAP_MS 2000 // longer pauses (segment gaps, seeks) are not waited out
+
+struct replay_pace_s {
+    int speed_pct;
+    int64_t base_us;  // wall clock when base_ts was sent
+    uint64_t base_ts; // recorded time, ms
+    uint64_t last_ts;
+};
+
+typedef struct replay_pace_s replay_pace_t;
+
+void replay_pace_init(replay_pace_t* pace, int speed_pct) {
+    pace->speed_pct = speed_pct;
+    pace->base_us = 0;
+    pace->base_ts = 0;
+    pace->last_ts = 0;
+}
+
+// waits until the frame recorded at ts is due
+void replay_pace_wait(replay_pace_t* pace, uint64_t ts) {
+    int64_t now = esp_timer_get_time();
+    if (!pace->base_us || ts < pace->last_ts || (ts - pace->last_ts) * 100 / pace->speed_pct > REPLAY_PACE_GAP_MS) {
+        pace->base_us = now;
+        pace->base_ts = ts;
+    } else {
+        int64_t due = pace->base_us + (int64_t)(ts - pace->base_ts) * 1000 * 100 / pace->speed_pct;
+        if (due > now) vTaskDelay(pdMS_TO_TICKS((due - now) / 1000));
+        // do not burst to catch up after a slow card or socket
+        else if (now - due > REPLAY_PACE_GAP_MS * 1000LL) {
+            pace->base_us = now;
+            pace->base_ts = ts;
+        }
+    }
+    pace->last_ts = ts;
+}
+
+// reads speed (as percent) and from out of the query string
+void camsys_replay_query(httpd_req_t* req, int* speed_pct, uint64_t* from) {
+    *speed_pct = 100;
+    *from = 0;
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len <= 1) return;
+    char* buf = malloc(buf_len);
+    if (!buf) return;
+    if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
+        char param[24];
+        if (httpd_query_key_value(buf, "speed", param, sizeof(param)) == ESP_OK) {
+            int pct = (int)(strtof(param, NULL) * 100);
+            if (pct < REPLAY_SPEED_PCT_MIN) pct = REPLAY_SPEED_PCT_MIN;
+            if (pct > REPLAY_SPEED_PCT_MAX) pct = REPLAY_SPEED_PCT_MAX;
+            *speed_pct = pct;
+        }
+        if (httpd_query_key_value(buf, "from", param, sizeof(param)) == ESP_OK) {
+            *from = strtoull(param, NULL, 10);
+        }
+    }
+    free(buf);
 }
 
 esp_err_t camsys_camera_httpd_stream_replay_handler(wifi_app_t* app, httpd_req_t* req, bool replay) {
@@ -778,11 +3114,39 @@ esp_err_t camsys_camera_httpd_stream_replay_handler(wifi_app_t* app, httpd_req_t
   
     app->ext->sys->streaming = true;
 
-    if (replay) ESP_ERROR_CHECK( camera_recording_open(app->ext->sys->camera, "rb") );
+    if (replay && ESP_OK != camera_replay_open(app->ext->sys->camera)) {
+        ESP_LOGE(TAG, "no recordings");
+        app->ext->sys->streaming = false;
+        return ESP_FAIL;
+    }
+
+    replay_pace_t pace;
+    bool trick = false;
+    if (replay) {
+        int speed_pct;
+        uint64_t from;
+        camsys_replay_query(req, &speed_pct, &from);
+        replay_pace_init(&pace, speed_pct);
+        // trick-play and from both need the index
+        trick = speed_pct >= REPLAY_TRICK_SPEED_PCT && camera_index_size(app->ext->sys->camera) > 0;
+        if (from && ESP_OK != camera_seek(app->ext->sys->camera, from)) ESP_LOGW(TAG, "replay from %llu not found", from);
+        ESP_LOGI(TAG, "replay speed: %d%%%s", speed_pct, trick ? " (trick)" : "");
+    }
+
+    // live viewers share the frames of the capture task
+    camsys_frame_consumer_t viewer;
+    camsys_frame_t* frame = NULL;
+    if (!replay && ESP_OK != camsys_frame_consumer_add(&camsys_frames, &viewer)) {
+        app->ext->sys->streaming = false;
+        return ESP_FAIL;
+    }
+    if (!replay) abr_start(&camsys_abr);
 
     while(app->ext->sys->streaming) {   
         
-        fb = replay ? replay_fb_get(app) : camsys_fb_get(app);
+        if (replay) fb = replay_fb_get(app);
+        else fb = (frame = camsys_frame_acquire(&camsys_frames, &viewer)) ? frame->fb : NULL;
+        int64_t hold_start_us = esp_timer_get_time();
         
         if (!fb) {
             ESP_LOGE(TAG, "Cam capt fail");
@@ -792,8 +3156,14 @@ esp_err_t camsys_camera_httpd_stream_replay_handler(wifi_app_t* app, httpd_req_t
 
         _jpg_buf_len = fb->len;
         _jpg_buf = fb->buf;
-        
 
+        uint64_t fb_ts = 0;
+        if (replay) {
+            fb_ts = (uint64_t)fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000;
+            replay_pace_wait(&pace, fb_ts);
+        }
+
+        int64_t send_start_us = esp_timer_get_time();
         if(res == ESP_OK) {
             res = httpd_resp_send_chunk(req, CAMSYS_CAMERA_STREAM_BOUNDARY, strlen(CAMSYS_CAMERA_STREAM_BOUNDARY));
         }
@@ -805,17 +3175,48 @@ esp_err_t camsys_camera_httpd_stream_replay_handler(wifi_app_t* app, httpd_req_t
         if(res == ESP_OK) {
             res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
         }
-        if(fb->format != PIXFORMAT_JPEG) {
+        if(!replay && fb->format != PIXFORMAT_JPEG) {
             free(_jpg_buf);
         }
-        if(res != ESP_OK || (replay ? replay_fb_return(fb) : camsys_fb_return(fb)) != ESP_OK) {
+        int64_t send_us = esp_timer_get_time() - send_start_us;
+        if (res == ESP_OK) metrics_observe(METRICS_HTTP_SEND, send_us);
+        if (!replay) {
+            camsys_frame_release(&camsys_frames, frame);
+            metrics_since(METRICS_HOLD_STREAM, hold_start_us);
+        }
+        if (!replay && res == ESP_OK) abr_update(&camsys_abr, send_us, _jpg_buf_len);
+        if(res != ESP_OK || (replay && replay_fb_return(app, fb) != ESP_OK)) {
             if (res == ESP_OK) res = ESP_FAIL;
             break;
         }
-        
+
+        // trick-play jumps to the next indexed frame, reads on when the index has no more
+        if (trick) {
+            camsys_camera_t* camera = app->ext->sys->camera;
+            record_index_item_t next;
+            esp_err_t err = ESP_OK;
+            xSemaphoreTake(camera->replay_lock, portMAX_DELAY);
+            long pos = camera->file ? ftell(camera->file) : -1;
+            if (pos >= 0 && ESP_OK == record_index_cache_next(&camera->index, camera->segment, pos, &next)) {
+                err = camera_replay_seek_offset(camera, next.segment, next.entry.offset);
+            }
+            xSemaphoreGive(camera->replay_lock);
+            if (err != ESP_OK) {
+                res = ESP_FAIL;
+                break;
+            }
+        }
+
     }
 
-    if (replay) ESP_ERROR_CHECK( camera_recording_stop(app->ext->sys->camera) );
+    if (replay) {
+        xSemaphoreTake(app->ext->sys->camera->replay_lock, portMAX_DELAY);
+        ESP_ERROR_CHECK( camera_replay_close(app->ext->sys->camera) );
+        xSemaphoreGive(app->ext->sys->camera->replay_lock);
+    } else {
+        abr_stop(&camsys_abr);
+        camsys_frame_consumer_remove(&camsys_frames, &viewer);
+    }
 
     app->ext->sys->streaming = false;
 
@@ -904,6 +3305,178 @@ esp_err_t camsys_httpd_replay_handler(httpd_req_t* req) {
     return camsys_httpd_stream_replay_handler(req, true);
 }
 
+// reads from and to (ms since unix epoch) out of the query string
+void camsys_download_query(httpd_req_t* req, uint64_t* from, uint64_t* to) {
+    *from = 0;
+    *to = UINT64_MAX;
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if (buf_len <= 1) return;
+    char* buf = malloc(buf_len);
+    if (!buf) return;
+    if (httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK) {
+        char param[24];
+        if (httpd_query_key_value(buf, "from", param, sizeof(param)) == ESP_OK) *from = strtoull(param, NULL, 10);
+        if (httpd_query_key_value(buf, "to", param, sizeof(param)) == ESP_OK) *to = strtoull(param, NULL, 10);
+    }
+    free(buf);
+}
+
+// parses a single "bytes=a-b", "bytes=a-" or "bytes=-n" range, false if it is not satisfiable
+bool camsys_parse_range(const char* range, uint32_t size, uint32_t* first, uint32_t* last) {
+    if (strncmp(range, "bytes=", 6)) return false;
+    const char* p = range + 6;
+    char* end;
+    if (*p == '-') {
+        unsigned long long n = strtoull(p + 1, &end, 10);
+        if (end == p + 1 || !n || !size) return false;
+        *first = n >= size ? 0 : size - (uint32_t)n;
+        *last = size - 1;
+        return true;
+    }
+    unsigned long long a = strtoull(p, &end, 10);
+    if (end == p || *end != '-' || a >= size) return false;
+    p = end + 1;
+    unsigned long long b = size - 1;
+    if (*p >= '0' && *p <= '9') {
+        b = strtoull(p, &end, 10);
+        if (b < a) return false;
+        if (b >= size) b = size - 1;
+    }
+    *first = (uint32_t)a;
+    *last = (uint32_t)b;
+    return true;
+}
+
+#define CAMSYS_DOWNLOAD_CHUNK_SIZE (16 * 1024)
+
+esp_err_t camsys_camera_httpd_download_handler(wifi_app_t* app, httpd_req_t* req) {
+    camsys_camera_t* camera = app->ext->sys->camera;
+    uint64_t from, to;
+    camsys_download_query(req, &from, &to);
+    if (ESP_OK != camera_download_prepare(camera, from, to)) {
+        ESP_LOGE(TAG, "no recordings to download");
+        return httpd_resp_send_404(req);
+    }
+    avi_file_t* avi = &camera->download.avi;
+
+    uint32_t first = 0, last = avi->size - 1;
+    char hdr[64];
+    bool partial = false;
+    size_t range_len = httpd_req_get_hdr_value_len(req, "Range");
+    if (range_len && range_len < sizeof(hdr) && ESP_OK == httpd_req_get_hdr_value_str(req, "Range", hdr, sizeof(hdr))) {
+        if (!camsys_parse_range(hdr, avi->size, &first, &last)) {
+            download_close(&camera->download);
+            snprintf(hdr, sizeof(hdr), "bytes */%u", avi->size);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_set_hdr(req, "Content-Range", hdr);
+            return httpd_resp_send(req, NULL, 0);
+        }
+        partial = true;
+    }
+
+    char range[48];
+    char disposition[64];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"camsys-%llu.avi\"", from);
+    httpd_resp_set_type(req, "video/x-msvideo");
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+    if (partial) {
+        snprintf(range, sizeof(range), "bytes %u-%u/%u", first, last, avi->size);
+        httpd_resp_set_status(req, "206 Partial Content");
+        httpd_resp_set_hdr(req, "Content-Range", range);
+    }
+    ESP_LOGI(TAG, "download: %u-%u/%u", first, last, avi->size);
+
+    uint8_t* buf = malloc(CAMSYS_DOWNLOAD_CHUNK_SIZE);
+    if (!buf) {
+        download_close(&camera->download);
+        return httpd_resp_send_500(req);
+    }
+    esp_err_t res = ESP_OK;
+    for (uint32_t pos = first; pos <= last && res == ESP_OK; ) {
+        size_t size = last - pos + 1;
+        if (size > CAMSYS_DOWNLOAD_CHUNK_SIZE) size = CAMSYS_DOWNLOAD_CHUNK_SIZE;
+        long len = avi_file_read(avi, pos, buf, size);
+        if (len <= 0) {
+            ESP_LOGE(TAG, "download read err at %u", pos);
+            res = ESP_FAIL;
+            break;
+        }
+        res = httpd_resp_send_chunk(req, (const char*)buf, len);
+        pos += len;
+    }
+    free(buf);
+    download_close(&camera->download);
+    if (res == ESP_OK) res = httpd_resp_send_chunk(req, NULL, 0);
+    return res;
+}
+
+// the latest captured frame as a single JPEG
+esp_err_t camsys_camera_httpd_snapshot_handler(wifi_app_t* app, httpd_req_t* req) {
+    camsys_frame_t* frame = camsys_frame_snapshot(&camsys_frames);
+    if (!frame) return httpd_resp_send_404(req);
+    int64_t hold_start_us = esp_timer_get_time();
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t res = httpd_resp_send(req, (const char*)frame->fb->buf, frame->fb->len);
+    camsys_frame_release(&camsys_frames, frame);
+    metrics_since(METRICS_HOLD_SNAPSHOT, hold_start_us);
+    return res;
+}
+
+#define CAMSYS_METRICS_LINE_SIZE 128
+
+// Prometheus text format, the histogram buckets are cumulative. Registered on the
+// port 80 instance only, so the stream task never holds up a scrape.
+esp_err_t camsys_httpd_metrics_handler(httpd_req_t* req) {
+    wifi_app_t* app = _app;
+    if (!camsys_check_secret(app, req)) return ESP_FAIL;
+    metrics_t m;
+    metrics_copy(&m);
+    char line[CAMSYS_METRICS_LINE_SIZE];
+    esp_err_t res = httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    for (int i=0; i<METRICS_HIST_COUNT && res == ESP_OK; i++) {
+        metrics_hist_t* h = &m.hists[i];
+        int len = snprintf(line, sizeof(line), "# TYPE camsys_%s_seconds histogram\n", metrics_hist_names[i]);
+        res = httpd_resp_send_chunk(req, line, len);
+        uint32_t cnt = 0;
+        for (int b=0; b<METRICS_BUCKETS && res == ESP_OK; b++) {
+            cnt += h->buckets[b];
+            if (b < METRICS_BUCKETS - 1) len = snprintf(line, sizeof(line), "camsys_%s_seconds_bucket{le=\"%u.%06u\"} %u\n", 
+                metrics_hist_names[i], metrics_bounds_us[b] / 1000000, metrics_bounds_us[b] % 1000000, cnt);
+            else len = snprintf(line, sizeof(line), "camsys_%s_seconds_bucket{le=\"+Inf\"} %u\n", metrics_hist_names[i], cnt);
+            res = httpd_resp_send_chunk(req, line, len);
+        }
+        if (res != ESP_OK) break;
+        len = snprintf(line, sizeof(line), "camsys_%s_seconds_sum %llu.%06llu\ncamsys_%s_seconds_count %u\n", 
+            metrics_hist_names[i], h->sum_us / 1000000, h->sum_us % 1000000, metrics_hist_names[i], h->count);
+        res = httpd_resp_send_chunk(req, line, len);
+    }
+    for (int i=0; i<METRICS_DROP_COUNT && res == ESP_OK; i++) {
+        int len = i ? 0 : snprintf(line, sizeof(line), "# TYPE camsys_frames_dropped_total counter\n");
+        len += snprintf(line + len, sizeof(line) - len, "camsys_frames_dropped_total{reason=\"%s\"} %u\n", metrics_drop_names[i], m.drops[i]);
+        res = httpd_resp_send_chunk(req, line, len);
+    }
+    if (res == ESP_OK) res = httpd_resp_send_chunk(req, NULL, 0);
+    return res;
+}
+
+esp_err_t camsys_httpd_snapshot_handler(httpd_req_t* req) {
+    wifi_app_t* app = _app;
+    if (!camsys_check_secret(app, req)) return ESP_FAIL;
+    if (app->ext->sys->mode == CAMSYS_MODE_CAMERA) return camsys_camera_httpd_snapshot_handler(app, req);
+    ESP_ERROR_CHECK( httpd_resp_send_404(req) );
+    return ESP_OK;
+}
+
+esp_err_t camsys_httpd_download_handler(httpd_req_t* req) {
+    wifi_app_t* app = _app;
+    if (!camsys_check_secret(app, req)) return ESP_FAIL;
+    if (app->ext->sys->mode == CAMSYS_MODE_CAMERA) return camsys_camera_httpd_download_handler(app, req);
+    ESP_ERROR_CHECK( httpd_resp_send_404(req) );
+    return ESP_OK;
+}
+
 
 static const httpd_uri_t camsys_stream_uri = {
     .uri       = "/stream",
@@ -923,6 +3496,38 @@ static const httpd_uri_t camsys_record_uri = {
     .user_ctx  = NULL
 };
 
+static const httpd_uri_t camsys_download_uri = {
+    .uri       = "/download",
+    .method    = HTTP_GET,
+    .handler   = camsys_httpd_download_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t camsys_snapshot_uri = {
+    .uri       = "/snapshot",
+    .method    = HTTP_GET,
+    .handler   = camsys_httpd_snapshot_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t camsys_metrics_uri = {
+    .uri       = "/metrics",
+    .method    = HTTP_GET,
+    .handler   = camsys_httpd_metrics_handler,
+    .user_ctx  = NULL
+};
+
+
+// A server instance runs every handler in its one task, and a stream handler only
+// returns when the viewer goes. So the long-lived /stream and /replay get a second
+// instance on CAMSYS_HTTPD_STREAM_PORT, and /download, /snapshot and /metrics on
+// port 80 are answered while a viewer is connected.
+// Sockets: both servers (a listener, a control socket and their connections each)
+// and the websocket client fit CONFIG_LWIP_MAX_SOCKETS (16).
+
+#define CAMSYS_HTTPD_STREAM_PORT 81
+#define CAMSYS_HTTPD_MAX_SOCKETS 6
+#define CAMSYS_HTTPD_STREAM_MAX_SOCKETS 3
 
 //Function for starting the webserver
 void camsys_httpd_server_init(wifi_app_t* app)
@@ -930,15 +3535,28 @@ void camsys_httpd_server_init(wifi_app_t* app)
     _app = app;
     // Generate default configuration
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_open_sockets = CAMSYS_HTTPD_MAX_SOCKETS;
+    config.lru_purge_enable = true;
+
+    httpd_config_t stream_config = HTTPD_DEFAULT_CONFIG();
+    stream_config.server_port = CAMSYS_HTTPD_STREAM_PORT;
+    stream_config.ctrl_port = config.ctrl_port + 1;
+    stream_config.max_open_sockets = CAMSYS_HTTPD_STREAM_MAX_SOCKETS;
+    stream_config.lru_purge_enable = true;
 
     // Empty handle to http_server
     app->ext->sys->server = NULL;
+    app->ext->sys->stream_server = NULL;
 
-    // Start the httpd server
+    // Start the httpd servers
     ESP_ERROR_CHECK(httpd_start(&app->ext->sys->server, &config));
+    ESP_ERROR_CHECK(httpd_start(&app->ext->sys->stream_server, &stream_config));
     // Register URI handlers
-    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->server, &camsys_stream_uri));
-    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->server, &camsys_record_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->stream_server, &camsys_stream_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->stream_server, &camsys_record_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->server, &camsys_download_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->server, &camsys_snapshot_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(app->ext->sys->server, &camsys_metrics_uri));
 
     // If server failed to start, handle will be NULL
 }
@@ -962,27 +3580,14 @@ esp_err_t websock_sendf(esp_websocket_client_handle_t client, const char* fmt, .
 
 // ----------------- camera/motion websocket loops ---------------------
 
-void camsys_camera_websock_loop(wifi_app_t* app) {
-    // record video when recording but not streaming and not playback
-    if (!app->ext->sys->streaming && app->ext->sys->camera->file && app->ext->sys->camera->idxf) {
-        ESP_LOGI(TAG, "rec.. (no strm)");
-
-        camera_fb_t * fb = camsys_fb_get(app);
-        
-        if (!fb) {
-            ESP_LOGE(TAG, "Cam capture fail");
-        } else {
-            if (ESP_OK != camsys_fb_return(fb)) ESP_LOGE(TAG, "Cam fb ret fail");
-        }
-        
-    }
-}
-
 // -----------------------------------
 
 #define WATCHER_MAX_SIZE 40
 #define WATCHER_BUFF_SIZE WATCHER_MAX_SIZE*WATCHER_MAX_SIZE*4
-uint8_t watcher_prev_buf[WATCHER_BUFF_SIZE];
+// samples of the previous and the current frame, swapped after each check
+uint32_t watcher_sample_bufs[2][WATCHER_BUFF_SIZE / sizeof(uint32_t)];
+uint8_t* watcher_prev_buf = (uint8_t*)watcher_sample_bufs[0];
+uint8_t* watcher_cur_buf = (uint8_t*)watcher_sample_bufs[1];
 
 struct watcher_s {
     int x;
@@ -1002,7 +3607,107 @@ watcher_t watcher = WATCHER_DEFAULT;
 
 
 bool camsys_motion_websock_loop_first = true;
-bool camsys_motion_websock_loop_alert = false;
+
+// How the watch window detects motion: "diff" sums the differences to the previous
+// frame against the threshold, "bg" counts the samples off the background model
+// (see bg.h) against pixels. Set by !DETECT, kept in NVS.
+
+#define WATCHER_METHOD_DIFF 0
+#define WATCHER_METHOD_BG 1
+#define WATCHER_PIXELS_MAX WATCHER_BUFF_SIZE
+#define WATCHER_NOISE_MAX 64
+
+struct watcher_detect_s {
+    int method;
+    bg_params_t bg;
+    int pixels;           // foreground samples that alert
+};
+
+typedef struct watcher_detect_s watcher_detect_t;
+
+watcher_detect_t watcher_detect = {
+    .method = WATCHER_METHOD_DIFF,
+    .bg = { .rate = 5, .sigma = 3, .sigma_min = 6 },
+    .pixels = 4,
+};
+
+bg_model_t watcher_bg = { .pixels = NULL };
+size_t watcher_fg_max = 0;
+
+esp_err_t watcher_detect_save(nvs_handle_t handle, const watcher_detect_t* detect) {
+    esp_err_t err = nvs_set_u8(handle, "dmethod", (uint8_t)detect->method);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "drate", detect->bg.rate);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "dsigma", detect->bg.sigma);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "dnoise", detect->bg.sigma_min);
+    if (err == ESP_OK) err = nvs_set_u16(handle, "dpixels", (uint16_t)detect->pixels);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t watcher_detect_load(nvs_handle_t handle, watcher_detect_t* detect) {
+    uint8_t method = detect->method, rate = detect->bg.rate, sigma = detect->bg.sigma, noise = detect->bg.sigma_min;
+    uint16_t pixels = detect->pixels;
+    esp_err_t err = nvs_get_u8(handle, "dmethod", &method);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "drate", &rate);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "dsigma", &sigma);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "dnoise", &noise);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u16(handle, "dpixels", &pixels);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (method <= WATCHER_METHOD_BG) detect->method = method;
+    if (rate <= BG_RATE_MAX) detect->bg.rate = rate;
+    if (sigma >= 1 && sigma <= BG_SIGMA_MAX) detect->bg.sigma = sigma;
+    if (noise <= WATCHER_NOISE_MAX) detect->bg.sigma_min = noise;
+    if (pixels >= 1 && pixels <= WATCHER_PIXELS_MAX) detect->pixels = pixels;
+    return err;
+}
+
+// parses "method=<diff|bg> rate=<0..10> sigma=<1..15> noise=<0..64> pixels=<n>", every key is optional
+esp_err_t watcher_detect_parse(const char* params, watcher_detect_t* detect) {
+    char buff[100];
+    strncpy(buff, params, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buff, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        char* val = strchr(tok, '=');
+        if (!val) return ESP_ERR_INVALID_ARG;
+        *val++ = '\0';
+        int v = atoi(val);
+        if (!strcmp(tok, "method")) {
+            if (!strcmp(val, "diff")) detect->method = WATCHER_METHOD_DIFF;
+            else if (!strcmp(val, "bg")) detect->method = WATCHER_METHOD_BG;
+            else return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "rate")) {
+            if (v < 0 || v > BG_RATE_MAX) return ESP_ERR_INVALID_ARG;
+            detect->bg.rate = v;
+        } else if (!strcmp(tok, "sigma")) {
+            if (v < 1 || v > BG_SIGMA_MAX) return ESP_ERR_INVALID_ARG;
+            detect->bg.sigma = v;
+        } else if (!strcmp(tok, "noise")) {
+            if (v < 0 || v > WATCHER_NOISE_MAX) return ESP_ERR_INVALID_ARG;
+            detect->bg.sigma_min = v;
+        } else if (!strcmp(tok, "pixels")) {
+            if (v < 1 || v > WATCHER_PIXELS_MAX) return ESP_ERR_INVALID_ARG;
+            detect->pixels = v;
+        } else return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// (re)starts the background model with the current parameters
+esp_err_t watcher_detect_apply(const watcher_detect_t* detect) {
+    watcher_detect = *detect;
+    watcher_fg_max = 0;
+    if (watcher_detect.method != WATCHER_METHOD_BG) return ESP_OK;
+    bg_pixel_t* pixels = watcher_bg.pixels;
+    if (!pixels) pixels = heap_caps_malloc(WATCHER_BUFF_SIZE * sizeof(bg_pixel_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!pixels) {
+        ESP_LOGE(TAG, "bg model alloc err");
+        watcher_detect.method = WATCHER_METHOD_DIFF;
+        return ESP_ERR_NO_MEM;
+    }
+    bg_init(&watcher_bg, pixels, WATCHER_BUFF_SIZE, &watcher_detect.bg);
+    return ESP_OK;
+}
 
 esp_err_t watch_save(nvs_handle_t handle, const char* data) {
     esp_err_t err = nvs_set_str(handle, "watch", data);
@@ -1049,7 +3754,8 @@ void watch_restore(char* buff) {
     watcher.threshold = atoi(array[4]);
     watcher.diff_sum_max = 0;
     camsys_motion_websock_loop_first = true;
-    camsys_motion_websock_loop_alert = false;
+    // the window may have moved
+    if (watcher_bg.pixels) bg_reset(&watcher_bg);
 }
 
 
@@ -1064,56 +3770,584 @@ void watch_restore(char* buff) {
 //     ESP_LOGI(TAG, "%s", sbuff);
 // }
 
-void camsys_motion_websock_loop(wifi_app_t* app) {
-    
-    camera_fb_t* fb = motion_fb;
+// compares the watch window of a grayscale image to the previous one (row by row,
+// see sad.h), returns the score in percent of the threshold (see event.h)
+uint32_t watcher_check(const uint8_t* buf, int width, int height) {
+    sad_window_t win = {
+        .x = watcher.x - watcher.size,
+        .y = watcher.y - watcher.size,
+        .width = 2 * watcher.size,
+        .height = 2 * watcher.size,
+        .step = watcher.raster,
+    };
+    sad_window_t clipped = win;
+    if (sad_window_clip(&clipped, width, height) > WATCHER_BUFF_SIZE) {
+        ESP_LOGE(TAG, "buff size too large");
+        return 0;
+    }
+    size_t n = sad_gather(buf, width, height, &win, watcher_cur_buf);
+    size_t diff_sum = sad_u8(watcher_cur_buf, watcher_prev_buf, n);
+    uint8_t* prev = watcher_prev_buf;
+    watcher_prev_buf = watcher_cur_buf;
+    watcher_cur_buf = prev;
 
-    fb = camsys_fb_get(app);            
-    if (!fb) {
-        ESP_LOGE(TAG, "Motion Cam capture fail");
-        ESP_ERROR_CHECK( camsys_fb_return(fb) );
-        return;
+    if (watcher.diff_sum_max < diff_sum) watcher.diff_sum_max = diff_sum;
+
+    uint32_t score = diff_sum * EVENT_SCORE_HIT / (watcher.threshold > 0 ? watcher.threshold : 1);
+    if (watcher_detect.method == WATCHER_METHOD_BG) {
+        // the current samples are in watcher_prev_buf after the swap
+        size_t fg = bg_update(&watcher_bg, watcher_prev_buf, n);
+        if (watcher_fg_max < fg) watcher_fg_max = fg;
+        score = fg * EVENT_SCORE_HIT / watcher_detect.pixels;
     }
     
+    if (camsys_motion_websock_loop_first) score = 0;
+    camsys_motion_websock_loop_first = false;
 
-    int xfrom = watcher.x - watcher.size;
-    int xto = watcher.x + watcher.size;
-    int yfrom = watcher.y - watcher.size;
-    int yto = watcher.y + watcher.size;
-    int i=0;
-    size_t diff_sum = 0;
-    for (int x=xfrom; x<xto; x+=watcher.raster) {
-        for (int y=yfrom; y<yto; y+=watcher.raster) {
-            int diff = fb->buf[x+y*fb->width] - watcher_prev_buf[i];
-            diff_sum += (diff > 0 ? diff : -diff);
-            if (i>=WATCHER_BUFF_SIZE) {
-                ESP_LOGE(TAG, "buff size too large");
+    // use this for debugging:
+    // watcher_show_diff(diff_sum, score >= EVENT_SCORE_HIT);
+
+    return score;
+}
+
+// -----------------------------------
+
+// The zones and the heat map read the differences to the previous motion image from
+// summed-area tables (see sat.h), built once per image for a noise floor: 0 for the
+// heat map, a zone sensitivity when its zones cover CAMSYS_SAT_MIN_PIXELS. A zone
+// rectangle or a grid cell is then four lookups, however large. A table costs about
+// two direct passes over the image, so smaller zones are summed directly.
+
+#define CAMSYS_SAT_MAX (ZONE_MAX + 1)
+#define CAMSYS_SAT_MIN_PIXELS (2 * MOTION_SIZE * MOTION_SIZE)
+
+struct camsys_sat_s {
+    uint8_t* prev;       // previous motion image
+    bool primed;
+    int count;           // tables built for the current image
+    sat_t tables[CAMSYS_SAT_MAX];
+};
+
+typedef struct camsys_sat_s camsys_sat_t;
+
+camsys_sat_t camsys_sat;
+
+// the table of the current image with the floor, NULL if it was not built
+const sat_t* camsys_sat_get(uint8_t floor) {
+    for (int i=0; i<camsys_sat.count; i++) if (camsys_sat.tables[i].floor == floor) return &camsys_sat.tables[i];
+    return NULL;
+}
+
+// builds a table for each floor (once per value) against the previous image, false
+// when there is no previous image (then there are no tables either)
+bool camsys_sat_build(const uint8_t* buf, int width, int height, const uint8_t* floors, int n) {
+    camsys_sat.count = 0;
+    if (width != MOTION_SIZE || height != MOTION_SIZE) return false;
+    if (!camsys_sat.prev) camsys_sat.prev = heap_caps_malloc(MOTION_SIZE * MOTION_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!camsys_sat.prev) return false;
+    const size_t size = SAT_TABLE_SIZE(MOTION_SIZE, MOTION_SIZE);
+    for (int i=0; i<n && camsys_sat.primed && camsys_sat.count < CAMSYS_SAT_MAX; i++) {
+        if (camsys_sat_get(floors[i])) continue;
+        sat_t* sat = &camsys_sat.tables[camsys_sat.count];
+        if (!sat->table) {
+            uint32_t* table = heap_caps_malloc(size * sizeof(uint32_t), MALLOC_CAP_SPIRAM);
+            if (!table) {
+                ESP_LOGE(TAG, "sat alloc err");
                 break;
             }
-            watcher_prev_buf[i] = fb->buf[x+y*fb->width];
-            i++;
+            sat_init(sat, table, size);
         }
+        if (sat_build(sat, buf, camsys_sat.prev, width, height, floors[i])) camsys_sat.count++;
     }
+    return camsys_sat.primed;
+}
 
-    if (watcher.diff_sum_max < diff_sum) watcher.diff_sum_max = diff_sum;
-    
-    if (!camsys_motion_websock_loop_alert) 
-        camsys_motion_websock_loop_alert = !camsys_motion_websock_loop_first && diff_sum >= watcher.threshold;
-    camsys_motion_websock_loop_first = false;
+// buf is the previous image of the next one
+void camsys_sat_next(const uint8_t* buf) {
+    if (!camsys_sat.prev) return;
+    memcpy(camsys_sat.prev, buf, MOTION_SIZE * MOTION_SIZE);
+    camsys_sat.primed = true;
+}
 
-    // use this for debugging:
-    // watcher_show_diff(diff_sum, camsys_motion_websock_loop_alert);
+// -----------------------------------
+
+// Named zones next to the watch window (see zone.h), in the coordinates of the
+// MOTION_SIZE x MOTION_SIZE motion image. They are compiled to rectangles on every
+// change and checked in the summed-area tables of the image.
+
+#define ZONES_NVS_SIZE (ZONE_MAX * ZONE_DEF_SIZE)
+
+zone_set_t camsys_zones;
+SemaphoreHandle_t camsys_zones_lock = NULL;
+bool camsys_zones_primed = false;
+uint32_t camsys_zones_sum_max[ZONE_MAX];
+
+esp_err_t zones_save(nvs_handle_t handle) {
+    char* data = malloc(ZONES_NVS_SIZE);
+    if (!data) return ESP_ERR_NO_MEM;
+    size_t len = 0;
+    data[0] = '\0';
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    for (int i=0; i<camsys_zones.count && len < ZONES_NVS_SIZE; i++) {
+        if (i) data[len++] = '\n';
+        len += zone_format(&camsys_zones.zones[i], data + len, ZONES_NVS_SIZE - len);
+    }
+    xSemaphoreGive(camsys_zones_lock);
+    esp_err_t err = len < ZONES_NVS_SIZE ? nvs_set_str(handle, "zones", data) : ESP_ERR_NVS_INVALID_LENGTH;
+    if (err == ESP_OK) err = nvs_commit(handle);
+    free(data);
+    return err;
+}
+
+// called before anything else touches the zones
+esp_err_t zones_load(nvs_handle_t handle) {
+    zone_set_init(&camsys_zones);
+    if (!camsys_zones_lock) camsys_zones_lock = xSemaphoreCreateMutex();
+    if (!camsys_zones_lock) return ESP_ERR_NO_MEM;
+    char* data = malloc(ZONES_NVS_SIZE);
+    if (!data) return ESP_ERR_NO_MEM;
+    size_t size = ZONES_NVS_SIZE;
+    esp_err_t err = nvs_get_str(handle, "zones", data, &size);
+    if (err == ESP_OK) {
+        zone_t zone;
+        for (char* line = strtok(data, "\n"); line; line = strtok(NULL, "\n")) {
+            int zerr = zone_parse(line, &zone);
+            if (zerr == ZONE_OK) zerr = zone_set_put(&camsys_zones, &zone);
+            if (zerr != ZONE_OK) ESP_LOGW(TAG, "zone skipped: %s", zone_strerror(zerr));
+        }
+    }
+    free(data);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (err == ESP_OK && ZONE_OK != zone_set_compile(&camsys_zones, MOTION_SIZE, MOTION_SIZE)) {
+        ESP_LOGE(TAG, "zones compile err");
+        zone_set_init(&camsys_zones);
+    }
+    return err;
+}
+
+// adds or replaces (def), or removes (def is NULL) a zone and recompiles them
+int zones_update(const char* def, const char* name) {
+    zone_t zone;
+    if (def) {
+        int err = zone_parse(def, &zone);
+        if (err != ZONE_OK) return err;
+    }
+    if (def) name = zone.name;
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    // a zone can break the compile (too many spans), then the previous one comes back
+    zone_t old;
+    bool existed = false;
+    for (int i=0; i<camsys_zones.count; i++) if (!strcmp(camsys_zones.zones[i].name, name)) {
+        old = camsys_zones.zones[i];
+        existed = true;
+    }
+    int err = def ? zone_set_put(&camsys_zones, &zone) : zone_set_remove(&camsys_zones, name);
+    if (err == ZONE_OK) {
+        err = zone_set_compile(&camsys_zones, MOTION_SIZE, MOTION_SIZE);
+        if (err != ZONE_OK) {
+            if (existed) zone_set_put(&camsys_zones, &old);
+            else zone_set_remove(&camsys_zones, name);
+            zone_set_compile(&camsys_zones, MOTION_SIZE, MOTION_SIZE);
+        }
+    }
+    camsys_zones_primed = false;
+    memset(camsys_zones_sum_max, 0, sizeof(camsys_zones_sum_max));
+    xSemaphoreGive(camsys_zones_lock);
+    return err;
+}
+
+// the distinct sensitivities of the checked zones and the pixels they cover each
+int zones_floors(uint8_t* floors, uint32_t* pixels) {
+    if (!camsys_zones_lock) return 0;
+    int n = 0;
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    for (int i=0; i<camsys_zones.count; i++) {
+        if (camsys_zones.zones[i].ignore) continue;
+        int j = 0;
+        while (j < n && floors[j] != camsys_zones.zones[i].sensitivity) j++;
+        if (j == n) {
+            floors[n] = camsys_zones.zones[i].sensitivity;
+            pixels[n++] = 0;
+        }
+        pixels[j] += camsys_zones.pixels[i];
+    }
+    xSemaphoreGive(camsys_zones_lock);
+    return n;
+}
+
+// checks every zone of the image against the previous one, from the tables where
+// there is one. Returns the highest score, hits gets a bit per zone at its threshold.
+uint32_t zones_check(const uint8_t* buf, const uint8_t* prev, uint32_t* hits) {
+    *hits = 0;
+    if (!camsys_zones_lock) return 0;
+    uint32_t score = 0;
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    if (camsys_zones.span_count && camsys_zones_primed) {
+        uint32_t sums[ZONE_MAX];
+        const sat_t* sats[ZONE_MAX];
+        for (int i=0; i<camsys_zones.count; i++) sats[i] = camsys_sat_get(camsys_zones.zones[i].sensitivity);
+        zone_set_eval_sat(&camsys_zones, sats, buf, prev, sums);
+        for (int i=0; i<camsys_zones.count; i++) {
+            if (camsys_zones.zones[i].ignore) continue;
+            if (camsys_zones_sum_max[i] < sums[i]) camsys_zones_sum_max[i] = sums[i];
+            uint32_t zone_score = (uint64_t)sums[i] * EVENT_SCORE_HIT / camsys_zones.zones[i].threshold;
+            if (zone_score >= EVENT_SCORE_HIT) *hits |= 1UL << i;
+            if (score < zone_score) score = zone_score;
+        }
+    }
+    camsys_zones_primed = true;
+    xSemaphoreGive(camsys_zones_lock);
+    return score;
+}
+
+// {"func":"zones","zones":[{"name":..,"threshold":..,"sensitivity":..,"ignore":..,"pixels":..,"sum_max":..},..]}
+int zones_json(char* buf, size_t size) {
+    int len = snprintf(buf, size, "{\"func\":\"zones\",\"zones\":[");
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    for (int i=0; i<camsys_zones.count && len < size; i++) {
+        zone_t* zone = &camsys_zones.zones[i];
+        len += snprintf(buf + len, size - len, "%s{\"name\":\"%s\",\"threshold\":%u,\"sensitivity\":%u,\"ignore\":%s,\"pixels\":%u,\"sum_max\":%u}",
+            i ? "," : "", zone->name, zone->threshold, zone->sensitivity, zone->ignore ? "true" : "false", camsys_zones.pixels[i], camsys_zones_sum_max[i]);
+        camsys_zones_sum_max[i] = 0;
+    }
+    xSemaphoreGive(camsys_zones_lock);
+    if (len < size) len += snprintf(buf + len, size - len, "]}");
+    return len < size ? len : (int)size - 1;
+}
+
+// -----------------------------------
+
+// Activity heat map of the motion image (see heatmap.h), built from every checked
+// image and pushed to the server as a binary message at most every ms (0 is off).
+// Set by !HEATMAP, kept in NVS.
+
+#define HEATMAP_MS_MIN 100
+#define HEATMAP_MS_MAX 10000
+
+struct camsys_heatmap_settings_s {
+    int ms;
+    int cells;    // per side
+};
+
+typedef struct camsys_heatmap_settings_s camsys_heatmap_settings_t;
+
+camsys_heatmap_settings_t camsys_heatmap_settings = { .ms = 500, .cells = 12 };
+heatmap_t camsys_heatmap;
+SemaphoreHandle_t camsys_heatmap_lock = NULL;
+int64_t camsys_heatmap_last_us = 0;
+
+esp_err_t camsys_heatmap_save(nvs_handle_t handle, const camsys_heatmap_settings_t* settings) {
+    esp_err_t err = nvs_set_u16(handle, "hmms", (uint16_t)settings->ms);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "hmcells", (uint8_t)settings->cells);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t camsys_heatmap_load(nvs_handle_t handle, camsys_heatmap_settings_t* settings) {
+    uint16_t ms = settings->ms;
+    uint8_t cells = settings->cells;
+    esp_err_t err = nvs_get_u16(handle, "hmms", &ms);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "hmcells", &cells);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (!ms || (ms >= HEATMAP_MS_MIN && ms <= HEATMAP_MS_MAX)) settings->ms = ms;
+    if (cells >= HEATMAP_CELLS_MIN && cells <= HEATMAP_CELLS_MAX) settings->cells = cells;
+    return err;
+}
+
+// parses "ms=<0|100..10000> cells=<4..16>", every key is optional
+esp_err_t camsys_heatmap_parse(const char* params, camsys_heatmap_settings_t* settings) {
+    char buff[100];
+    strncpy(buff, params, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+    char* save = NULL;
+    for (char* tok = strtok_r(buff, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        char* val = strchr(tok, '=');
+        if (!val) return ESP_ERR_INVALID_ARG;
+        *val++ = '\0';
+        int v = atoi(val);
+        if (!strcmp(tok, "ms")) {
+            if (v && (v < HEATMAP_MS_MIN || v > HEATMAP_MS_MAX)) return ESP_ERR_INVALID_ARG;
+            settings->ms = v;
+        } else if (!strcmp(tok, "cells")) {
+            if (v < HEATMAP_CELLS_MIN || v > HEATMAP_CELLS_MAX) return ESP_ERR_INVALID_ARG;
+            settings->cells = v;
+        } else return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+// (re)starts the grid, the next message is a keyframe
+void camsys_heatmap_apply(const camsys_heatmap_settings_t* settings) {
+    if (!camsys_heatmap_lock) camsys_heatmap_lock = xSemaphoreCreateMutex();
+    xSemaphoreTake(camsys_heatmap_lock, portMAX_DELAY);
+    camsys_heatmap_settings = *settings;
+    heatmap_init(&camsys_heatmap, settings->cells, settings->cells);
+    xSemaphoreGive(camsys_heatmap_lock);
+}
+
+// the server (re)connected, it has no grid yet
+void camsys_heatmap_keyframe() {
+    if (!camsys_heatmap_lock) return;
+    xSemaphoreTake(camsys_heatmap_lock, portMAX_DELAY);
+    heatmap_keyframe(&camsys_heatmap);
+    xSemaphoreGive(camsys_heatmap_lock);
+}
+
+void camsys_heatmap_check() {
+    if (!camsys_heatmap_lock || !camsys_heatmap_settings.ms) return;
+    const sat_t* sat = camsys_sat_get(0);
+    if (!sat) return;
+    xSemaphoreTake(camsys_heatmap_lock, portMAX_DELAY);
+    heatmap_update(&camsys_heatmap, sat);
+    xSemaphoreGive(camsys_heatmap_lock);
+}
+
+// sends the changed cells when ms passed since the last message
+void camsys_heatmap_send(wifi_app_t* app) {
+    if (!camsys_heatmap_lock || !camsys_heatmap_settings.ms) return;
+    int64_t now_us = esp_timer_get_time();
+    if (now_us - camsys_heatmap_last_us < camsys_heatmap_settings.ms * 1000LL) return;
+    camsys_heatmap_last_us = now_us;
+    static uint8_t msg[HEATMAP_MSG_SIZE];
+    xSemaphoreTake(camsys_heatmap_lock, portMAX_DELAY);
+    size_t len = heatmap_encode(&camsys_heatmap, msg, sizeof(msg));
+    xSemaphoreGive(camsys_heatmap_lock);
+    if (!len) return;
+    if ((int)len != esp_websocket_client_send_bin(app->ext->client, (const char*)msg, len, portMAX_DELAY)) {
+        ESP_LOGW(TAG, "heatmap send err");
+        camsys_heatmap_keyframe();
+    }
+}
+
+// -----------------------------------
+
+#define CAMSYS_REASON_WATCH (1UL << ZONE_MAX)   // next to the zone bits
+
+// every motion image goes through here in both modes: the watch window, then the
+// zones and the heat map (with the tables of the differences). Returns the highest
+// score, reasons gets the zone bits and CAMSYS_REASON_WATCH of the hits.
+uint32_t camsys_motion_check(const uint8_t* buf, int width, int height, uint32_t* reasons) {
+    uint32_t score = watcher_check(buf, width, height);
+    *reasons = score >= EVENT_SCORE_HIT ? CAMSYS_REASON_WATCH : 0;
+    uint8_t floors[CAMSYS_SAT_MAX];
+    uint32_t pixels[CAMSYS_SAT_MAX];
+    int n = zones_floors(floors, pixels);
+    int j = 0;
+    while (j < n && floors[j]) j++;
+    if (camsys_heatmap_settings.ms) {
+        if (j == n) floors[n++] = 0;
+        pixels[j] = CAMSYS_SAT_MIN_PIXELS;
+    }
+    int cnt = 0;
+    for (int i=0; i<n; i++) if (pixels[i] >= CAMSYS_SAT_MIN_PIXELS) floors[cnt++] = floors[i];
+    if (camsys_sat_build(buf, width, height, floors, cnt)) {
+        uint32_t hits;
+        uint32_t zones_score = zones_check(buf, camsys_sat.prev, &hits);
+        if (score < zones_score) score = zones_score;
+        *reasons |= hits;
+        camsys_heatmap_check();
+    }
+    camsys_sat_next(buf);
+    return score;
+}
+
+// -----------------------------------
+
+// Motion events (see event.h) out of the scores of camsys_motion_check(), sent as
+// alert_start and alert_end with the reasons: "watch" is the watch window, the others
+// are zone names. Set by !EVENT, kept in NVS. A message stays pending until sent.
+
+#define CAMSYS_EVENT_MSG_SIZE (128 + ZONE_MAX * (ZONE_NAME_SIZE + 3))
+
+event_params_t camsys_event_params = { .n = 3, .m = 5, .min_ms = 3000, .hold_ms = 2000, .cooldown_ms = 5000 };
+event_t camsys_event;
+bool camsys_event_dirty = true;         // camsys_event_params changed
+uint32_t camsys_event_reasons = 0;      // of the current event
+char camsys_event_start_msg[CAMSYS_EVENT_MSG_SIZE] = "";  // pending when not empty
+char camsys_event_end_msg[CAMSYS_EVENT_MSG_SIZE] = "";
+
+esp_err_t camsys_event_save(nvs_handle_t handle, const event_params_t* params) {
+    esp_err_t err = nvs_set_u8(handle, "evn", params->n);
+    if (err == ESP_OK) err = nvs_set_u8(handle, "evm", params->m);
+    if (err == ESP_OK) err = nvs_set_u32(handle, "evmin", params->min_ms);
+    if (err == ESP_OK) err = nvs_set_u32(handle, "evhold", params->hold_ms);
+    if (err == ESP_OK) err = nvs_set_u32(handle, "evcool", params->cooldown_ms);
+    if (err == ESP_OK) err = nvs_commit(handle);
+    return err;
+}
+
+esp_err_t camsys_event_load(nvs_handle_t handle, event_params_t* params) {
+    event_params_t loaded = *params;
+    esp_err_t err = nvs_get_u8(handle, "evn", &loaded.n);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u8(handle, "evm", &loaded.m);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u32(handle, "evmin", &loaded.min_ms);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u32(handle, "evhold", &loaded.hold_ms);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) err = nvs_get_u32(handle, "evcool", &loaded.cooldown_ms);
+    if (err == ESP_ERR_NVS_NOT_FOUND) err = ESP_OK;
+    if (loaded.m >= 1 && loaded.m <= EVENT_FRAMES_MAX && loaded.n >= 1 && loaded.n <= loaded.m) {
+        params->n = loaded.n;
+        params->m = loaded.m;
+    }
+    if (loaded.min_ms <= EVENT_MS_MAX) params->min_ms = loaded.min_ms;
+    if (loaded.hold_ms <= EVENT_MS_MAX) params->hold_ms = loaded.hold_ms;
+    if (loaded.cooldown_ms <= EVENT_MS_MAX) params->cooldown_ms = loaded.cooldown_ms;
+    return err;
+}
+
+// parses "n=<1..32> m=<1..32> min=<ms> hold=<ms> cooldown=<ms>", every key is optional
+esp_err_t camsys_event_parse(const char* params, event_params_t* out) {
+    char buff[100];
+    strncpy(buff, params, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+    event_params_t parsed = *out;
+    char* save = NULL;
+    for (char* tok = strtok_r(buff, " ", &save); tok; tok = strtok_r(NULL, " ", &save)) {
+        char* val = strchr(tok, '=');
+        if (!val) return ESP_ERR_INVALID_ARG;
+        *val++ = '\0';
+        long v = atol(val);
+        if (!strcmp(tok, "n") || !strcmp(tok, "m")) {
+            if (v < 1 || v > EVENT_FRAMES_MAX) return ESP_ERR_INVALID_ARG;
+            if (tok[0] == 'n') parsed.n = v;
+            else parsed.m = v;
+        } else if (v < 0 || v > EVENT_MS_MAX) {
+            return ESP_ERR_INVALID_ARG;
+        } else if (!strcmp(tok, "min")) parsed.min_ms = v;
+        else if (!strcmp(tok, "hold")) parsed.hold_ms = v;
+        else if (!strcmp(tok, "cooldown")) parsed.cooldown_ms = v;
+        else return ESP_ERR_INVALID_ARG;
+    }
+    if (parsed.n > parsed.m) return ESP_ERR_INVALID_ARG;
+    *out = parsed;
+    return ESP_OK;
+}
+
+// "watch","door",..
+int camsys_event_reasons_json(uint32_t reasons, char* buf, size_t size) {
+    int len = snprintf(buf, size, "%s", reasons & CAMSYS_REASON_WATCH ? "\"watch\"" : "");
+    if (!camsys_zones_lock) return len;
+    xSemaphoreTake(camsys_zones_lock, portMAX_DELAY);
+    for (int i=0; i<camsys_zones.count && len < size; i++) if (reasons & (1UL << i))
+        len += snprintf(buf + len, size - len, "%s\"%s\"", len ? "," : "", camsys_zones.zones[i].name);
+    xSemaphoreGive(camsys_zones_lock);
+    return len;
+}
+
+void camsys_event_end_msg_build() {
+    char reasons[CAMSYS_EVENT_MSG_SIZE - 100];
+    camsys_event_reasons_json(camsys_event_reasons, reasons, sizeof(reasons));
+    snprintf(camsys_event_end_msg, sizeof(camsys_event_end_msg), "{\"func\":\"alert_end\",\"zones\":[%s],\"peak\":%u,\"duration_ms\":%u,\"suppressed\":%u}",
+        reasons, camsys_event.peak, camsys_event.duration_ms, camsys_event.suppressed);
+}
+
+// feeds the score of a checked frame to the event, returns EVENT_START, EVENT_END
+// or EVENT_NONE and leaves its message pending
+int camsys_event_check(uint32_t score, uint32_t reasons) {
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    if (camsys_event_dirty) {
+        // new parameters end the current event
+        camsys_event_dirty = false;
+        bool active = camsys_event.active;
+        if (active) {
+            camsys_event.duration_ms = now_ms - camsys_event.start_ms;
+            camsys_event_end_msg_build();
+        }
+        event_init(&camsys_event, &camsys_event_params);
+        if (active) return EVENT_END;
+    }
+    int ev = event_update(&camsys_event, now_ms, score);
+    if (ev == EVENT_START) {
+        // an unsent start takes its end with it, the server never saw that event
+        if (camsys_event_start_msg[0]) camsys_event_end_msg[0] = '\0';
+        camsys_event_reasons = reasons;
+        char buf[CAMSYS_EVENT_MSG_SIZE - 60];
+        camsys_event_reasons_json(reasons, buf, sizeof(buf));
+        snprintf(camsys_event_start_msg, sizeof(camsys_event_start_msg), "{\"func\":\"alert_start\",\"zones\":[%s],\"score\":%u}", buf, score);
+    } else if (camsys_event.active || ev == EVENT_END) {
+        if (score >= EVENT_SCORE_HIT) camsys_event_reasons |= reasons;
+        if (ev == EVENT_END) camsys_event_end_msg_build();
+    }
+    return ev;
+}
+
+bool camsys_event_send_msg(wifi_app_t* app, char* msg) {
+    if (!msg[0]) return true;
+    if (ESP_OK != websock_sendf(app->ext->client, "%s", msg)) return false;
+    msg[0] = '\0';
+    return true;
+}
+
+// sends the pending messages in order: a pending end is of the previous event while
+// the current one is active
+void camsys_event_send(wifi_app_t* app) {
+    if (camsys_event.active) {
+        if (camsys_event_send_msg(app, camsys_event_end_msg)) camsys_event_send_msg(app, camsys_event_start_msg);
+    } else {
+        if (camsys_event_send_msg(app, camsys_event_start_msg)) camsys_event_send_msg(app, camsys_event_end_msg);
+    }
+}
+
+// !EVENT, the loop picks the parameters up with the next frame
+void camsys_event_apply(const event_params_t* params) {
+    camsys_event_params = *params;
+    camsys_event_dirty = true;
+}
+
+void camsys_motion_websock_loop(wifi_app_t* app) {
     
-    if (camsys_motion_websock_loop_alert) {
-        // PRINT("******************************************************");
-        // PRINT("*********************** [ALERT] **********************");
-        // PRINT("******************************************************");
-        if (ESP_OK == websock_sendf(app->ext->client, "{\"func\":\"alert\"}") ) camsys_motion_websock_loop_alert = false;
+    camera_fb_t* fb = motion_fb;
+
+    fb = camsys_fb_get(app);            
+    if (!fb) {
+        ESP_LOGE(TAG, "Motion Cam capture fail");
+        return;
     }
+
+    uint32_t reasons;
+    uint32_t score = camsys_motion_check(fb->buf, fb->width, fb->height, &reasons);
+    camsys_event_check(score, reasons);
+    camsys_event_send(app);
+    camsys_heatmap_send(app);
     
     ESP_ERROR_CHECK( camsys_fb_return(fb) );
 }
 
+#define CAMSYS_CAMERA_LOOP_MS 100
+
+// the capture task records (or fills the preroll), streaming or not. Motion is checked
+// here every motion_ms on the latest frame. A motion event starts the recording right
+// away and stops it when it ends, unless the server took the recording over.
+void camsys_camera_websock_loop(wifi_app_t* app) {
+    delay(CAMSYS_CAMERA_LOOP_MS);
+    camsys_motion_t* motion = app->ext->sys->motion;
+    int64_t now_us = esp_timer_get_time();
+    if (!camsys_settings.motion_ms || now_us - motion->last_us < camsys_settings.motion_ms * 1000LL) return;
+    motion->last_us = now_us;
+
+    camsys_frame_t* frame = camsys_frame_snapshot(&camsys_frames);
+    if (!frame) return;
+    esp_err_t err = frame->fb->format == PIXFORMAT_JPEG ? camsys_motion_decode(motion, frame->fb->buf, frame->fb->len) : ESP_FAIL;
+    camsys_frame_release(&camsys_frames, frame);
+    metrics_since(METRICS_HOLD_MOTION, now_us);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "motion decode err");
+        return;
+    }
+
+    uint32_t reasons;
+    uint32_t score = camsys_motion_check(motion->gray, MOTION_SIZE, MOTION_SIZE, &reasons);
+    int ev = camsys_event_check(score, reasons);
+    if (ev == EVENT_START) {
+        ESP_LOGI(TAG, "motion: rec start");
+        if (ESP_OK != camera_recording_start(app->ext->sys->camera, true)) ESP_LOGE(TAG, "motion: rec start err");
+    } else if (ev == EVENT_END) {
+        ESP_LOGI(TAG, "motion: rec stop");
+        if (ESP_OK != camera_recording_stop(app->ext->sys->camera, true)) ESP_LOGE(TAG, "motion: rec stop err");
+    }
+    camsys_event_send(app);
+    camsys_heatmap_send(app);
+}
+
 // ---------------------------------------------------------------
 // WIFI APP
 // ---------------------------------------------------------------
@@ -1324,6 +4558,10 @@ void wifi_app_run(wifi_app_t* app) {
 
     sdcard_init();
 
+    if (app->ext->sys->mode == CAMSYS_MODE_CAMERA && sdcard_initialized) camera_recording_recover(app->ext->sys->camera);
+
+    if (app->ext->sys->mode == CAMSYS_MODE_CAMERA) ESP_ERROR_CHECK( camsys_frame_hub_start(&camsys_frames, app) );
+
     wifi_connection_establish(app);
 
     while(!app->exited) {
@@ -1421,16 +4659,35 @@ void wifi_app_main(wifi_app_t* app) {
             ESP_ERROR_CHECK( camsys_app_mode_load(app->nvs_handle, &mode) );
             app->ext->sys->mode = (bool)mode;
 
-            if (app->ext->sys->mode == CAMSYS_MODE_MOTION) {
+            if (app->ext->sys->mode == CAMSYS_MODE_CAMERA) {
+                ESP_ERROR_CHECK( camsys_index_interval_load(app->nvs_handle, &app->ext->sys->camera->index_interval_ms) );
+                ESP_ERROR_CHECK( camsys_fill_level_load(app->nvs_handle, &app->ext->sys->camera->segments.fill_level) );
+                ESP_ERROR_CHECK( camsys_camera_settings_load(app->nvs_handle, &camsys_settings) );
+            }
+
+            // camera mode watches too (see camsys_camera_websock_loop)
+            {
                 const size_t size = 100;
                 char buff[size];// = "44,44,10,5,251";
                 ESP_ERROR_CHECK( watch_load(app->nvs_handle, buff, size) );
                 watch_restore(buff);
             }
+            ESP_ERROR_CHECK( zones_load(app->nvs_handle) );
+            {
+                watcher_detect_t detect = watcher_detect;
+                ESP_ERROR_CHECK( watcher_detect_load(app->nvs_handle, &detect) );
+                ESP_ERROR_CHECK_WITHOUT_ABORT( watcher_detect_apply(&detect) );
+            }
+            ESP_ERROR_CHECK( camsys_event_load(app->nvs_handle, &camsys_event_params) );
+            {
+                camsys_heatmap_settings_t heatmap = camsys_heatmap_settings;
+                ESP_ERROR_CHECK( camsys_heatmap_load(app->nvs_handle, &heatmap) );
+                camsys_heatmap_apply(&heatmap);
+            }
 
             ESP_LOGI(TAG, "MODE: %d", (uint8_t)app->ext->sys->mode);
 
-            camsys_camera_init(app->ext->sys->mode, true);
+            ESP_ERROR_CHECK( camsys_camera_init(app->ext->sys->mode, true) );
 
             ESP_ERROR_CHECK( wifi_creds_load(app) );
 
@@ -1635,6 +4892,7 @@ void wscli_app_on_websock_connected(void* arg) {
     wifi_app_t* app = arg; // using argument as an app
     ESP_LOGI(TAG, "----------- [WEBSOCKET CONNECTED] -------------");
     ESP_ERROR_CHECK_WITHOUT_ABORT( websock_sendf(app->ext->client, "HELLO %s %s", app->ext->secret, app->ext->cid) );
+    camsys_heatmap_keyframe();
     
 }
 
@@ -1646,19 +4904,32 @@ void wscli_app_on_websock_disconnected(void* arg) {
 
 //-------------------------------
 
-#define RESPONSE_SIZE 1000
+#define RESPONSE_SIZE 1500 // fits ?STATS
 char response_buff[RESPONSE_SIZE];
-int camsys_resp_update(camsys_t* sys, watcher_t watcher, size_t diff_sum_max) {
+int camsys_resp_update(camsys_t* sys, watcher_t watcher, size_t diff_sum_max, size_t fg_max) {
     response_buff[0] = '\0';
     return snprintf(response_buff, RESPONSE_SIZE, 
-        "{\"func\":\"update\",\"mode\":\"%s\",\"streaming\":%s,\"camera\":{\"recording\":%s},\"watcher\":{\"x\":%d,\"y\":%d,\"size\":%d,\"raster\":%d,\"threshold\":%d,\"diff_sum_max\":%d}}", 
+        "{\"func\":\"update\",\"mode\":\"%s\",\"streaming\":%s,\"camera\":{\"recording\":%s,\"dropped\":%u,\"framesize\":\"%s\",\"quality\":%d,\"fps\":%d,\"motion_ms\":%d,\"abr\":{\"target_ms\":%d,\"active\":%s,\"send_ms\":%d,\"frame_bytes\":%u,\"framesize\":\"%s\",\"quality\":%d}},\"watcher\":{\"x\":%d,\"y\":%d,\"size\":%d,\"raster\":%d,\"threshold\":%d,\"diff_sum_max\":%d,\"method\":\"%s\",\"pixels\":%d,\"fg_max\":%u},\"heatmap\":{\"ms\":%d,\"cells\":%d},\"event\":{\"n\":%d,\"m\":%d,\"min_ms\":%u,\"hold_ms\":%u,\"cooldown_ms\":%u,\"active\":%s,\"suppressed\":%u}}", 
         (sys->mode == CAMSYS_MODE_CAMERA ? "camera" : "motion"),
         (sys->streaming ? "true" : "false"),
-        (sys->camera->file ? "true" : "false"),
-        watcher.x, watcher.y, watcher.size, watcher.raster, watcher.threshold, diff_sum_max
+        (sys->camera->recording ? "true" : "false"),
+        (sys->camera->recording ? sys->camera->recorder.dropped : 0),
+        camsys_framesize_name(camsys_settings.framesize), camsys_settings.quality, camsys_settings.fps, camsys_settings.motion_ms,
+        camsys_settings.abr_ms, (camsys_abr.active ? "true" : "false"), abr_send_ms(&camsys_abr), camsys_abr.frame_bytes,
+        camsys_framesize_name(camsys_abr.framesize), camsys_abr.quality,
+        watcher.x, watcher.y, watcher.size, watcher.raster, watcher.threshold, diff_sum_max,
+        (watcher_detect.method == WATCHER_METHOD_BG ? "bg" : "diff"), watcher_detect.pixels, (unsigned)fg_max,
+        camsys_heatmap_settings.ms, camsys_heatmap_settings.cells,
+        camsys_event_params.n, camsys_event_params.m, camsys_event_params.min_ms, camsys_event_params.hold_ms, camsys_event_params.cooldown_ms,
+        (camsys_event.active ? "true" : "false"), camsys_event.suppressed
     );
 }
 
+// a failed NVS write is reported to the server, the new setting applies until reboot
+int camsys_resp_save_err(esp_err_t err) {
+    return snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"settings save error: %d\"}", err);
+}
+
 esp_err_t camsys_handle_cmd(wifi_app_t* app, const char* cmd) {
     int outlen = -1; 
 
@@ -1668,57 +4939,69 @@ esp_err_t camsys_handle_cmd(wifi_app_t* app, const char* cmd) {
     if (!strcmp(cmd, "?UPDATE")) {
         
 
+    } else if (!strcmp(cmd, "?STATS")) {
+
+        outlen = metrics_json(response_buff, RESPONSE_SIZE);
+
     } else if (!strcmp(cmd, "?INDEX")) {
 
-        if (!app->ext->sys->camera->idxf) {
-            long int sz = get_file_size(SDCARD_MOUNT_POINT"/record.idx");
+        if (!app->ext->sys->camera->recording) {
+            long int sz = camera_index_size(app->ext->sys->camera);
             if (sz < 0) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Index retrieve error: %ld\"}", sz);
             else {
-                sz /= sizeof(long int);
                 outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"index\",\"size\":%ld}", sz);
             }
         } else outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Recording in progress, please stop first.. (1)\"}");
     
+    } else if (str_starts_with("!INDEX INTERVAL ", cmd)) {
+
+        strncpy_offs(buff, 0, cmd, strlen("!INDEX INTERVAL "), 99);
+        long int interval_ms = atol(buff);
+        if (interval_ms < RECORD_INDEX_INTERVAL_MS_MIN) {
+            outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"index interval is too short (min %d ms)\"}", RECORD_INDEX_INTERVAL_MS_MIN);
+        } else {
+            app->ext->sys->camera->index_interval_ms = interval_ms;
+            esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_index_interval_save(app->nvs_handle, interval_ms) );
+            if (err != ESP_OK) outlen = camsys_resp_save_err(err);
+        }
+
+    } else if (str_starts_with("!SEEK ", cmd)) {
+
+        if (!app->ext->sys->camera->recording) {
+            strncpy_offs(buff, 0, cmd, strlen("!SEEK "), 99);
+            ESP_LOGI(TAG, "seek param: '%s'", buff);
+            uint64_t timestamp = strtoull(buff, NULL, 10);
+
+            xSemaphoreTake(app->ext->sys->camera->replay_lock, portMAX_DELAY);
+            esp_err_t err = camera_seek(app->ext->sys->camera, timestamp);
+            xSemaphoreGive(app->ext->sys->camera->replay_lock);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "seek error: %d", err);
+                outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"seek error: %d\"}", err);
+            }
+        } else outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Recording in progress, please stop first.. (3)\"}");
+
+    } else if (str_starts_with("!TIME ", cmd)) {
+
+        strncpy_offs(buff, 0, cmd, strlen("!TIME "), 99);
+        esp_err_t err = camsys_clock_set(strtoull(buff, NULL, 10));
+        if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"time error: %d\"}", err);
+
     } else if (str_starts_with("!INDEX ", cmd)) {
 
-        if (!app->ext->sys->camera->idxf) {
+        if (!app->ext->sys->camera->recording) {
             //if (!app->ext->sys->streaming) {
 
                 strncpy_offs(buff, 0, cmd, strlen("!INDEX "), 99);
                 ESP_LOGI(TAG, "index param: '%s'", buff);
                 long int n = atoi(buff);
 
-                FILE* idxf = fopen(SDCARD_MOUNT_POINT"/record.idx", "rb");
-                if (!idxf) {
-                    ESP_LOGW(TAG, "index file open error (2): %d", errno);
-                    outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"index file open error (2): %d\"}", errno);
-                } else {
-                    
-                    if (fseek(idxf, n * sizeof(long int), SEEK_SET)) {                
-                        ESP_LOGW(TAG, "index file seek error");
-                        outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"index file seek error\"}");
-                    } else {
-
-                        long int fpos; 
-                        if (1 != fread(&fpos, sizeof(long int), 1, idxf)) {
-                            ESP_LOGW(TAG, "index file read error");
-                            outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"index file reed error\"}");
-                        } else {
-
-                            while(camsys_fb_hold) ESP_LOGI(TAG, "FB HOLD... (2)");
-                            if (app->ext->sys->camera->file) {
-                                if (fseek(app->ext->sys->camera->file, fpos, SEEK_SET)) {                
-                                    ESP_LOGW(TAG, "record video file seek error");
-                                    outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"record video file seek error\"}");
-                                } else {
-
-                                    if (fclose(idxf)) ESP_LOGW(TAG, "index file close error");
-                                }
-                            } else outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Video file is not open..\"}");
-                        }
-
-                    }
-
+                xSemaphoreTake(app->ext->sys->camera->replay_lock, portMAX_DELAY);
+                esp_err_t err = camera_index_seek(app->ext->sys->camera, n);
+                xSemaphoreGive(app->ext->sys->camera->replay_lock);
+                if (err != ESP_OK) {
+                    ESP_LOGW(TAG, "index seek error: %d", err);
+                    outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"index seek error: %d\"}", err);
                 }
 
             //} else outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Start stream first..\"}");
@@ -1730,18 +5013,97 @@ esp_err_t camsys_handle_cmd(wifi_app_t* app, const char* cmd) {
 
     } else if (!strcmp(cmd, "!RECORD START")) {
 
-        esp_err_t err = camera_recording_start(app->ext->sys->camera);
+        esp_err_t err = camera_recording_start(app->ext->sys->camera, false); // the server stops it
         if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"record start error: '%d'\"}", err);
 
     } else if (!strcmp(cmd, "!RECORD STOP")) {
 
-        esp_err_t err = camera_recording_stop(app->ext->sys->camera);
+        esp_err_t err = camera_recording_stop(app->ext->sys->camera, false);
         if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"record stop error: '%d'\"}", err);
 
+    } else if (str_starts_with("!RECORD FILL ", cmd)) {
+
+        strncpy_offs(buff, 0, cmd, strlen("!RECORD FILL "), 99);
+        long int fill_level = atol(buff);
+        if (fill_level < RECORD_FILL_LEVEL_MIN || fill_level > RECORD_FILL_LEVEL_MAX) {
+            outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"fill level out of range (%d..%d %%)\"}", RECORD_FILL_LEVEL_MIN, RECORD_FILL_LEVEL_MAX);
+        } else {
+            // read by the recorder task at the next segment, a byte is written at once
+            app->ext->sys->camera->segments.fill_level = fill_level;
+            esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_fill_level_save(app->nvs_handle, fill_level) );
+            if (err != ESP_OK) outlen = camsys_resp_save_err(err);
+        }
+
     } else if (!strcmp(cmd, "!RECORD DELETE")) {
 
         esp_err_t err = camera_recording_delete(app->ext->sys->camera);
-        if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"record delete error: '%d'\"}", err);
+        if (err == ESP_ERR_INVALID_STATE) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"Download in progress, please try again later..\"}");
+        else if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"record delete error: '%d'\"}", err);
+
+    } else if (str_starts_with("!CONFIG ", cmd)) {
+
+        if (app->ext->sys->mode == CAMSYS_MODE_CAMERA) {
+            camsys_camera_settings_t settings = camsys_settings;
+            esp_err_t err = camsys_camera_settings_parse(cmd + strlen("!CONFIG "), &settings);
+            if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"config error, use: framesize=<QVGA|VGA|SVGA|..> quality=<%d..%d> fps=<0..%d> abr=<0..%d ms> motion=<0|%d..%d ms>\"}", CAMSYS_QUALITY_MIN, CAMSYS_QUALITY_MAX, CAMSYS_FPS_MAX, CAMSYS_ABR_MS_MAX, CAMSYS_MOTION_MS_MIN, CAMSYS_MOTION_MS_MAX);
+            else {
+                err = camsys_camera_configure(&camsys_frames, &settings);
+                if (err != ESP_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"config apply error: '%d'\"}", err);
+                else if (ESP_OK != (err = ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_camera_settings_save(app->nvs_handle, &camsys_settings) ))) outlen = camsys_resp_save_err(err);
+            }
+        } else outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"config is for camera mode only\"}");
+
+    } else if (str_starts_with("!ZONE DEL ", cmd)) {
+
+        int err = zones_update(NULL, cmd + strlen("!ZONE DEL "));
+        if (err != ZONE_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"zone error: %s\"}", zone_strerror(err));
+        else {
+            esp_err_t save_err = ESP_ERROR_CHECK_WITHOUT_ABORT( zones_save(app->nvs_handle) );
+            outlen = save_err == ESP_OK ? zones_json(response_buff, RESPONSE_SIZE) : camsys_resp_save_err(save_err);
+        }
+
+    } else if (str_starts_with("!ZONE ", cmd)) {
+
+        int err = zones_update(cmd + strlen("!ZONE "), NULL);
+        if (err != ZONE_OK) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"zone error: %s, use: name=<name> threshold=<sum> sensitivity=<0..255> ignore=<0|1> poly=x,y;x,y;x,y.. or mask=<cols>x<rows>:<hex>\"}", zone_strerror(err));
+        else {
+            esp_err_t save_err = ESP_ERROR_CHECK_WITHOUT_ABORT( zones_save(app->nvs_handle) );
+            outlen = save_err == ESP_OK ? zones_json(response_buff, RESPONSE_SIZE) : camsys_resp_save_err(save_err);
+        }
+
+    } else if (!strcmp(cmd, "?ZONES")) {
+
+        outlen = zones_json(response_buff, RESPONSE_SIZE);
+
+    } else if (str_starts_with("!DETECT ", cmd)) {
+
+        watcher_detect_t detect = watcher_detect;
+        if (ESP_OK != watcher_detect_parse(cmd + strlen("!DETECT "), &detect)) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"detect error, use: method=<diff|bg> rate=<0..%d> sigma=<1..%d> noise=<0..%d> pixels=<1..%d>\"}", BG_RATE_MAX, BG_SIGMA_MAX, WATCHER_NOISE_MAX, WATCHER_PIXELS_MAX);
+        else if (ESP_OK != watcher_detect_apply(&detect)) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"no memory for the background model\"}");
+        else {
+            esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT( watcher_detect_save(app->nvs_handle, &watcher_detect) );
+            if (err != ESP_OK) outlen = camsys_resp_save_err(err);
+        }
+
+    } else if (str_starts_with("!HEATMAP ", cmd)) {
+
+        camsys_heatmap_settings_t heatmap = camsys_heatmap_settings;
+        if (ESP_OK != camsys_heatmap_parse(cmd + strlen("!HEATMAP "), &heatmap)) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"heatmap error, use: ms=<0|%d..%d> cells=<%d..%d>\"}", HEATMAP_MS_MIN, HEATMAP_MS_MAX, HEATMAP_CELLS_MIN, HEATMAP_CELLS_MAX);
+        else {
+            camsys_heatmap_apply(&heatmap);
+            esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_heatmap_save(app->nvs_handle, &camsys_heatmap_settings) );
+            if (err != ESP_OK) outlen = camsys_resp_save_err(err);
+        }
+
+    } else if (str_starts_with("!EVENT ", cmd)) {
+
+        event_params_t params = camsys_event_params;
+        if (ESP_OK != camsys_event_parse(cmd + strlen("!EVENT "), &params)) outlen = snprintf(response_buff, RESPONSE_SIZE, "{\"func\":\"err\",\"msg\":\"event error, use: n=<1..%d> m=<n..%d> min=<ms> hold=<ms> cooldown=<ms> (ms up to %d)\"}", EVENT_FRAMES_MAX, EVENT_FRAMES_MAX, EVENT_MS_MAX);
+        else {
+            camsys_event_apply(&params);
+            esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT( camsys_event_save(app->nvs_handle, &camsys_event_params) );
+            if (err != ESP_OK) outlen = camsys_resp_save_err(err);
+        }
 
     } else if (str_starts_with("!WATCH ", cmd)) {
 
@@ -1767,7 +5129,10 @@ esp_err_t camsys_handle_cmd(wifi_app_t* app, const char* cmd) {
         size_t diff_sum_max = watcher.diff_sum_max;
         watcher.diff_sum_max = 0;
 
-        outlen = camsys_resp_update(sys, watcher, diff_sum_max);
+        size_t fg_max = watcher_fg_max;
+        watcher_fg_max = 0;
+
+        outlen = camsys_resp_update(sys, watcher, diff_sum_max, fg_max);
     }
 
     if (-1 >= outlen || -1 >= esp_websocket_client_send_text(app->ext->client, response_buff, outlen, portMAX_DELAY)) {
@@ -1875,6 +5240,7 @@ void app_main() {
     camera_recording_init(&camera);
 
     camsys_motion_t motion;
+    camsys_motion_init(&motion);
 
     sys.camera = &camera;
     sys.motion = &motion;
@@ -0,0 +1,167 @@
+#include <string.h>
+#include "avi.h"
+
+#define AVI_FOURCC(p, s) memcpy((p), (s), 4)
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+static void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+static uint32_t avi_chunk_size(uint32_t len) {
+    return AVI_CHUNK_HEADER_SIZE + len + (len & 1);
+}
+
+static void avi_header_encode(avi_file_t* avi, uint16_t width, uint16_t height, uint32_t usec_per_frame, uint32_t max_len) {
+    uint8_t* p = avi->header;
+    uint32_t bytes_per_sec = usec_per_frame ? (uint32_t)((uint64_t)max_len * 1000000 / usec_per_frame) : 0;
+    memset(p, 0, AVI_HEADER_SIZE);
+
+    AVI_FOURCC(p, "RIFF");
+    put_u32(p + 4, avi->size - 8);
+    AVI_FOURCC(p + 8, "AVI ");
+
+    AVI_FOURCC(p + 12, "LIST");
+    put_u32(p + 16, 192);
+    AVI_FOURCC(p + 20, "hdrl");
+
+    AVI_FOURCC(p + 24, "avih");
+    put_u32(p + 28, 56);
+    put_u32(p + 32, usec_per_frame);
+    put_u32(p + 36, bytes_per_sec);
+    put_u32(p + 44, AVIF_HASINDEX);
+    put_u32(p + 48, avi->frames_cnt);
+    put_u32(p + 56, 1); // streams
+    put_u32(p + 60, max_len);
+    put_u32(p + 64, width);
+    put_u32(p + 68, height);
+
+    AVI_FOURCC(p + 88, "LIST");
+    put_u32(p + 92, 116);
+    AVI_FOURCC(p + 96, "strl");
+
+    AVI_FOURCC(p + 100, "strh");
+    put_u32(p + 104, 56);
+    AVI_FOURCC(p + 108, "vids");
+    AVI_FOURCC(p + 112, "MJPG");
+    put_u32(p + 128, usec_per_frame); // scale
+    put_u32(p + 132, 1000000);        // rate
+    put_u32(p + 140, avi->frames_cnt);
+    put_u32(p + 144, max_len);
+    put_u32(p + 148, 0xFFFFFFFFUL);   // quality: default
+    put_u16(p + 160, width);
+    put_u16(p + 162, height);
+
+    AVI_FOURCC(p + 164, "strf");
+    put_u32(p + 168, 40);
+    put_u32(p + 172, 40);
+    put_u32(p + 176, width);
+    put_u32(p + 180, height);
+    put_u16(p + 184, 1);
+    put_u16(p + 186, 24);
+    AVI_FOURCC(p + 188, "MJPG");
+    put_u32(p + 192, (uint32_t)width * height * 3);
+
+    AVI_FOURCC(p + 212, "LIST");
+    put_u32(p + 216, 4 + avi->movi_size);
+    AVI_FOURCC(p + 220, "movi");
+}
+
+// Lays out the frames, stops before the file would exceed AVI_SIZE_MAX.
+// Returns the number of frames in the file.
+uint32_t avi_file_init(avi_file_t* avi, avi_frame_t* frames, uint32_t cnt,
+    uint16_t width, uint16_t height, uint32_t usec_per_frame, avi_payload_cb_t read, void* arg) {
+    uint64_t movi_size = 0;
+    uint32_t max_len = 0;
+    uint32_t n = 0;
+    for (; n<cnt; n++) {
+        uint64_t next = movi_size + avi_chunk_size(frames[n].len);
+        if (AVI_HEADER_SIZE + next + AVI_CHUNK_HEADER_SIZE + (uint64_t)(n + 1) * AVI_INDEX_ENTRY_SIZE > AVI_SIZE_MAX) break;
+        frames[n].movi_pos = movi_size;
+        movi_size = next;
+        if (max_len < frames[n].len) max_len = frames[n].len;
+    }
+    avi->frames = frames;
+    avi->frames_cnt = n;
+    avi->movi_size = movi_size;
+    avi->size = AVI_HEADER_SIZE + avi->movi_size + AVI_CHUNK_HEADER_SIZE + n * AVI_INDEX_ENTRY_SIZE;
+    avi->read = read;
+    avi->arg = arg;
+    avi_header_encode(avi, width, height, usec_per_frame, max_len);
+    return n;
+}
+
+// chunk containing movi data offset pos
+static uint32_t avi_frame_at(const avi_file_t* avi, uint32_t pos) {
+    uint32_t lo = 0, hi = avi->frames_cnt;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (avi->frames[mid].movi_pos <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Produces up to size bytes of the file from pos, returns the number of bytes
+// (less than size only at the end of the file) or AVI_ERR_READ.
+long avi_file_read(const avi_file_t* avi, uint32_t pos, uint8_t* buf, size_t size) {
+    uint8_t tmp[AVI_INDEX_ENTRY_SIZE];
+    size_t done = 0;
+    uint32_t movi_end = AVI_HEADER_SIZE + avi->movi_size;
+    while (done < size && pos < avi->size) {
+        size_t n;
+        if (pos < AVI_HEADER_SIZE) {
+            n = AVI_HEADER_SIZE - pos;
+            if (n > size - done) n = size - done;
+            memcpy(buf + done, avi->header + pos, n);
+        } else if (pos < movi_end) {
+            uint32_t mpos = pos - AVI_HEADER_SIZE;
+            const avi_frame_t* frame = &avi->frames[avi_frame_at(avi, mpos)];
+            uint32_t off = mpos - frame->movi_pos;
+            if (off < AVI_CHUNK_HEADER_SIZE) {
+                AVI_FOURCC(tmp, "00dc");
+                put_u32(tmp + 4, frame->len);
+                n = AVI_CHUNK_HEADER_SIZE - off;
+                if (n > size - done) n = size - done;
+                memcpy(buf + done, tmp + off, n);
+            } else if (off - AVI_CHUNK_HEADER_SIZE < frame->len) {
+                uint32_t delta = off - AVI_CHUNK_HEADER_SIZE;
+                n = frame->len - delta;
+                if (n > size - done) n = size - done;
+                if (avi->read(avi->arg, frame, delta, buf + done, n)) return AVI_ERR_READ;
+            } else {
+                n = 1;
+                buf[done] = 0; // pad to even size
+            }
+        } else {
+            uint32_t ipos = pos - movi_end;
+            uint32_t off;
+            if (ipos < AVI_CHUNK_HEADER_SIZE) {
+                AVI_FOURCC(tmp, "idx1");
+                put_u32(tmp + 4, avi->frames_cnt * AVI_INDEX_ENTRY_SIZE);
+                off = ipos;
+                n = AVI_CHUNK_HEADER_SIZE - off;
+            } else {
+                const avi_frame_t* frame = &avi->frames[(ipos - AVI_CHUNK_HEADER_SIZE) / AVI_INDEX_ENTRY_SIZE];
+                AVI_FOURCC(tmp, "00dc");
+                put_u32(tmp + 4, AVIIF_KEYFRAME);
+                put_u32(tmp + 8, 4 + frame->movi_pos); // from the 'movi' fourcc
+                put_u32(tmp + 12, frame->len);
+                off = (ipos - AVI_CHUNK_HEADER_SIZE) % AVI_INDEX_ENTRY_SIZE;
+                n = AVI_INDEX_ENTRY_SIZE - off;
+            }
+            if (n > size - done) n = size - done;
+            memcpy(buf + done, tmp + off, n);
+        }
+        done += n;
+        pos += n;
+    }
+    return done;
+}
@@ -0,0 +1,58 @@
+#ifndef AVI_H
+#define AVI_H
+
+// ---------------------------------------------------------------
+// AVI/MJPEG EXPORT
+// ---------------------------------------------------------------
+//
+// A recording range is exported as an AVI 1.0 file that only exists virtually:
+// header, movi chunks and idx1 are generated while the file is read, the JPEG
+// payloads come from the recording through a callback, so any byte range can
+// be produced (HTTP Range) without a temporary file.
+//
+//   RIFF 'AVI '
+//     LIST 'hdrl' { avih, LIST 'strl' { strh, strf } }   AVI_HEADER_SIZE bytes with
+//     LIST 'movi' { '00dc' frame [pad] ... }              the movi list header
+//     idx1 { '00dc', AVIIF_KEYFRAME, offset, len } ...
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AVI_HEADER_SIZE 224
+#define AVI_CHUNK_HEADER_SIZE 8
+#define AVI_INDEX_ENTRY_SIZE 16
+#define AVI_SIZE_MAX 0x7FFFFFFFUL // RIFF sizes are signed in most readers
+
+#define AVI_ERR_READ -1
+
+struct avi_frame_s {
+    uint32_t src;      // source of the payload (segment number on the device)
+    uint32_t offset;   // payload offset in the source
+    uint32_t len;
+    uint32_t movi_pos; // chunk offset in the movi data, set by avi_file_init()
+};
+
+typedef struct avi_frame_s avi_frame_t;
+
+// reads len bytes of the frame payload starting at delta into buf, returns 0 or an error
+typedef int (*avi_payload_cb_t)(void* arg, const avi_frame_t* frame, uint32_t delta, uint8_t* buf, size_t len);
+
+struct avi_file_s {
+    avi_frame_t* frames;
+    uint32_t frames_cnt;
+    uint32_t movi_size;
+    uint32_t size; // of the whole file
+    uint8_t header[AVI_HEADER_SIZE];
+    avi_payload_cb_t read;
+    void* arg;
+};
+
+typedef struct avi_file_s avi_file_t;
+
+uint32_t avi_file_init(avi_file_t* avi, avi_frame_t* frames, uint32_t cnt,
+    uint16_t width, uint16_t height, uint32_t usec_per_frame, avi_payload_cb_t read, void* arg);
+long avi_file_read(const avi_file_t* avi, uint32_t pos, uint8_t* buf, size_t size);
+
+#endif // AVI_H
@@ -0,0 +1,59 @@
+#include "bg.h"
+
+void bg_init(bg_model_t* bg, bg_pixel_t* pixels, size_t size, const bg_params_t* params) {
+    bg->pixels = pixels;
+    bg->size = size;
+    bg->params = *params;
+    if (bg->params.rate > BG_RATE_MAX) bg->params.rate = BG_RATE_MAX;
+    if (bg->params.sigma > BG_SIGMA_MAX) bg->params.sigma = BG_SIGMA_MAX;
+    bg_reset(bg);
+}
+
+void bg_reset(bg_model_t* bg) {
+    bg->n = 0;
+    bg->frames = 0;
+}
+
+// adds (v >> shift) rounded, v may be negative
+static inline int32_t bg_step(int32_t v, int shift) {
+    return (v + ((1 << shift) >> 1)) >> shift;
+}
+
+size_t bg_update(bg_model_t* bg, const uint8_t* samples, size_t n) {
+    if (n > bg->size) n = bg->size;
+    if (n != bg->n) {
+        // new window, learn it from scratch
+        uint16_t var = (uint16_t)(bg->params.sigma_min * bg->params.sigma_min) << 4;
+        for (size_t i = 0; i < n; i++) {
+            bg->pixels[i].mean = samples[i] << 8;
+            bg->pixels[i].var = var;
+        }
+        bg->n = n;
+        bg->frames = 1;
+        return 0;
+    }
+
+    const int rate = bg->params.rate;
+    const int32_t var_min = (int32_t)bg->params.sigma_min * bg->params.sigma_min << 4;
+    const int32_t sigma2 = (int32_t)bg->params.sigma * bg->params.sigma;
+    size_t fg_cnt = 0;
+    bg_pixel_t* px = bg->pixels;
+    for (size_t i = 0; i < n; i++) {
+        int32_t mean = px[i].mean;
+        int32_t var = px[i].var;
+        int32_t d8 = (int32_t)(samples[i] << 8) - mean;
+        int32_t d4 = d8 >> 4;                                 // 12.4
+        int32_t d2 = (d4 * d4) >> 4;                          // 12.4
+        if (d2 > BG_VAR_MAX) d2 = BG_VAR_MAX;
+        int32_t ref = var > var_min ? var : var_min;
+        int fg = d2 > sigma2 * ref;
+        fg_cnt += fg;
+        int shift = rate + (fg ? BG_FG_RATE_EXTRA : 0);
+        mean += bg_step(d8, shift);
+        var += fg ? 0 : bg_step(d2 - var, rate + BG_VAR_RATE_EXTRA);
+        px[i].mean = mean < 0 ? 0 : mean > 0xFF00 ? 0xFF00 : mean;
+        px[i].var = var < 0 ? 0 : var;
+    }
+    bg->frames++;
+    return bg->frames > (1UL << rate) ? fg_cnt : 0;
+}
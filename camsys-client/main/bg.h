@@ -0,0 +1,64 @@
+#ifndef BG_H
+#define BG_H
+
+// ---------------------------------------------------------------
+// BACKGROUND MODEL
+// ---------------------------------------------------------------
+//
+// Per pixel running average and variance of the watched samples, in fixed point
+// (mean 8.8, variance 12.4 in intensity^2) packed in 4 bytes per pixel:
+//
+//   d = x - mean
+//   foreground when d^2 > sigma^2 * max(var, sigma_min^2)
+//   mean += d / 2^rate, var += (d^2 - var) / 2^rate
+//
+// Foreground pixels adapt 2^BG_FG_RATE_EXTRA times slower, so a slow intruder is
+// not learned into the background while it moves, but something left behind is
+// in the end. Slow lighting changes (dawn, dusk) move the mean with them and stay
+// background. No foreground is reported until 2^rate frames were learned.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BG_VAR_MAX (4095 << 4)   // variance cap, sigma 64
+#define BG_FG_RATE_EXTRA 3
+#define BG_VAR_RATE_EXTRA 2
+#define BG_RATE_MAX 10
+#define BG_SIGMA_MAX 15
+
+struct bg_pixel_s {
+    uint16_t mean; // 8.8
+    uint16_t var;  // 12.4
+};
+
+typedef struct bg_pixel_s bg_pixel_t;
+
+struct bg_params_s {
+    uint8_t rate;      // learning rate 1 / 2^rate
+    uint8_t sigma;     // foreground distance in standard deviations
+    uint8_t sigma_min; // noise floor of the standard deviation (intensity)
+};
+
+typedef struct bg_params_s bg_params_t;
+
+struct bg_model_s {
+    bg_pixel_t* pixels;
+    size_t size;       // capacity of pixels
+    size_t n;          // pixels in use, 0 until the first frame
+    uint32_t frames;
+    bg_params_t params;
+};
+
+typedef struct bg_model_s bg_model_t;
+
+void bg_init(bg_model_t* bg, bg_pixel_t* pixels, size_t size, const bg_params_t* params);
+
+// forgets the background, the next frame starts learning
+void bg_reset(bg_model_t* bg);
+
+// learns n samples (more than size are ignored), returns the foreground pixel count
+size_t bg_update(bg_model_t* bg, const uint8_t* samples, size_t n);
+
+#endif // BG_H
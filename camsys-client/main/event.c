@@ -0,0 +1,58 @@
+#include "event.h"
+
+static uint32_t event_clamp(uint32_t v, uint32_t min, uint32_t max) {
+    return v < min ? min : v > max ? max : v;
+}
+
+void event_init(event_t* ev, const event_params_t* params) {
+    ev->params = *params;
+    ev->params.m = event_clamp(params->m, 1, EVENT_FRAMES_MAX);
+    ev->params.n = event_clamp(params->n, 1, ev->params.m);
+    ev->params.min_ms = event_clamp(params->min_ms, 0, EVENT_MS_MAX);
+    ev->params.hold_ms = event_clamp(params->hold_ms, 0, EVENT_MS_MAX);
+    ev->params.cooldown_ms = event_clamp(params->cooldown_ms, 0, EVENT_MS_MAX);
+    ev->history = 0;
+    ev->active = false;
+    ev->cooling = false;
+    ev->start_ms = ev->last_hit_ms = ev->end_ms = 0;
+    ev->peak = 0;
+    ev->duration_ms = 0;
+    ev->suppressed = 0;
+}
+
+static int event_hits(uint32_t history) {
+    int cnt = 0;
+    for (; history; history &= history - 1) cnt++;
+    return cnt;
+}
+
+int event_update(event_t* ev, uint32_t now_ms, uint32_t score) {
+    bool hit = score >= EVENT_SCORE_HIT;
+    if (ev->cooling) {
+        if (now_ms - ev->end_ms < ev->params.cooldown_ms) {
+            ev->suppressed += hit;
+            return EVENT_NONE;
+        }
+        ev->cooling = false;
+    }
+
+    if (ev->active) {
+        if (hit) ev->last_hit_ms = now_ms;
+        if (ev->peak < score) ev->peak = score;
+        if (hit || now_ms - ev->last_hit_ms < ev->params.hold_ms || now_ms - ev->start_ms < ev->params.min_ms) return EVENT_NONE;
+        ev->active = false;
+        ev->duration_ms = now_ms - ev->start_ms;
+        ev->end_ms = now_ms;
+        ev->cooling = ev->params.cooldown_ms > 0;
+        return EVENT_END;
+    }
+
+    uint32_t mask = ev->params.m >= 32 ? 0xFFFFFFFFUL : (1UL << ev->params.m) - 1;
+    ev->history = ((ev->history << 1) | hit) & mask;
+    if (event_hits(ev->history) < ev->params.n) return EVENT_NONE;
+    ev->history = 0;
+    ev->active = true;
+    ev->start_ms = ev->last_hit_ms = now_ms;
+    ev->peak = score;
+    return EVENT_START;
+}
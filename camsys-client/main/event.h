@@ -0,0 +1,63 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+// ---------------------------------------------------------------
+// MOTION EVENTS
+// ---------------------------------------------------------------
+//
+// Debounces the motion score of the checked frames into events, with hysteresis:
+//
+//   idle -> active   when n of the last m frames hit (score >= EVENT_SCORE_HIT)
+//   active -> idle   when no frame hit for hold_ms and the event lasted min_ms
+//   cool-down        for cooldown_ms after an event no frame counts, the hits are
+//                    only counted as suppressed
+//
+// Hits during an event extend it instead of starting another one. The score is in
+// percent of the threshold (100 is at the threshold), the event keeps its peak.
+// Times are in ms of a free running clock, differences survive the wrap around.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EVENT_NONE 0
+#define EVENT_START 1
+#define EVENT_END 2
+
+#define EVENT_SCORE_HIT 100
+#define EVENT_FRAMES_MAX 32   // m
+#define EVENT_MS_MAX 600000
+
+struct event_params_s {
+    uint8_t n;              // hits ..
+    uint8_t m;              // .. of the last m frames start an event (1 of 1: every hit)
+    uint32_t min_ms;        // shortest event
+    uint32_t hold_ms;       // an event ends this long after its last hit
+    uint32_t cooldown_ms;
+};
+
+typedef struct event_params_s event_params_t;
+
+struct event_s {
+    event_params_t params;
+    uint32_t history;       // hit bits of the last m frames, newest lowest
+    bool active;
+    bool cooling;
+    uint32_t start_ms;
+    uint32_t last_hit_ms;
+    uint32_t end_ms;
+    uint32_t peak;          // of the current (or last) event
+    uint32_t duration_ms;   // of the last event
+    uint32_t suppressed;    // hits in cool-downs, from init
+};
+
+typedef struct event_s event_t;
+
+// the parameters are clamped: 1 <= n <= m <= EVENT_FRAMES_MAX, times to EVENT_MS_MAX
+void event_init(event_t* ev, const event_params_t* params);
+
+// takes the score of a frame, returns EVENT_START, EVENT_END or EVENT_NONE
+int event_update(event_t* ev, uint32_t now_ms, uint32_t score);
+
+#endif // EVENT_H
@@ -0,0 +1,70 @@
+#include <string.h>
+#include "heatmap.h"
+
+static int heatmap_clamp(int v) {
+    return v < HEATMAP_CELLS_MIN ? HEATMAP_CELLS_MIN : v > HEATMAP_CELLS_MAX ? HEATMAP_CELLS_MAX : v;
+}
+
+void heatmap_init(heatmap_t* map, int cols, int rows) {
+    map->cols = heatmap_clamp(cols);
+    map->rows = heatmap_clamp(rows);
+    memset(map->peak, 0, sizeof(map->peak));
+    memset(map->sent, 0, sizeof(map->sent));
+    map->keyframe = true;
+}
+
+void heatmap_keyframe(heatmap_t* map) {
+    map->keyframe = true;
+}
+
+void heatmap_update(heatmap_t* map, const sat_t* sat) {
+    const int width = sat->width, height = sat->height;
+    for (int r = 0; r < map->rows; r++) {
+        int y0 = r * height / map->rows, y1 = (r + 1) * height / map->rows;
+        for (int c = 0; c < map->cols; c++) {
+            int x0 = c * width / map->cols, x1 = (c + 1) * width / map->cols;
+            size_t pixels = (size_t)(x1 - x0) * (y1 - y0);
+            if (!pixels) continue;
+            uint32_t sum = sat_rect(sat, x0, y0, x1 - x0, y1 - y0);
+            uint32_t mean = (sum + pixels / 2) / pixels;
+            uint8_t* peak = &map->peak[r * map->cols + c];
+            if (*peak < mean) *peak = mean;
+        }
+    }
+}
+
+static bool heatmap_changed(uint8_t v, uint8_t sent) {
+    if (!v != !sent) return true;
+    return (v > sent ? v - sent : sent - v) >= HEATMAP_DEADBAND;
+}
+
+size_t heatmap_encode(heatmap_t* map, uint8_t* out, size_t size) {
+    size_t cells = (size_t)map->cols * map->rows;
+    if (size < HEATMAP_HEADER_SIZE + cells) return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < cells; i++) count += heatmap_changed(map->peak[i], map->sent[i]);
+    if (!count && !map->keyframe) return 0;
+
+    out[0] = HEATMAP_MAGIC;
+    out[2] = map->cols;
+    out[3] = map->rows;
+    size_t len = HEATMAP_HEADER_SIZE;
+    if (map->keyframe || 1 + 2 * count >= cells) {
+        out[1] = HEATMAP_KEYFRAME;
+        memcpy(out + len, map->peak, cells);
+        memcpy(map->sent, map->peak, cells);
+        len += cells;
+        map->keyframe = false;
+    } else {
+        // count < cells / 2 here, so it and the indexes fit a byte
+        out[1] = 0;
+        out[len++] = count;
+        for (size_t i = 0; i < cells; i++) if (heatmap_changed(map->peak[i], map->sent[i])) {
+            out[len++] = i;
+            out[len++] = map->peak[i];
+            map->sent[i] = map->peak[i];
+        }
+    }
+    memset(map->peak, 0, cells);
+    return len;
+}
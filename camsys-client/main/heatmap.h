@@ -0,0 +1,62 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+// ---------------------------------------------------------------
+// HEAT MAP
+// ---------------------------------------------------------------
+//
+// Coarse activity grid of the motion image: a cell is the mean absolute difference
+// of its pixels to the previous image (0..255, the unit of the zone sensitivity),
+// read from the summed-area table of the differences (see sat.h).
+// Between two messages every cell keeps its peak, so short motion is not lost at a
+// slow send rate.
+//
+// The grid goes out as a binary message with only the cells that changed by at least
+// HEATMAP_DEADBAND since the last one (or went to / came from 0):
+//
+//   'H', flags, cols, rows, then
+//     keyframe (flags & HEATMAP_KEYFRAME): cols * rows cells, row by row
+//     delta: count, then count (index, value) pairs
+//
+// A delta that would not be smaller than the keyframe is sent as a keyframe, and
+// nothing is sent while no cell changes.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sat.h"
+
+#define HEATMAP_MAGIC 'H'
+#define HEATMAP_KEYFRAME 0x01
+#define HEATMAP_CELLS_MIN 4
+#define HEATMAP_CELLS_MAX 16
+#define HEATMAP_DEADBAND 2
+#define HEATMAP_HEADER_SIZE 4
+#define HEATMAP_MSG_SIZE (HEATMAP_HEADER_SIZE + HEATMAP_CELLS_MAX * HEATMAP_CELLS_MAX)
+
+struct heatmap_s {
+    uint8_t cols;
+    uint8_t rows;
+    bool keyframe;  // the next message is a keyframe
+    uint8_t peak[HEATMAP_CELLS_MAX * HEATMAP_CELLS_MAX];  // since the last message
+    uint8_t sent[HEATMAP_CELLS_MAX * HEATMAP_CELLS_MAX];  // as the receiver has it
+};
+
+typedef struct heatmap_s heatmap_t;
+
+// cols and rows are clamped to HEATMAP_CELLS_MIN..HEATMAP_CELLS_MAX
+void heatmap_init(heatmap_t* map, int cols, int rows);
+
+// the next message is a keyframe (new receiver, or a message was lost)
+void heatmap_keyframe(heatmap_t* map);
+
+// adds the differences in the table to the cell peaks
+void heatmap_update(heatmap_t* map, const sat_t* sat);
+
+// writes the message of the changes into out and starts new peaks, 0 when nothing
+// changed (size should be HEATMAP_MSG_SIZE)
+size_t heatmap_encode(heatmap_t* map, uint8_t* out, size_t size);
+
+#endif // HEATMAP_H
@@ -0,0 +1,319 @@
+#include <string.h>
+#include <stdbool.h>
+#include "jpeg_dc.h"
+
+#define JPEG_DC_LOOKAHEAD 9
+#define JPEG_DC_COMPONENTS_MAX 4
+#define JPEG_DC_TABLES 4
+#define JPEG_DC_PRED_MAX 32767  // a valid 8 bit frame stays within +-2047
+
+struct jpeg_dc_huff_s {
+    uint16_t look[1 << JPEG_DC_LOOKAHEAD]; // (length << 8) | symbol, 0: longer code
+    int32_t maxcode[17];
+    int32_t valoffset[17];
+    uint8_t vals[256];
+    bool defined;
+};
+
+typedef struct jpeg_dc_huff_s jpeg_dc_huff_t;
+
+struct jpeg_dc_component_s {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t tq;
+    uint8_t td;
+    uint8_t ta;
+    int pred;
+};
+
+typedef struct jpeg_dc_component_s jpeg_dc_component_t;
+
+// Entropy coded data, 0xFF00 is unstuffed. A marker or the end of the data stops
+// the reader, then zeros are shifted in. Taking any of them means the data was cut
+// short (jpeg_dc_overrun()).
+struct jpeg_dc_reader_s {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t acc;
+    int nbits;
+    int pad;     // zero bytes shifted in
+    bool marker;
+};
+
+typedef struct jpeg_dc_reader_s jpeg_dc_reader_t;
+
+struct jpeg_dc_s {
+    jpeg_dc_huff_t dc[JPEG_DC_TABLES];
+    jpeg_dc_huff_t ac[JPEG_DC_TABLES];
+    uint16_t q0[JPEG_DC_TABLES];  // DC quantizer of each table
+    jpeg_dc_component_t comps[JPEG_DC_COMPONENTS_MAX];
+    int ncomps;
+    int hmax;
+    int vmax;
+    int restart;
+    jpeg_dc_info_t info;
+};
+
+typedef struct jpeg_dc_s jpeg_dc_t;
+
+static inline uint16_t get_be16(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static int jpeg_dc_huff_build(jpeg_dc_huff_t* h, const uint8_t* bits, const uint8_t* vals, int count) {
+    h->defined = false;
+    memset(h->look, 0, sizeof(h->look));
+    memcpy(h->vals, vals, count);
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        h->valoffset[l] = k - code;
+        h->maxcode[l] = bits[l - 1] ? code + bits[l - 1] - 1 : -1;
+        for (int i = 0; i < bits[l - 1]; i++, k++, code++) {
+            // more codes than the length has
+            if (code >= (1 << l)) return JPEG_DC_ERR_DATA;
+            if (l > JPEG_DC_LOOKAHEAD) continue;
+            int shift = JPEG_DC_LOOKAHEAD - l;
+            for (int j = 0; j < (1 << shift); j++) h->look[(code << shift) | j] = (l << 8) | vals[k];
+        }
+        code <<= 1;
+    }
+    h->defined = true;
+    return JPEG_DC_OK;
+}
+
+static inline void jpeg_dc_fill(jpeg_dc_reader_t* r) {
+    while (r->nbits <= 24) {
+        uint32_t c = 0;
+        if (!r->marker && r->p < r->end) {
+            c = *r->p;
+            if (c != 0xFF) r->p++;
+            else if (r->p + 1 < r->end && !r->p[1]) r->p += 2;
+            else {
+                r->marker = true;
+                c = 0;
+                r->pad++;
+            }
+        } else r->pad++;
+        r->acc = (r->acc << 8) | c;
+        r->nbits += 8;
+    }
+}
+
+static inline int jpeg_dc_bits(jpeg_dc_reader_t* r, int n) {
+    if (!n) return 0;
+    jpeg_dc_fill(r);
+    r->nbits -= n;
+    return (r->acc >> r->nbits) & ((1UL << n) - 1);
+}
+
+// true once bits past the data were taken
+static inline bool jpeg_dc_overrun(const jpeg_dc_reader_t* r) {
+    return r->pad * 8 > r->nbits;
+}
+
+// the next Huffman symbol, -1 on a bad code
+static inline int jpeg_dc_decode(jpeg_dc_reader_t* r, const jpeg_dc_huff_t* h) {
+    jpeg_dc_fill(r);
+    uint16_t look = h->look[(r->acc >> (r->nbits - JPEG_DC_LOOKAHEAD)) & ((1 << JPEG_DC_LOOKAHEAD) - 1)];
+    if (look) {
+        r->nbits -= look >> 8;
+        return look & 0xFF;
+    }
+    for (int l = JPEG_DC_LOOKAHEAD + 1; l <= 16; l++) {
+        int32_t code = (r->acc >> (r->nbits - l)) & ((1UL << l) - 1);
+        if (code <= h->maxcode[l]) {
+            r->nbits -= l;
+            return h->vals[h->valoffset[l] + code];
+        }
+    }
+    return -1;
+}
+
+// decodes the DC difference of a block and skips its AC coefficients
+static int jpeg_dc_block(jpeg_dc_reader_t* r, const jpeg_dc_huff_t* dc, const jpeg_dc_huff_t* ac, int* pred) {
+    int s = jpeg_dc_decode(r, dc);
+    if (s < 0 || s > 11) return JPEG_DC_ERR_DATA;
+    if (s) {
+        int v = jpeg_dc_bits(r, s);
+        *pred += v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+        if (*pred < -JPEG_DC_PRED_MAX || *pred > JPEG_DC_PRED_MAX) return JPEG_DC_ERR_DATA;
+    }
+    for (int k = 1; k < 64; k++) {
+        int rs = jpeg_dc_decode(r, ac);
+        if (rs < 0) return JPEG_DC_ERR_DATA;
+        s = rs & 15;
+        if (s) {
+            k += rs >> 4;
+            jpeg_dc_fill(r);
+            r->nbits -= s;
+        } else if ((rs >> 4) == 15) k += 15;
+        else break;
+    }
+    return JPEG_DC_OK;
+}
+
+static int jpeg_dc_parse_dht(jpeg_dc_t* j, const uint8_t* p, size_t len) {
+    while (len >= 17) {
+        int tc = p[0] >> 4, th = p[0] & 15;
+        if (tc > 1 || th >= JPEG_DC_TABLES) return JPEG_DC_ERR_FORMAT;
+        int count = 0;
+        for (int i = 0; i < 16; i++) count += p[1 + i];
+        if (count > 256 || len < 17 + (size_t)count) return JPEG_DC_ERR_DATA;
+        int err = jpeg_dc_huff_build(tc ? &j->ac[th] : &j->dc[th], p + 1, p + 17, count);
+        if (err != JPEG_DC_OK) return err;
+        p += 17 + count;
+        len -= 17 + count;
+    }
+    return len ? JPEG_DC_ERR_DATA : JPEG_DC_OK;
+}
+
+static int jpeg_dc_parse_dqt(jpeg_dc_t* j, const uint8_t* p, size_t len) {
+    while (len) {
+        int pq = p[0] >> 4, tq = p[0] & 15;
+        size_t size = 1 + 64 * (pq ? 2 : 1);
+        if (pq > 1 || tq >= JPEG_DC_TABLES || len < size) return JPEG_DC_ERR_DATA;
+        j->q0[tq] = pq ? get_be16(p + 1) : p[1];
+        p += size;
+        len -= size;
+    }
+    return JPEG_DC_OK;
+}
+
+static int jpeg_dc_parse_sof(jpeg_dc_t* j, const uint8_t* p, size_t len) {
+    if (len < 6 || p[0] != 8) return JPEG_DC_ERR_FORMAT;
+    j->info.height = get_be16(p + 1);
+    j->info.width = get_be16(p + 3);
+    j->ncomps = p[5];
+    if (!j->info.width || !j->info.height || !j->ncomps || j->ncomps > JPEG_DC_COMPONENTS_MAX || len < 6 + 3 * (size_t)j->ncomps) return JPEG_DC_ERR_FORMAT;
+    j->hmax = j->vmax = 1;
+    for (int i = 0; i < j->ncomps; i++) {
+        jpeg_dc_component_t* c = &j->comps[i];
+        c->id = p[6 + 3 * i];
+        c->h = p[7 + 3 * i] >> 4;
+        c->v = p[7 + 3 * i] & 15;
+        c->tq = p[8 + 3 * i];
+        if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4 || c->tq >= JPEG_DC_TABLES) return JPEG_DC_ERR_FORMAT;
+        if (c->h > j->hmax) j->hmax = c->h;
+        if (c->v > j->vmax) j->vmax = c->v;
+    }
+    // the luma blocks have to be 8x8 pixels of the image
+    if (j->ncomps > 1 && (j->comps[0].h != j->hmax || j->comps[0].v != j->vmax)) return JPEG_DC_ERR_FORMAT;
+    j->info.thumb_width = (j->info.width + 7) / 8;
+    j->info.thumb_height = (j->info.height + 7) / 8;
+    return JPEG_DC_OK;
+}
+
+static int jpeg_dc_parse_sos(jpeg_dc_t* j, const uint8_t* p, size_t len) {
+    if (!j->ncomps || len < 1 || p[0] != j->ncomps || len < 4 + 2 * (size_t)j->ncomps) return JPEG_DC_ERR_FORMAT;
+    for (int i = 0; i < j->ncomps; i++) {
+        jpeg_dc_component_t* c = &j->comps[i];
+        if (p[1 + 2 * i] != c->id) return JPEG_DC_ERR_FORMAT;
+        c->td = p[2 + 2 * i] >> 4;
+        c->ta = p[2 + 2 * i] & 15;
+        if (c->td >= JPEG_DC_TABLES || c->ta >= JPEG_DC_TABLES || !j->dc[c->td].defined || !j->ac[c->ta].defined) return JPEG_DC_ERR_FORMAT;
+        c->pred = 0;
+    }
+    const uint8_t* s = p + 1 + 2 * j->ncomps;
+    if (s[0] != 0 || s[1] != 63 || s[2] != 0) return JPEG_DC_ERR_FORMAT;
+    return JPEG_DC_OK;
+}
+
+static int jpeg_dc_scan(jpeg_dc_t* j, const uint8_t* p, const uint8_t* end, uint8_t* out) {
+    jpeg_dc_reader_t r = { .p = p, .end = end, .acc = 0, .nbits = 0, .pad = 0, .marker = false };
+    const int tw = j->info.thumb_width, th = j->info.thumb_height;
+    // a single component scan is not interleaved, one block per MCU
+    const bool single = j->ncomps == 1;
+    const int mcu_w = single ? 8 : 8 * j->hmax, mcu_h = single ? 8 : 8 * j->vmax;
+    const int mcus_x = (j->info.width + mcu_w - 1) / mcu_w, mcus_y = (j->info.height + mcu_h - 1) / mcu_h;
+    const int q0 = j->q0[j->comps[0].tq];
+    int todo = j->restart;
+    for (int my = 0; my < mcus_y; my++) {
+        for (int mx = 0; mx < mcus_x; mx++) {
+            if (j->restart && !todo--) {
+                // to the next RSTn, the bits left are padding
+                while (r.p + 1 < r.end && !(r.p[0] == 0xFF && (r.p[1] & 0xF8) == 0xD0)) r.p++;
+                if (r.p + 1 >= r.end) return JPEG_DC_ERR_DATA;
+                r.p += 2;
+                r.acc = 0;
+                r.nbits = 0;
+                r.pad = 0;
+                r.marker = false;
+                for (int i = 0; i < j->ncomps; i++) j->comps[i].pred = 0;
+                todo = j->restart - 1;
+            }
+            for (int i = 0; i < j->ncomps; i++) {
+                jpeg_dc_component_t* c = &j->comps[i];
+                int bh = single ? 1 : c->h, bv = single ? 1 : c->v;
+                for (int v = 0; v < bv; v++) for (int h = 0; h < bh; h++) {
+                    int err = jpeg_dc_block(&r, &j->dc[c->td], &j->ac[c->ta], &c->pred);
+                    if (err != JPEG_DC_OK) return err;
+                    if (i) continue;
+                    int x = mx * bh + h, y = my * bv + v;
+                    if (x >= tw || y >= th) continue;
+                    int pixel = ((c->pred * q0 + 4) >> 3) + 128;
+                    out[y * tw + x] = pixel < 0 ? 0 : pixel > 255 ? 255 : pixel;
+                }
+            }
+            // a cut frame stops here instead of decoding zeros to its end
+            if (jpeg_dc_overrun(&r)) return JPEG_DC_ERR_DATA;
+        }
+    }
+    return JPEG_DC_OK;
+}
+
+int jpeg_dc_thumbnail(const uint8_t* jpg, size_t len, uint8_t* out, size_t size, jpeg_dc_info_t* info) {
+    static jpeg_dc_t j; // the Huffman tables are too large for a task stack
+    memset(&j, 0, sizeof(j));
+    const uint8_t* p = jpg;
+    const uint8_t* end = jpg + len;
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return JPEG_DC_ERR_FORMAT;
+    p += 2;
+    while (p + 4 <= end) {
+        if (p[0] != 0xFF) return JPEG_DC_ERR_DATA;
+        uint8_t m = p[1];
+        if (m == 0xFF) {
+            p++;
+            continue;
+        }
+        p += 2;
+        if (m == 0x01 || (m >= 0xD0 && m <= 0xD7)) continue;
+        if (m == 0xD9) break;
+        size_t seg = get_be16(p);
+        if (seg < 2 || seg > (size_t)(end - p)) return JPEG_DC_ERR_DATA;
+        const uint8_t* data = p + 2;
+        seg -= 2;
+        int err = JPEG_DC_OK;
+        switch (m) {
+            case 0xC0:
+            case 0xC1: err = jpeg_dc_parse_sof(&j, data, seg); break;
+            case 0xC4: err = jpeg_dc_parse_dht(&j, data, seg); break;
+            case 0xDB: err = jpeg_dc_parse_dqt(&j, data, seg); break;
+            case 0xDD: j.restart = seg >= 2 ? get_be16(data) : 0; break;
+            case 0xDA:
+                if (!j.info.width) return JPEG_DC_ERR_FORMAT;
+                if ((size_t)j.info.thumb_width * j.info.thumb_height > size) return JPEG_DC_ERR_SIZE;
+                err = jpeg_dc_parse_sos(&j, data, seg);
+                if (err == JPEG_DC_OK) err = jpeg_dc_scan(&j, data + seg, end, out);
+                if (err == JPEG_DC_OK && info) *info = j.info;
+                return err;
+            default:
+                // other SOFn: progressive, lossless, arithmetic coding
+                if (m >= 0xC2 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC) return JPEG_DC_ERR_FORMAT;
+        }
+        if (err != JPEG_DC_OK) return err;
+        p += 2 + seg;
+    }
+    return JPEG_DC_ERR_DATA;
+}
+
+const char* jpeg_dc_strerror(int err) {
+    switch (err) {
+        case JPEG_DC_OK: return "ok";
+        case JPEG_DC_ERR_FORMAT: return "unsupported jpeg";
+        case JPEG_DC_ERR_DATA: return "corrupt jpeg";
+        case JPEG_DC_ERR_SIZE: return "thumbnail too large";
+        default: return "unknown error";
+    }
+}
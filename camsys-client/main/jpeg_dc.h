@@ -0,0 +1,49 @@
+#ifndef JPEG_DC_H
+#define JPEG_DC_H
+
+// ---------------------------------------------------------------
+// JPEG DC THUMBNAIL
+// ---------------------------------------------------------------
+//
+// Decodes only the DC coefficient of the luma blocks of a baseline JPEG, which is
+// the average of the 8x8 block: one pixel per block, a 1/8 scale grayscale
+// thumbnail. The AC coefficients are entropy-decoded only as far as needed to skip
+// them, there is no dequantization, IDCT or color conversion, and the chroma
+// blocks are skipped the same way.
+//
+// The pixels are the same as a 1/8 scaled grayscale decode of libjpeg:
+//   pixel = clamp(((dc * q0 + 4) >> 3) + 128)
+//
+// Baseline (and extended Huffman 8 bit) frames with all components in one scan and
+// restart intervals are supported, progressive or arithmetic coded ones are not.
+// Unlike libjpeg a frame whose entropy data is cut short is an error, not padded
+// with zeros, so a partly received frame never looks like motion.
+//
+// The Huffman tables live in a static workspace, so only one thumbnail is decoded
+// at a time (the device has a single motion task).
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JPEG_DC_OK 0
+#define JPEG_DC_ERR_FORMAT -1   // not a supported JPEG
+#define JPEG_DC_ERR_DATA -2     // corrupt or truncated
+#define JPEG_DC_ERR_SIZE -3     // the thumbnail does not fit
+
+struct jpeg_dc_info_s {
+    uint16_t width;        // of the image
+    uint16_t height;
+    uint16_t thumb_width;  // (width + 7) / 8
+    uint16_t thumb_height;
+};
+
+typedef struct jpeg_dc_info_s jpeg_dc_info_t;
+
+// writes the thumbnail (thumb_width x thumb_height bytes) into out
+int jpeg_dc_thumbnail(const uint8_t* jpg, size_t len, uint8_t* out, size_t size, jpeg_dc_info_t* info);
+
+const char* jpeg_dc_strerror(int err);
+
+#endif // JPEG_DC_H
@@ -0,0 +1,443 @@
+#include <string.h>
+#include <unistd.h>
+#include "record.h"
+
+// ---------------------------------------------------------------
+// CRC-32 (IEEE 802.3, reflected)
+// ---------------------------------------------------------------
+
+static uint32_t record_crc32_table[256];
+static bool record_crc32_table_ready = false;
+
+static void record_crc32_table_init() {
+    for (uint32_t i=0; i<256; i++) {
+        uint32_t c = i;
+        for (int k=0; k<8; k++) c = (c & 1) ? (0xEDB88320UL ^ (c >> 1)) : (c >> 1);
+        record_crc32_table[i] = c;
+    }
+    record_crc32_table_ready = true;
+}
+
+uint32_t record_crc32(uint32_t crc, const uint8_t* buf, size_t len) {
+    if (!record_crc32_table_ready) record_crc32_table_init();
+    crc = ~crc;
+    while (len--) crc = record_crc32_table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// ---------------------------------------------------------------
+// LITTLE-ENDIAN HELPERS
+// ---------------------------------------------------------------
+
+static void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+    put_u32(p, v & 0xFFFFFFFFUL);
+    put_u32(p + 4, (v >> 32) & 0xFFFFFFFFUL);
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+// ---------------------------------------------------------------
+// HEADERS
+// ---------------------------------------------------------------
+
+void record_file_header_encode(const record_file_header_t* hdr, uint8_t* out) {
+    memcpy(out, RECORD_FILE_MAGIC, 4);
+    put_u16(out + 4, hdr->version);
+    put_u16(out + 6, hdr->hdr_size);
+    put_u32(out + 8, hdr->max_len);
+    put_u32(out + 12, hdr->data_len);
+}
+
+int record_file_header_decode(const uint8_t* in, record_file_header_t* hdr) {
+    if (memcmp(in, RECORD_FILE_MAGIC, 4)) return RECORD_ERR_MAGIC;
+    hdr->version = get_u16(in + 4);
+    hdr->hdr_size = get_u16(in + 6);
+    hdr->max_len = get_u32(in + 8);
+    hdr->data_len = get_u32(in + 12);
+    if (hdr->version != RECORD_FILE_VERSION || hdr->hdr_size < RECORD_FILE_HEADER_SIZE) return RECORD_ERR_VERSION;
+    return RECORD_OK;
+}
+
+void record_frame_header_encode(const record_frame_header_t* hdr, uint8_t* out) {
+    put_u32(out, RECORD_FRAME_SYNC);
+    put_u32(out + 4, hdr->len);
+    put_u64(out + 8, hdr->timestamp);
+    put_u16(out + 16, hdr->width);
+    put_u16(out + 18, hdr->height);
+    out[20] = hdr->format;
+    out[21] = hdr->flags;
+    put_u16(out + 22, 0);
+    put_u32(out + 24, hdr->crc);
+}
+
+int record_frame_header_decode(const uint8_t* in, record_frame_header_t* hdr) {
+    if (get_u32(in) != RECORD_FRAME_SYNC) return RECORD_ERR_SYNC;
+    hdr->len = get_u32(in + 4);
+    hdr->timestamp = get_u64(in + 8);
+    hdr->width = get_u16(in + 16);
+    hdr->height = get_u16(in + 18);
+    hdr->format = in[20];
+    hdr->flags = in[21];
+    hdr->crc = get_u32(in + 24);
+    if (!hdr->len || hdr->len > RECORD_FRAME_LEN_MAX) return RECORD_ERR_LEN;
+    return RECORD_OK;
+}
+
+// ---------------------------------------------------------------
+// FILE I/O
+// ---------------------------------------------------------------
+
+// hdr_size >= RECORD_FILE_HEADER_SIZE, the rest of the header is zero padding
+int record_write_file_header(FILE* f, uint16_t hdr_size) {
+    if (hdr_size < RECORD_FILE_HEADER_SIZE) return RECORD_ERR_LEN;
+    uint8_t raw[RECORD_FILE_HEADER_SIZE];
+    record_file_header_t hdr = { RECORD_FILE_VERSION, hdr_size, 0, 0 };
+    record_file_header_encode(&hdr, raw);
+    if (1 != fwrite(raw, RECORD_FILE_HEADER_SIZE, 1, f)) return RECORD_ERR_IO;
+    static const uint8_t zeros[512] = {0};
+    for (size_t left = hdr_size - RECORD_FILE_HEADER_SIZE; left; ) {
+        size_t n = left < sizeof(zeros) ? left : sizeof(zeros);
+        if (n != fwrite(zeros, sizeof(uint8_t), n, f)) return RECORD_ERR_IO;
+        left -= n;
+    }
+    return RECORD_OK;
+}
+
+int record_read_file_header(FILE* f, record_file_header_t* hdr) {
+    uint8_t raw[RECORD_FILE_HEADER_SIZE];
+    if (1 != fread(raw, RECORD_FILE_HEADER_SIZE, 1, f)) return feof(f) ? RECORD_ERR_EOF : RECORD_ERR_IO;
+    int err = record_file_header_decode(raw, hdr);
+    if (err != RECORD_OK) return err;
+    // skip header extension written by a newer minor layout
+    if (hdr->hdr_size > RECORD_FILE_HEADER_SIZE && fseek(f, hdr->hdr_size, SEEK_SET)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+// f must be opened for update ("r+b"), the position is restored on success.
+int record_update_file_header(FILE* f, uint32_t max_len, uint32_t data_len) {
+    uint8_t raw[8];
+    long pos = ftell(f);
+    if (pos < 0) return RECORD_ERR_IO;
+    put_u32(raw, max_len);
+    put_u32(raw + 4, data_len);
+    if (fseek(f, 8, SEEK_SET)) return RECORD_ERR_IO;
+    if (1 != fwrite(raw, sizeof(raw), 1, f)) return RECORD_ERR_IO;
+    if (fseek(f, pos, SEEK_SET)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+// Computes hdr->crc from buf and writes the frame record.
+int record_write_frame(FILE* f, record_frame_header_t* hdr, const uint8_t* buf) {
+    uint8_t raw[RECORD_FRAME_HEADER_SIZE];
+    hdr->crc = record_crc32(0, buf, hdr->len);
+    record_frame_header_encode(hdr, raw);
+    if (1 != fwrite(raw, RECORD_FRAME_HEADER_SIZE, 1, f)) return RECORD_ERR_IO;
+    if (hdr->len != fwrite(buf, sizeof(uint8_t), hdr->len, f)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+int record_read_frame_header(FILE* f, record_frame_header_t* hdr) {
+    uint8_t raw[RECORD_FRAME_HEADER_SIZE];
+    if (1 != fread(raw, RECORD_FRAME_HEADER_SIZE, 1, f)) return feof(f) ? RECORD_ERR_EOF : RECORD_ERR_IO;
+    return record_frame_header_decode(raw, hdr);
+}
+
+int record_read_frame_payload(FILE* f, const record_frame_header_t* hdr, uint8_t* buf, size_t size) {
+    if (hdr->len > size) return RECORD_ERR_LEN;
+    if (hdr->len != fread(buf, sizeof(uint8_t), hdr->len, f)) return feof(f) ? RECORD_ERR_EOF : RECORD_ERR_IO;
+    if (record_crc32(0, buf, hdr->len) != hdr->crc) return RECORD_ERR_CRC;
+    return RECORD_OK;
+}
+
+int record_skip_frame_payload(FILE* f, const record_frame_header_t* hdr) {
+    if (fseek(f, hdr->len, SEEK_CUR)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+// ---------------------------------------------------------------
+// SEEK INDEX
+// ---------------------------------------------------------------
+
+int record_write_index_header(FILE* f) {
+    uint8_t raw[RECORD_INDEX_HEADER_SIZE];
+    memcpy(raw, RECORD_INDEX_MAGIC, 4);
+    put_u16(raw + 4, RECORD_INDEX_VERSION);
+    put_u16(raw + 6, RECORD_INDEX_ENTRY_SIZE);
+    if (1 != fwrite(raw, RECORD_INDEX_HEADER_SIZE, 1, f)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+// Checks the header and gives the number of complete entries,
+// a torn entry at the end (power loss while appending) is not counted.
+int record_read_index_header(FILE* f, long* count) {
+    uint8_t raw[RECORD_INDEX_HEADER_SIZE];
+    if (fseek(f, 0L, SEEK_SET)) return RECORD_ERR_IO;
+    if (1 != fread(raw, RECORD_INDEX_HEADER_SIZE, 1, f)) return feof(f) ? RECORD_ERR_EOF : RECORD_ERR_IO;
+    if (memcmp(raw, RECORD_INDEX_MAGIC, 4)) return RECORD_ERR_MAGIC;
+    if (get_u16(raw + 4) != RECORD_INDEX_VERSION || get_u16(raw + 6) != RECORD_INDEX_ENTRY_SIZE) return RECORD_ERR_VERSION;
+    if (fseek(f, 0L, SEEK_END)) return RECORD_ERR_IO;
+    long size = ftell(f);
+    if (size < 0) return RECORD_ERR_IO;
+    *count = (size - RECORD_INDEX_HEADER_SIZE) / RECORD_INDEX_ENTRY_SIZE;
+    return RECORD_OK;
+}
+
+int record_write_index_entries(FILE* f, const record_index_entry_t* entries, size_t cnt) {
+    uint8_t raw[RECORD_INDEX_ENTRY_SIZE];
+    for (size_t i=0; i<cnt; i++) {
+        put_u64(raw, entries[i].timestamp);
+        put_u32(raw + 8, entries[i].offset);
+        put_u32(raw + 12, entries[i].frame);
+        if (1 != fwrite(raw, RECORD_INDEX_ENTRY_SIZE, 1, f)) return RECORD_ERR_IO;
+    }
+    return RECORD_OK;
+}
+
+// Reads cnt entries starting with the n-th one in a single pass.
+int record_read_index_entries(FILE* f, long n, record_index_entry_t* entries, size_t cnt) {
+    uint8_t raw[RECORD_INDEX_ENTRY_SIZE];
+    if (fseek(f, RECORD_INDEX_HEADER_SIZE + n * RECORD_INDEX_ENTRY_SIZE, SEEK_SET)) return RECORD_ERR_IO;
+    for (size_t i=0; i<cnt; i++) {
+        if (1 != fread(raw, RECORD_INDEX_ENTRY_SIZE, 1, f)) return feof(f) ? RECORD_ERR_EOF : RECORD_ERR_IO;
+        entries[i].timestamp = get_u64(raw);
+        entries[i].offset = get_u32(raw + 8);
+        entries[i].frame = get_u32(raw + 12);
+    }
+    return RECORD_OK;
+}
+
+int record_read_index_entry(FILE* f, long n, record_index_entry_t* entry) {
+    return record_read_index_entries(f, n, entry, 1);
+}
+
+#define RECORD_INDEX_SEARCH_CHUNK 64
+
+// Last entry at or before timestamp. The timestamps only rise within a run (a clock
+// step back starts a new one), so like the index cache of the device the latest
+// such time of all runs is taken, the later entry on a tie. An .idx has no run
+// table, its entries are read once, in chunks.
+// Returns its number, RECORD_ERR_EOF when timestamp is before every entry.
+long record_index_search(FILE* f, long count, uint64_t timestamp, record_index_entry_t* entry) {
+    record_index_entry_t chunk[RECORD_INDEX_SEARCH_CHUNK];
+    long best = -1;
+    for (long n=0; n<count; n+=RECORD_INDEX_SEARCH_CHUNK) {
+        long cnt = count - n < RECORD_INDEX_SEARCH_CHUNK ? count - n : RECORD_INDEX_SEARCH_CHUNK;
+        int err = record_read_index_entries(f, n, chunk, cnt);
+        if (err != RECORD_OK) return err;
+        for (long i=0; i<cnt; i++) {
+            if (chunk[i].timestamp > timestamp || (best >= 0 && chunk[i].timestamp < entry->timestamp)) continue;
+            best = n + i;
+            *entry = chunk[i];
+        }
+    }
+    return best >= 0 ? best : RECORD_ERR_EOF;
+}
+
+// ---------------------------------------------------------------
+// RECOVERY
+// ---------------------------------------------------------------
+
+static int record_scan_check(const record_frame_header_t* hdr, bool check_crc, uint32_t crc,
+    const uint8_t* head, const uint8_t* tail) {
+    if (check_crc && crc != hdr->crc) return RECORD_ERR_CRC;
+    if (hdr->format != RECORD_PIXFORMAT_JPEG) return RECORD_OK;
+    if (hdr->len < 4 || head[0] != 0xFF || head[1] != 0xD8) return RECORD_ERR_JPEG;
+    for (int i=RECORD_JPEG_EOI_SLACK-2; i>=0; i--) {
+        if (tail[i] == 0xFF && tail[i+1] == 0xD9) return RECORD_OK;
+    }
+    return RECORD_ERR_JPEG;
+}
+
+// Walks the frame records from offset up to end (-1 = end of file) in reads of
+// size bytes, without seeking and without holding a frame in memory. A frame is
+// valid with a good header, CRC (when check_crc) and JPEG SOI/EOI markers.
+// Returns RECORD_ERR_IO on a read error, scan->err tells where the frames stop.
+int record_scan(FILE* f, long offset, long end, uint8_t* buf, size_t size, bool check_crc,
+    record_scan_cb_t cb, void* arg, record_scan_t* scan) {
+    uint8_t raw[RECORD_FRAME_HEADER_SIZE];
+    uint8_t head[2] = {0};
+    uint8_t tail[RECORD_JPEG_EOI_SLACK] = {0};
+    size_t raw_len = 0;
+    record_frame_header_t hdr;
+    uint32_t left = 0; // payload bytes still to come, 0 while reading a header
+    uint32_t crc = 0;
+    long pos = offset; // file offset of buf[0]
+
+    scan->offset = offset;
+    scan->frames = 0;
+    scan->max_len = 0;
+    scan->err = RECORD_OK;
+    if (fseek(f, offset, SEEK_SET)) return scan->err = RECORD_ERR_IO;
+
+    while (scan->err == RECORD_OK) {
+        size_t want = size;
+        if (end >= 0 && (long)want > end - pos) want = end - pos;
+        size_t n = want ? fread(buf, sizeof(uint8_t), want, f) : 0;
+        if (!n) {
+            scan->err = want && ferror(f) ? RECORD_ERR_IO : RECORD_ERR_EOF;
+            break;
+        }
+        for (size_t i=0; i<n && scan->err == RECORD_OK; ) {
+            if (!left) {
+                size_t k = RECORD_FRAME_HEADER_SIZE - raw_len;
+                if (k > n - i) k = n - i;
+                memcpy(raw + raw_len, buf + i, k);
+                raw_len += k;
+                i += k;
+                if (raw_len < RECORD_FRAME_HEADER_SIZE) continue;
+                raw_len = 0;
+                scan->err = record_frame_header_decode(raw, &hdr);
+                left = hdr.len;
+                crc = 0;
+                memset(tail, 0, sizeof(tail));
+                continue;
+            }
+
+            size_t k = left < n - i ? left : n - i;
+            const uint8_t* p = buf + i;
+            uint32_t done = hdr.len - left;
+            if (done == 0) head[0] = p[0];
+            if (done <= 1 && done + k > 1) head[1] = p[1 - done];
+            if (k >= RECORD_JPEG_EOI_SLACK) memcpy(tail, p + k - RECORD_JPEG_EOI_SLACK, RECORD_JPEG_EOI_SLACK);
+            else {
+                memmove(tail, tail + k, RECORD_JPEG_EOI_SLACK - k);
+                memcpy(tail + RECORD_JPEG_EOI_SLACK - k, p, k);
+            }
+            if (check_crc) crc = record_crc32(crc, p, k);
+            left -= k;
+            i += k;
+            if (left) continue;
+
+            scan->err = record_scan_check(&hdr, check_crc, crc, head, tail);
+            if (scan->err == RECORD_OK && cb) scan->err = cb(arg, scan->offset, &hdr);
+            if (scan->err != RECORD_OK) break;
+            scan->frames++;
+            if (scan->max_len < hdr.len) scan->max_len = hdr.len;
+            scan->offset = pos + i;
+        }
+        pos += n;
+    }
+    return scan->err == RECORD_ERR_IO ? RECORD_ERR_IO : RECORD_OK;
+}
+
+struct record_recover_index_s {
+    FILE* idx;
+    uint32_t interval_ms;
+    uint32_t frame;
+    uint64_t last_ts;
+    bool first;
+    uint32_t entries;
+};
+
+// a frame stamped before the last entry (the clock was set back) starts a new run
+// and the interval over
+static int record_recover_index_cb(void* arg, long offset, const record_frame_header_t* hdr) {
+    struct record_recover_index_s* ri = arg;
+    int64_t delta = (int64_t)(hdr->timestamp - ri->last_ts);
+    if (ri->first || delta < 0 || delta >= ri->interval_ms) {
+        record_index_entry_t entry = { hdr->timestamp, (uint32_t)offset, ri->frame };
+        int err = record_write_index_entries(ri->idx, &entry, 1);
+        if (err != RECORD_OK) return err;
+        ri->first = false;
+        ri->last_ts = hdr->timestamp;
+        ri->entries++;
+    }
+    ri->frame++;
+    return RECORD_OK;
+}
+
+// Repairs a segment left open by a reset: the frames after the last index entry
+// before the sync point are scanned, the index is rebuilt from there, the torn
+// tail is cut off and the header gets the final data_len. vid and idx must be
+// opened for update ("r+b", idx may be empty), a closed segment is left as is.
+int record_recover(FILE* vid, FILE* idx, uint32_t index_interval_ms, uint8_t* buf, size_t size, record_recover_t* rec) {
+    record_file_header_t fhdr;
+    rec->repaired = false;
+    rec->frames = 0;
+    rec->index_entries = 0;
+    if (fseek(vid, 0L, SEEK_SET)) return RECORD_ERR_IO;
+    int err = record_read_file_header(vid, &fhdr);
+    if (err != RECORD_OK) return err;
+    if (fseek(vid, 0L, SEEK_END)) return RECORD_ERR_IO;
+    long size_vid = ftell(vid);
+    if (size_vid < 0) return RECORD_ERR_IO;
+    rec->committed = fhdr.hdr_size + fhdr.data_len;
+    rec->end = rec->committed;
+
+    bool closed = fhdr.data_len && size_vid <= rec->committed;
+    long count = 0;
+    bool idx_ok = RECORD_OK == record_read_index_header(idx, &count);
+    if (closed && idx_ok) return RECORD_OK;
+    rec->repaired = true;
+
+    // keep the index entries up to the sync point, rescan from the last one kept
+    struct record_recover_index_s ri = { idx, index_interval_ms, 0, 0, true, 0 };
+    long start = fhdr.hdr_size;
+    record_index_entry_t entry;
+    while (idx_ok && count > 0) {
+        err = record_read_index_entry(idx, count - 1, &entry);
+        if (err != RECORD_OK) return err;
+        count--;
+        if (entry.offset < rec->committed && entry.offset >= fhdr.hdr_size) {
+            start = entry.offset;
+            ri.frame = entry.frame;
+            break;
+        }
+    }
+    if (!idx_ok) {
+        count = 0;
+        if (fseek(idx, 0L, SEEK_SET)) return RECORD_ERR_IO;
+        err = record_write_index_header(idx);
+        if (err != RECORD_OK) return err;
+    }
+    if (fseek(idx, RECORD_INDEX_HEADER_SIZE + count * RECORD_INDEX_ENTRY_SIZE, SEEK_SET)) return RECORD_ERR_IO;
+
+    record_scan_t scan;
+    err = record_scan(vid, start, closed ? rec->committed : -1, buf, size, true, record_recover_index_cb, &ri, &scan);
+    if (err != RECORD_OK) return err;
+    rec->frames = scan.frames;
+    rec->index_entries = ri.entries;
+    rec->end = scan.offset;
+
+    if (fflush(idx) || ftruncate(fileno(idx), RECORD_INDEX_HEADER_SIZE + (count + ri.entries) * RECORD_INDEX_ENTRY_SIZE)) return RECORD_ERR_IO;
+    uint32_t max_len = fhdr.max_len > scan.max_len ? fhdr.max_len : scan.max_len;
+    err = record_update_file_header(vid, max_len, rec->end - fhdr.hdr_size);
+    if (err != RECORD_OK) return err;
+    if (fflush(vid) || ftruncate(fileno(vid), rec->end)) return RECORD_ERR_IO;
+    return RECORD_OK;
+}
+
+const char* record_strerror(int err) {
+    switch (err) {
+        case RECORD_OK: return "ok";
+        case RECORD_ERR_IO: return "i/o error";
+        case RECORD_ERR_EOF: return "end of file";
+        case RECORD_ERR_MAGIC: return "not a record file";
+        case RECORD_ERR_VERSION: return "unsupported record version";
+        case RECORD_ERR_SYNC: return "frame sync lost";
+        case RECORD_ERR_LEN: return "bad frame length";
+        case RECORD_ERR_CRC: return "frame crc mismatch";
+        case RECORD_ERR_JPEG: return "bad jpeg markers";
+        default: return "unknown error";
+    }
+}
@@ -0,0 +1,165 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+// ---------------------------------------------------------------
+// RECORD CONTAINER
+// ---------------------------------------------------------------
+//
+// On-disk layout of record.vid (all integers little-endian):
+//
+//   file header  (RECORD_FILE_HEADER_SIZE bytes)
+//     0  magic     "CSRV"
+//     4  version   u16
+//     6  hdr_size  u16   size of this header
+//     8  max_len   u32   largest frame payload in the file (0 = unknown)
+//    12  data_len  u32   bytes of frame records after the header (0 = up to end of file)
+//
+//   frame record (RECORD_FRAME_HEADER_SIZE bytes + len bytes payload)
+//     0  sync      u32   RECORD_FRAME_SYNC
+//     4  len       u32   payload length
+//     8  timestamp u64   capture time, ms since unix epoch
+//    16  width     u16
+//    18  height    u16
+//    20  format    u8    pixformat_t of the payload
+//    21  flags     u8    RECORD_FRAME_FLAG_*
+//    22  reserved  u16
+//    24  crc       u32   CRC-32 (IEEE) of the payload
+//
+// hdr_size may be larger than RECORD_FILE_HEADER_SIZE, readers skip the padding.
+// data_len lets a preallocated file carry unwritten space after the last frame.
+//
+// On-disk layout of the seek index (.idx) next to each .vid:
+//
+//   index header (RECORD_INDEX_HEADER_SIZE bytes)
+//     0  magic      "CSRI"
+//     4  version    u16
+//     6  entry_size u16
+//
+//   entry (entry_size bytes, in file order, the timestamp only goes back after a clock step)
+//     0  timestamp  u64   capture time of the frame, ms since unix epoch
+//     8  offset     u32   file offset of the frame record in the .vid
+//    12  frame      u32   frame number in the .vid, counted from 0
+//
+// A segment is closed properly when the file ends at hdr_size + data_len. While
+// recording, data_len is advanced at sync points (to the start of an indexed frame)
+// and the file is preallocated, record_recover() repairs a segment left open.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RECORD_FILE_MAGIC "CSRV"
+#define RECORD_FILE_VERSION 1
+#define RECORD_FILE_HEADER_SIZE 16
+
+#define RECORD_FRAME_SYNC 0x4D524643UL // "CFRM"
+#define RECORD_FRAME_HEADER_SIZE 28
+#define RECORD_FRAME_LEN_MAX (4UL * 1024 * 1024)
+
+#define RECORD_FRAME_FLAG_KEY 0x01
+
+// pixformat_t value of JPEG frames in the esp32-camera driver
+#define RECORD_PIXFORMAT_JPEG 4
+// the JPEG end marker may be followed by this much padding
+#define RECORD_JPEG_EOI_SLACK 8
+
+#define RECORD_INDEX_MAGIC "CSRI"
+#define RECORD_INDEX_VERSION 1
+#define RECORD_INDEX_HEADER_SIZE 8
+#define RECORD_INDEX_ENTRY_SIZE 16
+
+#define RECORD_OK 0
+#define RECORD_ERR_IO -1
+#define RECORD_ERR_EOF -2
+#define RECORD_ERR_MAGIC -3
+#define RECORD_ERR_VERSION -4
+#define RECORD_ERR_SYNC -5
+#define RECORD_ERR_LEN -6
+#define RECORD_ERR_CRC -7
+#define RECORD_ERR_JPEG -8
+
+struct record_file_header_s {
+    uint16_t version;
+    uint16_t hdr_size;
+    uint32_t max_len;
+    uint32_t data_len;
+};
+
+typedef struct record_file_header_s record_file_header_t;
+
+struct record_frame_header_s {
+    uint32_t len;
+    uint64_t timestamp;
+    uint16_t width;
+    uint16_t height;
+    uint8_t format;
+    uint8_t flags;
+    uint32_t crc;
+};
+
+typedef struct record_frame_header_s record_frame_header_t;
+
+struct record_index_entry_s {
+    uint64_t timestamp;
+    uint32_t offset;
+    uint32_t frame;
+};
+
+typedef struct record_index_entry_s record_index_entry_t;
+
+uint32_t record_crc32(uint32_t crc, const uint8_t* buf, size_t len);
+
+void record_file_header_encode(const record_file_header_t* hdr, uint8_t* out);
+int record_file_header_decode(const uint8_t* in, record_file_header_t* hdr);
+void record_frame_header_encode(const record_frame_header_t* hdr, uint8_t* out);
+int record_frame_header_decode(const uint8_t* in, record_frame_header_t* hdr);
+
+int record_write_file_header(FILE* f, uint16_t hdr_size);
+int record_read_file_header(FILE* f, record_file_header_t* hdr);
+int record_update_file_header(FILE* f, uint32_t max_len, uint32_t data_len);
+
+int record_write_frame(FILE* f, record_frame_header_t* hdr, const uint8_t* buf);
+int record_read_frame_header(FILE* f, record_frame_header_t* hdr);
+int record_read_frame_payload(FILE* f, const record_frame_header_t* hdr, uint8_t* buf, size_t size);
+int record_skip_frame_payload(FILE* f, const record_frame_header_t* hdr);
+
+int record_write_index_header(FILE* f);
+int record_read_index_header(FILE* f, long* count);
+int record_write_index_entries(FILE* f, const record_index_entry_t* entries, size_t cnt);
+int record_read_index_entries(FILE* f, long n, record_index_entry_t* entries, size_t cnt);
+int record_read_index_entry(FILE* f, long n, record_index_entry_t* entry);
+long record_index_search(FILE* f, long count, uint64_t timestamp, record_index_entry_t* entry);
+
+// called for every valid frame, a non RECORD_OK return stops the scan with that error
+typedef int (*record_scan_cb_t)(void* arg, long offset, const record_frame_header_t* hdr);
+
+struct record_scan_s {
+    long offset;      // end of the last valid frame
+    uint32_t frames;
+    uint32_t max_len;
+    int err;          // why the scan stopped, RECORD_ERR_EOF at the end of the file
+};
+
+typedef struct record_scan_s record_scan_t;
+
+int record_scan(FILE* f, long offset, long end, uint8_t* buf, size_t size, bool check_crc,
+    record_scan_cb_t cb, void* arg, record_scan_t* scan);
+
+struct record_recover_s {
+    bool repaired;            // the segment was left open (or its index was broken)
+    long committed;           // end of the frame data at the last sync point
+    long end;                 // end of the frame data after the repair
+    uint32_t frames;          // frames scanned
+    uint32_t index_entries;   // index entries rewritten
+};
+
+typedef struct record_recover_s record_recover_t;
+
+int record_recover(FILE* vid, FILE* idx, uint32_t index_interval_ms, uint8_t* buf, size_t size, record_recover_t* rec);
+
+const char* record_strerror(int err);
+
+#endif // RECORD_H
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "sad.h"
+
+#define SAD_LANES 0x00FF00FFUL
+#define SAD_LANE_ONES 0x00010001UL
+// every word adds at most 2 * 255 to a 16 bit lane
+#define SAD_SWAR_FLUSH_WORDS 128
+
+size_t sad_window_clip(sad_window_t* win, int img_width, int img_height) {
+    if (win->step < 1) win->step = 1;
+    // the samples stay on the grid of the original corner
+    if (win->x < 0) {
+        int skip = (-win->x + win->step - 1) / win->step * win->step;
+        win->x += skip;
+        win->width -= skip;
+    }
+    if (win->y < 0) {
+        int skip = (-win->y + win->step - 1) / win->step * win->step;
+        win->y += skip;
+        win->height -= skip;
+    }
+    if (win->x + win->width > img_width) win->width = img_width - win->x;
+    if (win->y + win->height > img_height) win->height = img_height - win->y;
+    if (win->width <= 0 || win->height <= 0) {
+        win->width = win->height = 0;
+        return 0;
+    }
+    return (size_t)((win->width + win->step - 1) / win->step) * ((win->height + win->step - 1) / win->step);
+}
+
+size_t sad_gather(const uint8_t* img, int img_width, int img_height, const sad_window_t* win, uint8_t* out) {
+    sad_window_t w = *win;
+    size_t n = sad_window_clip(&w, img_width, img_height);
+    if (!n) return 0;
+    int cols = (w.width + w.step - 1) / w.step;
+    const uint8_t* row = img + (size_t)w.y * img_width + w.x;
+    uint8_t* dst = out;
+    for (int y = 0; y < w.height; y += w.step) {
+        if (w.step == 1) memcpy(dst, row, cols);
+        else for (int i = 0; i < cols; i++) dst[i] = row[i * w.step];
+        dst += cols;
+        row += (size_t)w.step * img_width;
+    }
+    return n;
+}
+
+uint32_t sad_u8_ref(const uint8_t* a, const uint8_t* b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int d = a[i] - b[i];
+        sum += d < 0 ? -d : d;
+    }
+    return sum;
+}
+
+// |a - b| of the bytes in the low half of each 16 bit lane: the lane holds
+// 256 + a - b, its bit 8 is set when a >= b, otherwise the low byte is negated
+static inline uint32_t sad_lanes(uint32_t a, uint32_t b) {
+    uint32_t d = (a | (SAD_LANE_ONES << 8)) - b;
+    uint32_t lt = ((d >> 8) & SAD_LANE_ONES) ^ SAD_LANE_ONES;
+    return ((d & SAD_LANES) ^ (lt * 0xFF)) + lt;
+}
+
+uint32_t sad_u8_swar(const uint8_t* a, const uint8_t* b, size_t n) {
+    const uint8_t* pa = __builtin_assume_aligned(a, 4);
+    const uint8_t* pb = __builtin_assume_aligned(b, 4);
+    size_t words = n / 4;
+    uint32_t sum = 0;
+    while (words) {
+        size_t cnt = words < SAD_SWAR_FLUSH_WORDS ? words : SAD_SWAR_FLUSH_WORDS;
+        uint32_t acc = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            uint32_t wa, wb;
+            memcpy(&wa, pa, 4);
+            memcpy(&wb, pb, 4);
+            acc += sad_lanes(wa & SAD_LANES, wb & SAD_LANES);
+            acc += sad_lanes((wa >> 8) & SAD_LANES, (wb >> 8) & SAD_LANES);
+            pa += 4;
+            pb += 4;
+        }
+        sum += (acc & 0xFFFF) + (acc >> 16);
+        words -= cnt;
+    }
+    return sum + sad_u8_ref(pa, pb, n & 3);
+}
+
+uint32_t sad_u8(const uint8_t* a, const uint8_t* b, size_t n) {
+    size_t misalign = (uintptr_t)a & 3;
+    if (misalign != ((uintptr_t)b & 3)) return sad_u8_ref(a, b, n);
+    size_t head = misalign ? 4 - misalign : 0;
+    if (head >= n) return sad_u8_ref(a, b, n);
+    return sad_u8_ref(a, b, head) + sad_u8_swar(a + head, b + head, n - head);
+}
+
+uint32_t sad_u8_floor_ref(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int d = a[i] - b[i];
+        d = (d < 0 ? -d : d) - floor;
+        sum += d > 0 ? d : 0;
+    }
+    return sum;
+}
+
+// the lane holds 256 + |a - b| - floor, its bit 8 is set when the result is kept
+static inline uint32_t sad_lanes_floor(uint32_t a, uint32_t b, uint32_t floor_lanes) {
+    uint32_t t = sad_lanes(a, b) + (SAD_LANE_ONES << 8) - floor_lanes;
+    uint32_t keep = (t >> 8) & SAD_LANE_ONES;
+    return t & SAD_LANES & (keep * 0xFF);
+}
+
+uint32_t sad_u8_floor_swar(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor) {
+    const uint8_t* pa = __builtin_assume_aligned(a, 4);
+    const uint8_t* pb = __builtin_assume_aligned(b, 4);
+    uint32_t floor_lanes = floor * SAD_LANE_ONES;
+    size_t words = n / 4;
+    uint32_t sum = 0;
+    while (words) {
+        size_t cnt = words < SAD_SWAR_FLUSH_WORDS ? words : SAD_SWAR_FLUSH_WORDS;
+        uint32_t acc = 0;
+        for (size_t i = 0; i < cnt; i++) {
+            uint32_t wa, wb;
+            memcpy(&wa, pa, 4);
+            memcpy(&wb, pb, 4);
+            acc += sad_lanes_floor(wa & SAD_LANES, wb & SAD_LANES, floor_lanes);
+            acc += sad_lanes_floor((wa >> 8) & SAD_LANES, (wb >> 8) & SAD_LANES, floor_lanes);
+            pa += 4;
+            pb += 4;
+        }
+        sum += (acc & 0xFFFF) + (acc >> 16);
+        words -= cnt;
+    }
+    return sum + sad_u8_floor_ref(pa, pb, n & 3, floor);
+}
+
+uint32_t sad_u8_floor(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor) {
+    if (!floor) return sad_u8(a, b, n);
+    size_t misalign = (uintptr_t)a & 3;
+    if (misalign != ((uintptr_t)b & 3)) return sad_u8_floor_ref(a, b, n, floor);
+    size_t head = misalign ? 4 - misalign : 0;
+    if (head >= n) return sad_u8_floor_ref(a, b, n, floor);
+    return sad_u8_floor_ref(a, b, head, floor) + sad_u8_floor_swar(a + head, b + head, n - head, floor);
+}
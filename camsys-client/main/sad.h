@@ -0,0 +1,52 @@
+#ifndef SAD_H
+#define SAD_H
+
+// ---------------------------------------------------------------
+// SUM OF ABSOLUTE DIFFERENCES
+// ---------------------------------------------------------------
+//
+// Motion kernels on 8 bit grayscale images. A sampled window is first gathered
+// row by row into a contiguous buffer, then compared to the previous one:
+//
+//   n = sad_gather(img, width, height, &win, cur);
+//   sum = sad_u8(cur, prev, n);
+//
+// The window is clipped to the image once, so the inner loops carry no bounds
+// checks or branches. sad_u8_ref() is the plain reference, sad_u8_swar() works on
+// 4 pixels per 32 bit word (two 16 bit lanes of even and odd bytes), the ESP32
+// has no SIMD unit. sad_u8() picks the word kernel when the buffers allow it.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct sad_window_s {
+    int x;      // top left corner, may be out of the image (clipped)
+    int y;
+    int width;
+    int height;
+    int step;   // sampling distance in both directions, < 1 is 1
+};
+
+typedef struct sad_window_s sad_window_t;
+
+// clips the window to the image, returns the number of samples of sad_gather()
+size_t sad_window_clip(sad_window_t* win, int img_width, int img_height);
+
+// copies every step-th pixel of the window row by row into out, returns the count
+size_t sad_gather(const uint8_t* img, int img_width, int img_height, const sad_window_t* win, uint8_t* out);
+
+uint32_t sad_u8_ref(const uint8_t* a, const uint8_t* b, size_t n);
+
+// a and b must be 4 byte aligned
+uint32_t sad_u8_swar(const uint8_t* a, const uint8_t* b, size_t n);
+
+uint32_t sad_u8(const uint8_t* a, const uint8_t* b, size_t n);
+
+// as above, but each pixel adds only what its difference exceeds floor by (noise deadband)
+uint32_t sad_u8_floor_ref(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor);
+uint32_t sad_u8_floor_swar(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor);
+uint32_t sad_u8_floor(const uint8_t* a, const uint8_t* b, size_t n, uint8_t floor);
+
+#endif // SAD_H
@@ -0,0 +1,36 @@
+#include <string.h>
+#include "sat.h"
+
+void sat_init(sat_t* sat, uint32_t* table, size_t size) {
+    sat->table = table;
+    sat->size = size;
+    sat->width = 0;
+    sat->height = 0;
+    sat->floor = 0;
+}
+
+bool sat_build(sat_t* sat, const uint8_t* cur, const uint8_t* prev, int width, int height, uint8_t floor) {
+    if (width < 1 || height < 1 || (size_t)width * height > SAT_PIXELS_MAX) return false;
+    if (SAT_TABLE_SIZE(width, height) > sat->size) return false;
+    const size_t stride = width + 1;
+    memset(sat->table, 0, stride * sizeof(uint32_t));
+    const int f = floor;
+    for (int y = 0; y < height; y++) {
+        const uint32_t* above = sat->table + (size_t)y * stride;
+        uint32_t* row = sat->table + (size_t)(y + 1) * stride;
+        const uint8_t* a = cur + (size_t)y * width;
+        const uint8_t* b = prev + (size_t)y * width;
+        uint32_t sum = 0;
+        row[0] = 0;
+        for (int x = 0; x < width; x++) {
+            int d = a[x] - b[x];
+            d = (d < 0 ? -d : d) - f;
+            sum += d > 0 ? d : 0;
+            row[x + 1] = above[x + 1] + sum;
+        }
+    }
+    sat->width = width;
+    sat->height = height;
+    sat->floor = floor;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef SAT_H
+#define SAT_H
+
+// ---------------------------------------------------------------
+// SUMMED-AREA TABLE
+// ---------------------------------------------------------------
+//
+// Integral image of the difference of two grayscale images, less a noise floor:
+//
+//   d(x, y) = max(0, |cur - prev| - floor)
+//   t[y][x] = sum of d over the pixels above and left of (x, y)
+//
+// The table has (width + 1) x (height + 1) entries with a zero first row and
+// column, so the sum of any rectangle is four lookups (sat_rect()), however large
+// it is. It is built in one pass: a running sum of the row is added to the row
+// above.
+//
+// Entries are 32 bit: a full scale 96x96 image sums to 2.3M, 16 bit would not even
+// hold one zone row. The arithmetic is modulo 2^32, so a rectangle is exact as long
+// as its own sum fits, which holds for images up to SAT_PIXELS_MAX pixels.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SAT_PIXELS_MAX (0xFFFFFFFFUL / 255)
+#define SAT_TABLE_SIZE(width, height) (((size_t)(width) + 1) * ((size_t)(height) + 1))
+
+struct sat_s {
+    uint32_t* table;
+    size_t size;    // capacity of table in entries
+    int width;      // of the built image, 0 before the first build
+    int height;
+    uint8_t floor;
+};
+
+typedef struct sat_s sat_t;
+
+void sat_init(sat_t* sat, uint32_t* table, size_t size);
+
+// builds the table of two width x height images, false if it does not fit
+bool sat_build(sat_t* sat, const uint8_t* cur, const uint8_t* prev, int width, int height, uint8_t floor);
+
+// sum of the differences in the rectangle, which must be inside the image
+static inline uint32_t sat_rect(const sat_t* sat, int x, int y, int width, int height) {
+    const size_t stride = sat->width + 1;
+    const uint32_t* top = sat->table + (size_t)y * stride + x;
+    const uint32_t* bottom = top + (size_t)height * stride;
+    return bottom[width] - top[width] - bottom[0] + top[0];
+}
+
+#endif // SAT_H
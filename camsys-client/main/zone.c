@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sad.h"
+#include "zone.h"
+
+static bool zone_name_valid(const char* name) {
+    size_t len = strlen(name);
+    if (!len || len >= ZONE_NAME_SIZE) return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) return false;
+    }
+    return true;
+}
+
+static int zone_parse_long(const char* val, long min, long max, long* out) {
+    char* end;
+    long v = strtol(val, &end, 10);
+    if (end == val || *end) return ZONE_ERR_SYNTAX;
+    if (v < min || v > max) return ZONE_ERR_RANGE;
+    *out = v;
+    return ZONE_OK;
+}
+
+// x,y;x,y;...
+static int zone_parse_poly(const char* val, zone_t* zone) {
+    const char* p = val;
+    zone->points = 0;
+    while (*p) {
+        if (zone->points >= ZONE_POINTS_MAX) return ZONE_ERR_RANGE;
+        char* end;
+        long x = strtol(p, &end, 10);
+        if (end == p || *end != ',') return ZONE_ERR_SYNTAX;
+        p = end + 1;
+        long y = strtol(p, &end, 10);
+        if (end == p || (*end && *end != ';')) return ZONE_ERR_SYNTAX;
+        if (x < 0 || x > ZONE_IMAGE_SIZE_MAX || y < 0 || y > ZONE_IMAGE_SIZE_MAX) return ZONE_ERR_RANGE;
+        zone->x[zone->points] = x;
+        zone->y[zone->points] = y;
+        zone->points++;
+        p = *end ? end + 1 : end;
+    }
+    return zone->points >= 3 ? ZONE_OK : ZONE_ERR_SYNTAX;
+}
+
+// <cols>x<rows>:<hex>
+static int zone_parse_mask(const char* val, zone_t* zone) {
+    char* end;
+    long cols = strtol(val, &end, 10);
+    if (end == val || *end != 'x') return ZONE_ERR_SYNTAX;
+    const char* p = end + 1;
+    long rows = strtol(p, &end, 10);
+    if (end == p || *end != ':') return ZONE_ERR_SYNTAX;
+    if (cols < 1 || cols > ZONE_MASK_SIZE_MAX || rows < 1 || rows > ZONE_MASK_SIZE_MAX) return ZONE_ERR_RANGE;
+    p = end + 1;
+    size_t digits = (cols * rows + 3) / 4;
+    if (strlen(p) != digits) return ZONE_ERR_SYNTAX;
+    memset(zone->mask, 0, sizeof(zone->mask));
+    for (size_t i = 0; i < digits; i++) {
+        char c = p[i];
+        int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (v < 0) return ZONE_ERR_SYNTAX;
+        zone->mask[i / 2] |= v << (i & 1 ? 0 : 4);
+    }
+    zone->mask_cols = cols;
+    zone->mask_rows = rows;
+    return ZONE_OK;
+}
+
+int zone_parse(const char* def, zone_t* zone) {
+    char buf[ZONE_DEF_SIZE];
+    if (strlen(def) >= sizeof(buf)) return ZONE_ERR_RANGE;
+    strcpy(buf, def);
+    memset(zone, 0, sizeof(zone_t));
+    bool shape = false;
+    int err = ZONE_OK;
+    for (char* tok = strtok(buf, " "); tok && err == ZONE_OK; tok = strtok(NULL, " ")) {
+        char* val = strchr(tok, '=');
+        if (!val) return ZONE_ERR_SYNTAX;
+        *val++ = '\0';
+        long v;
+        if (!strcmp(tok, "name")) {
+            if (!zone_name_valid(val)) return ZONE_ERR_SYNTAX;
+            strcpy(zone->name, val);
+        } else if (!strcmp(tok, "threshold")) {
+            if (ZONE_OK == (err = zone_parse_long(val, 0, 0x7FFFFFFFL, &v))) zone->threshold = v;
+        } else if (!strcmp(tok, "sensitivity")) {
+            if (ZONE_OK == (err = zone_parse_long(val, 0, 255, &v))) zone->sensitivity = v;
+        } else if (!strcmp(tok, "ignore")) {
+            if (ZONE_OK == (err = zone_parse_long(val, 0, 1, &v))) zone->ignore = v;
+        } else if (!strcmp(tok, "poly") && !shape) {
+            zone->shape = ZONE_SHAPE_POLY;
+            err = zone_parse_poly(val, zone);
+            shape = true;
+        } else if (!strcmp(tok, "mask") && !shape) {
+            zone->shape = ZONE_SHAPE_MASK;
+            err = zone_parse_mask(val, zone);
+            shape = true;
+        } else return ZONE_ERR_SYNTAX;
+    }
+    if (err != ZONE_OK) return err;
+    if (!zone->name[0] || !shape || (!zone->ignore && !zone->threshold)) return ZONE_ERR_SYNTAX;
+    return ZONE_OK;
+}
+
+int zone_format(const zone_t* zone, char* buf, size_t size) {
+    int len = snprintf(buf, size, "name=%s threshold=%u sensitivity=%u ignore=%d %s=",
+        zone->name, zone->threshold, zone->sensitivity, zone->ignore ? 1 : 0, zone->shape == ZONE_SHAPE_MASK ? "mask" : "poly");
+    if (zone->shape == ZONE_SHAPE_MASK) {
+        if (len < (int)size) len += snprintf(buf + len, size - len, "%ux%u:", zone->mask_cols, zone->mask_rows);
+        size_t digits = (zone->mask_cols * zone->mask_rows + 3) / 4;
+        for (size_t i = 0; i < digits && len < (int)size; i++)
+            len += snprintf(buf + len, size - len, "%X", (zone->mask[i / 2] >> (i & 1 ? 0 : 4)) & 0xF);
+    } else {
+        for (int i = 0; i < zone->points && len < (int)size; i++)
+            len += snprintf(buf + len, size - len, "%s%d,%d", i ? ";" : "", zone->x[i], zone->y[i]);
+    }
+    return len;
+}
+
+void zone_set_init(zone_set_t* set) {
+    set->count = 0;
+    set->span_count = 0;
+    set->width = 0;
+    set->height = 0;
+}
+
+int zone_set_put(zone_set_t* set, const zone_t* zone) {
+    int i = 0;
+    while (i < set->count && strcmp(set->zones[i].name, zone->name)) i++;
+    if (i == set->count) {
+        if (set->count >= ZONE_MAX) return ZONE_ERR_FULL;
+        set->count++;
+    }
+    set->zones[i] = *zone;
+    return ZONE_OK;
+}
+
+int zone_set_remove(zone_set_t* set, const char* name) {
+    for (int i = 0; i < set->count; i++) if (!strcmp(set->zones[i].name, name)) {
+        memmove(set->zones + i, set->zones + i + 1, (set->count - i - 1) * sizeof(zone_t));
+        set->count--;
+        return ZONE_OK;
+    }
+    return ZONE_ERR_NOT_FOUND;
+}
+
+static int zone_float_cmp(const void* a, const void* b) {
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+// marks the pixels of row y covered by the zone, a pixel is in a polygon when its center is
+static void zone_cover_row(const zone_t* zone, int y, int width, int height, uint8_t* row) {
+    if (zone->shape == ZONE_SHAPE_MASK) {
+        int r = y * zone->mask_rows / height;
+        for (int x = 0; x < width; x++) {
+            int i = r * zone->mask_cols + x * zone->mask_cols / width;
+            row[x] |= (zone->mask[i >> 3] >> (7 - (i & 7))) & 1;
+        }
+        return;
+    }
+    float yc = y + 0.5f;
+    float xs[ZONE_POINTS_MAX];
+    int cnt = 0;
+    for (int i = 0, j = zone->points - 1; i < zone->points; j = i++) {
+        float yi = zone->y[i], yj = zone->y[j];
+        if ((yi <= yc) == (yj <= yc)) continue;
+        xs[cnt++] = zone->x[i] + (yc - yi) * (zone->x[j] - zone->x[i]) / (yj - yi);
+    }
+    qsort(xs, cnt, sizeof(float), zone_float_cmp);
+    for (int k = 0; k + 1 < cnt; k += 2) {
+        int from = (int)(xs[k] + 0.5f);
+        int to = (int)(xs[k + 1] + 0.5f);
+        if (from < 0) from = 0;
+        if (to > width) to = width;
+        for (int x = from; x < to; x++) row[x] = 1;
+    }
+}
+
+// merges the spans of consecutive rows with the same zone, x and len into rectangles,
+// the spans stay sorted by their first row
+static void zone_set_merge(zone_set_t* set) {
+    zone_span_t* spans = set->spans;
+    int n = set->span_count;
+    for (int i = 0; i < n; i++) {
+        zone_span_t* span = &spans[i];
+        if (!span->len) continue;
+        int j = i + 1;
+        for (;;) {
+            int next = span->y + span->rows;
+            while (j < n && spans[j].y < next) j++;
+            while (j < n && spans[j].y == next && !(spans[j].len == span->len && spans[j].x == span->x && spans[j].zone == span->zone)) j++;
+            if (j >= n || spans[j].y != next) break;
+            spans[j].len = 0; // merged
+            span->rows++;
+        }
+    }
+    int count = 0;
+    for (int i = 0; i < n; i++) if (spans[i].len) spans[count++] = spans[i];
+    set->span_count = count;
+}
+
+int zone_set_compile(zone_set_t* set, int width, int height) {
+    if (width < 1 || width > ZONE_IMAGE_SIZE_MAX || height < 1 || height > ZONE_IMAGE_SIZE_MAX) return ZONE_ERR_RANGE;
+    uint8_t ignore[ZONE_IMAGE_SIZE_MAX];
+    uint8_t cover[ZONE_IMAGE_SIZE_MAX];
+    set->span_count = 0;
+    set->width = width;
+    set->height = height;
+    memset(set->pixels, 0, sizeof(set->pixels));
+    for (int y = 0; y < height; y++) {
+        memset(ignore, 0, width);
+        for (int z = 0; z < set->count; z++) if (set->zones[z].ignore) zone_cover_row(&set->zones[z], y, width, height, ignore);
+        for (int z = 0; z < set->count; z++) {
+            if (set->zones[z].ignore) continue;
+            memset(cover, 0, width);
+            zone_cover_row(&set->zones[z], y, width, height, cover);
+            for (int x = 0; x < width; ) {
+                if (!cover[x] || ignore[x]) {
+                    x++;
+                    continue;
+                }
+                int from = x;
+                while (x < width && cover[x] && !ignore[x]) x++;
+                if (set->span_count >= ZONE_SPANS_MAX) {
+                    set->span_count = 0;
+                    return ZONE_ERR_FULL;
+                }
+                zone_span_t* span = &set->spans[set->span_count++];
+                span->y = y;
+                span->x = from;
+                span->len = x - from;
+                span->rows = 1;
+                span->zone = z;
+                set->pixels[z] += x - from;
+            }
+        }
+    }
+    zone_set_merge(set);
+    return ZONE_OK;
+}
+
+static uint32_t zone_span_sum(const zone_set_t* set, const zone_span_t* span, const uint8_t* cur, const uint8_t* prev) {
+    uint32_t sum = 0;
+    for (int r = 0; r < span->rows; r++) {
+        size_t offset = (size_t)(span->y + r) * set->width + span->x;
+        sum += sad_u8_floor(cur + offset, prev + offset, span->len, set->zones[span->zone].sensitivity);
+    }
+    return sum;
+}
+
+void zone_set_eval(const zone_set_t* set, const uint8_t* cur, const uint8_t* prev, uint32_t* sums) {
+    for (int z = 0; z < set->count; z++) sums[z] = 0;
+    for (int i = 0; i < set->span_count; i++) sums[set->spans[i].zone] += zone_span_sum(set, &set->spans[i], cur, prev);
+}
+
+void zone_set_eval_sat(const zone_set_t* set, const sat_t* const* sats, const uint8_t* cur, const uint8_t* prev, uint32_t* sums) {
+    for (int z = 0; z < set->count; z++) sums[z] = 0;
+    for (int i = 0; i < set->span_count; i++) {
+        const zone_span_t* span = &set->spans[i];
+        const sat_t* sat = sats[span->zone];
+        sums[span->zone] += sat ? sat_rect(sat, span->x, span->y, span->len, span->rows) : zone_span_sum(set, span, cur, prev);
+    }
+}
+
+const char* zone_strerror(int err) {
+    switch (err) {
+        case ZONE_OK: return "ok";
+        case ZONE_ERR_SYNTAX: return "syntax error";
+        case ZONE_ERR_RANGE: return "value out of range";
+        case ZONE_ERR_FULL: return "too many zones or spans";
+        case ZONE_ERR_NOT_FOUND: return "no such zone";
+        default: return "unknown error";
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef ZONE_H
+#define ZONE_H
+
+// ---------------------------------------------------------------
+// WATCH ZONES
+// ---------------------------------------------------------------
+//
+// Named zones of the motion image, each a polygon or a coarse bitmask with its
+// own threshold and sensitivity. Ignore zones are cut out of every other zone.
+//
+// Definition (the text of !ZONE, also what is stored), keys in any order:
+//
+//   name=<text> threshold=<sum> sensitivity=<0..255> ignore=<0|1> poly=x,y;x,y;x,y..
+//   name=<text> ... mask=<cols>x<rows>:<hex>
+//
+// The mask bits are row by row, most significant bit first, each cell covers
+// width / cols x height / rows pixels. The threshold is the sum of the pixel
+// differences over the zone that alerts, the sensitivity is the difference a
+// pixel has to exceed to count at all (noise deadband).
+//
+// zone_set_compile() turns the zones into row spans, and spans of the same width
+// on consecutive rows into rectangles, sorted by their first row. A frame is checked
+// in one pass over the image (zone_set_eval()), or with four lookups per rectangle
+// in the summed-area tables of the differences (zone_set_eval_sat(), see sat.h)
+// where they are worth building.
+//
+// This file has no ESP-IDF dependencies so that it builds on the host too.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sat.h"
+
+#define ZONE_MAX 8
+#define ZONE_NAME_SIZE 16
+#define ZONE_POINTS_MAX 16
+#define ZONE_MASK_SIZE_MAX 32           // cols and rows
+#define ZONE_IMAGE_SIZE_MAX 255         // width and height
+#define ZONE_SPANS_MAX 2048
+#define ZONE_DEF_SIZE 256               // longest definition text
+
+#define ZONE_OK 0
+#define ZONE_ERR_SYNTAX -1
+#define ZONE_ERR_RANGE -2
+#define ZONE_ERR_FULL -3
+#define ZONE_ERR_NOT_FOUND -4
+
+#define ZONE_SHAPE_POLY 0
+#define ZONE_SHAPE_MASK 1
+
+struct zone_s {
+    char name[ZONE_NAME_SIZE];
+    uint32_t threshold;
+    uint8_t sensitivity;
+    bool ignore;
+    uint8_t shape;
+    uint8_t points;
+    int16_t x[ZONE_POINTS_MAX];
+    int16_t y[ZONE_POINTS_MAX];
+    uint8_t mask_cols;
+    uint8_t mask_rows;
+    uint8_t mask[ZONE_MASK_SIZE_MAX * ZONE_MASK_SIZE_MAX / 8];
+};
+
+typedef struct zone_s zone_t;
+
+struct zone_span_s {
+    uint8_t y;
+    uint8_t x;
+    uint8_t len;
+    uint8_t rows;
+    uint8_t zone;
+};
+
+typedef struct zone_span_s zone_span_t;
+
+struct zone_set_s {
+    zone_t zones[ZONE_MAX];
+    int count;
+    uint16_t pixels[ZONE_MAX];   // covered by the compiled spans
+    zone_span_t spans[ZONE_SPANS_MAX];
+    int span_count;
+    int width;                   // of the compiled image
+    int height;
+};
+
+typedef struct zone_set_s zone_set_t;
+
+int zone_parse(const char* def, zone_t* zone);
+int zone_format(const zone_t* zone, char* buf, size_t size);
+
+void zone_set_init(zone_set_t* set);
+// adds the zone or replaces the one with the same name
+int zone_set_put(zone_set_t* set, const zone_t* zone);
+int zone_set_remove(zone_set_t* set, const char* name);
+int zone_set_compile(zone_set_t* set, int width, int height);
+
+// sums[] gets the difference of every zone between the two images (compiled size)
+void zone_set_eval(const zone_set_t* set, const uint8_t* cur, const uint8_t* prev, uint32_t* sums);
+
+// the same with the tables where there is one: sats[z] is built from the two images
+// with the sensitivity of zone z as the floor, zones with NULL are summed directly
+void zone_set_eval_sat(const zone_set_t* set, const sat_t* const* sats, const uint8_t* cur, const uint8_t* prev, uint32_t* sums);
+
+const char* zone_strerror(int err);
+
+#endif // ZONE_H
@@ -0,0 +1,105 @@
+// Host micro-benchmark of jpeg_dc.h: the DC-only thumbnail against libjpeg
+// decoding the same frame at 1/8 scale (DC only as well, but through the whole
+// libjpeg pipeline), at full scale in grayscale and at full scale in RGB, in us
+// per frame. The host does not model the ESP32 (no SIMD there), the numbers
+// only compare the decodes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <jpeglib.h>
+#include "jpeg_dc.h"
+
+#define SAMPLES_DIR "samples/"
+#define ROUNDS 300
+
+static const char* const names[] = { "422.jpg", "420.jpg", "rst_rows.jpg", "vga422.jpg" };
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t* load(const char* name, size_t* len)
+{
+    char path[256];
+    snprintf(path, sizeof(path), SAMPLES_DIR "%s", name);
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    uint8_t* buf = NULL;
+    if (!fseek(f, 0, SEEK_END)) {
+        long size = ftell(f);
+        if (size > 0 && !fseek(f, 0, SEEK_SET) && (buf = malloc(size))) {
+            if (fread(buf, 1, size, f) != (size_t) size) {
+                free(buf);
+                buf = NULL;
+            }
+            *len = size;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+static uint8_t out[640 * 480 * 3];
+
+// keeps the compiler from dropping the decodes
+static volatile uint8_t sink;
+
+// the samples are valid, libjpeg errors exit
+static void libjpeg_decode(const uint8_t* jpg, size_t len, int denom, J_COLOR_SPACE space)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error(&err);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpg, len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.out_color_space = space;
+    jpeg_start_decompress(&cinfo);
+    size_t stride = (size_t) cinfo.output_width * cinfo.output_components;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = out + cinfo.output_scanline * stride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    sink = out[0];
+}
+
+int main(void)
+{
+    printf("%-14s %9s %9s %9s %9s %9s\n", "frame (us)", "size", "dc", "1/8", "gray", "rgb");
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        size_t len;
+        uint8_t* jpg = load(names[n], &len);
+        jpeg_dc_info_t info;
+        if (!jpg || jpeg_dc_thumbnail(jpg, len, out, sizeof(out), &info) != JPEG_DC_OK) {
+            printf("cannot decode " SAMPLES_DIR "%s\n", names[n]);
+            return 1;
+        }
+        double t[5];
+        t[0] = now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            jpeg_dc_thumbnail(jpg, len, out, sizeof(out), NULL);
+            sink = out[0];
+        }
+        t[1] = now_ns();
+        for (int r = 0; r < ROUNDS; r++) libjpeg_decode(jpg, len, 8, JCS_GRAYSCALE);
+        t[2] = now_ns();
+        for (int r = 0; r < ROUNDS; r++) libjpeg_decode(jpg, len, 1, JCS_GRAYSCALE);
+        t[3] = now_ns();
+        for (int r = 0; r < ROUNDS; r++) libjpeg_decode(jpg, len, 1, JCS_RGB);
+        t[4] = now_ns();
+        char size[16];
+        snprintf(size, sizeof(size), "%ux%u", info.width, info.height);
+        printf("%-14s %9s %9.1f %9.1f %9.1f %9.1f\n", names[n], size, (t[1] - t[0]) / ROUNDS / 1000,
+            (t[2] - t[1]) / ROUNDS / 1000, (t[3] - t[2]) / ROUNDS / 1000, (t[4] - t[3]) / ROUNDS / 1000);
+        free(jpg);
+    }
+    return 0;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "record.h"
+#include "avi.h"
+#include "jpeg_dc.h"
+
+#define RECOVER_BUF_SIZE (1024 * 1024)
+#define RECOVER_INDEX_INTERVAL_MS 1000
+#define AVI_BUF_SIZE (64 * 1024)
+#define THUMB_SIZE_MAX (512 * 512)
+
+static void usage() {
+    fprintf(stderr,
+        "usage:\n"
+        "  camsys-rec info <record.vid>                 print header and validate every frame\n"
+        "  camsys-rec unpack <record.vid> <dir>         write each frame to <dir>/NNNNNN.jpg\n"
+        "  camsys-rec index <record.idx> [unix-ms]      list the seek index or look up a time\n"
+        "  camsys-rec recover <record.vid> <record.idx> repair a segment left open by a reset\n"
+        "  camsys-rec avi <record.vid> <out.avi>        export as MJPEG AVI, like the device /download\n"
+        "  camsys-rec pack <record.vid> <fps> <jpg>...  build a recording from jpeg files\n"
+        "  camsys-rec thumbs <record.vid> <dir>         write the 1/8 DC thumbnail of each frame to <dir>/NNNNNN.pgm\n");
+}
+
+static uint8_t* read_whole_file(const char* filename, size_t* len) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) return NULL;
+    uint8_t* buf = NULL;
+    if (!fseek(f, 0L, SEEK_END)) {
+        long size = ftell(f);
+        if (size > 0 && !fseek(f, 0L, SEEK_SET)) {
+            buf = malloc(size);
+            if (buf && (size_t)size != fread(buf, 1, size, f)) {
+                free(buf);
+                buf = NULL;
+            }
+            *len = size;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+static int cmd_info(const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    record_file_header_t fhdr;
+    int err = record_read_file_header(f, &fhdr);
+    if (err != RECORD_OK) {
+        fprintf(stderr, "%s: %s\n", filename, record_strerror(err));
+        fclose(f);
+        return 1;
+    }
+    printf("version: %u\nmax_len: %" PRIu32 "\ndata_len: %" PRIu32 "\n", fhdr.version, fhdr.max_len, fhdr.data_len);
+
+    long end = -1, pos = ftell(f);
+    if (fhdr.data_len) end = pos + fhdr.data_len;
+    else if (!fseek(f, 0L, SEEK_END)) end = ftell(f);
+    if (end < 0 || fseek(f, pos, SEEK_SET)) {
+        perror(filename);
+        fclose(f);
+        return 1;
+    }
+
+    uint8_t* buf = NULL;
+    size_t size = 0;
+    uint32_t frames = 0, max_len = 0;
+    uint64_t first = 0, last = 0;
+    record_frame_header_t hdr;
+    while ((pos = ftell(f)) < end) {
+        err = record_read_frame_header(f, &hdr);
+        if (err == RECORD_OK && hdr.len > size) {
+            free(buf);
+            size = hdr.len;
+            buf = malloc(size);
+            if (!buf) {
+                fprintf(stderr, "out of memory\n");
+                fclose(f);
+                return 1;
+            }
+        }
+        if (err == RECORD_OK) err = record_read_frame_payload(f, &hdr, buf, size);
+        if (err != RECORD_OK) {
+            fprintf(stderr, "frame %" PRIu32 " at %ld: %s\n", frames, pos, record_strerror(err));
+            free(buf);
+            fclose(f);
+            return 2;
+        }
+        if (!frames) first = hdr.timestamp;
+        last = hdr.timestamp;
+        if (max_len < hdr.len) max_len = hdr.len;
+        frames++;
+    }
+    printf("frames: %" PRIu32 "\nlargest: %" PRIu32 "\nfirst: %" PRIu64 "\nlast: %" PRIu64 "\nduration_ms: %" PRIu64 "\n",
+        frames, max_len, first, last, last - first);
+    free(buf);
+    fclose(f);
+    return 0;
+}
+
+static int cmd_unpack(const char* filename, const char* dir) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    record_file_header_t fhdr;
+    int err = record_read_file_header(f, &fhdr);
+    uint8_t* buf = NULL;
+    size_t size = 0;
+    uint32_t frames = 0;
+    long end = err == RECORD_OK && fhdr.data_len ? ftell(f) + fhdr.data_len : -1;
+    record_frame_header_t hdr;
+    while (err == RECORD_OK) {
+        if (end >= 0 && ftell(f) >= end) {
+            err = RECORD_ERR_EOF;
+            break;
+        }
+        err = record_read_frame_header(f, &hdr);
+        if (err != RECORD_OK) break;
+        if (hdr.len > size) {
+            free(buf);
+            size = hdr.len;
+            buf = malloc(size);
+            if (!buf) break;
+        }
+        err = record_read_frame_payload(f, &hdr, buf, size);
+        if (err != RECORD_OK) break;
+        char outname[4096];
+        snprintf(outname, sizeof(outname), "%s/%06" PRIu32 ".jpg", dir, frames);
+        FILE* out = fopen(outname, "wb");
+        if (!out || hdr.len != fwrite(buf, 1, hdr.len, out)) {
+            perror(outname);
+            if (out) fclose(out);
+            err = RECORD_ERR_IO;
+            break;
+        }
+        fclose(out);
+        frames++;
+    }
+    free(buf);
+    fclose(f);
+    printf("%" PRIu32 " frames written\n", frames);
+    if (err != RECORD_ERR_EOF) {
+        fprintf(stderr, "%s: %s\n", filename, record_strerror(err));
+        return 2;
+    }
+    return 0;
+}
+
+static int cmd_index(const char* filename, const char* at) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    long count = 0;
+    int err = record_read_index_header(f, &count);
+    record_index_entry_t entry;
+    if (err == RECORD_OK && at) {
+        long n = record_index_search(f, count, strtoull(at, NULL, 10), &entry);
+        if (n >= 0) printf("%ld: %" PRIu64 " offset %" PRIu32 " frame %" PRIu32 "\n", n, entry.timestamp, entry.offset, entry.frame);
+        else err = (int)n;
+    }
+    for (long n=0; err == RECORD_OK && !at && n<count; n++) {
+        err = record_read_index_entry(f, n, &entry);
+        if (err == RECORD_OK) printf("%ld: %" PRIu64 " offset %" PRIu32 " frame %" PRIu32 "\n", n, entry.timestamp, entry.offset, entry.frame);
+    }
+    fclose(f);
+    if (err != RECORD_OK) {
+        fprintf(stderr, "%s: %s\n", filename, record_strerror(err));
+        return 2;
+    }
+    return 0;
+}
+
+static int cmd_recover(const char* filename, const char* idxname) {
+    FILE* vid = fopen(filename, "r+b");
+    if (!vid) {
+        perror(filename);
+        return 1;
+    }
+    FILE* idx = fopen(idxname, "r+b");
+    if (!idx) idx = fopen(idxname, "w+b");
+    if (!idx) {
+        perror(idxname);
+        fclose(vid);
+        return 1;
+    }
+    uint8_t* buf = malloc(RECOVER_BUF_SIZE);
+    if (!buf) {
+        fprintf(stderr, "out of memory\n");
+        fclose(idx);
+        fclose(vid);
+        return 1;
+    }
+    record_recover_t rec;
+    int err = record_recover(vid, idx, RECOVER_INDEX_INTERVAL_MS, buf, RECOVER_BUF_SIZE, &rec);
+    free(buf);
+    if (fclose(idx) || fclose(vid)) err = RECORD_ERR_IO;
+    if (err != RECORD_OK) {
+        fprintf(stderr, "%s: %s\n", filename, record_strerror(err));
+        return 2;
+    }
+    if (!rec.repaired) printf("closed properly, nothing to do\n");
+    else printf("synced: %ld\nend: %ld\nframes scanned: %" PRIu32 "\nindex entries: %" PRIu32 "\n",
+        rec.committed, rec.end, rec.frames, rec.index_entries);
+    return 0;
+}
+
+static int avi_read_payload(void* arg, const avi_frame_t* frame, uint32_t delta, uint8_t* buf, size_t len) {
+    FILE* f = arg;
+    if (fseek(f, frame->offset + delta, SEEK_SET) || len != fread(buf, 1, len, f)) return AVI_ERR_READ;
+    return 0;
+}
+
+static int cmd_avi(const char* filename, const char* outname) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    record_file_header_t fhdr;
+    int err = record_read_file_header(f, &fhdr);
+    long end = err == RECORD_OK && fhdr.data_len ? (long)fhdr.hdr_size + fhdr.data_len : -1;
+
+    avi_frame_t* frames = NULL;
+    uint32_t cnt = 0, size = 0;
+    uint16_t width = 0, height = 0;
+    uint64_t first = 0, last = 0;
+    record_frame_header_t hdr;
+    while (err == RECORD_OK && (end < 0 || ftell(f) < end)) {
+        long pos = ftell(f);
+        if (record_read_frame_header(f, &hdr) != RECORD_OK || record_skip_frame_payload(f, &hdr) != RECORD_OK) break;
+        if (cnt == size) {
+            size = size ? size * 2 : 1024;
+            avi_frame_t* grown = realloc(frames, size * sizeof(avi_frame_t));
+            if (!grown) {
+                err = RECORD_ERR_IO;
+                break;
+            }
+            frames = grown;
+        }
+        if (!cnt) {
+            width = hdr.width;
+            height = hdr.height;
+            first = hdr.timestamp;
+        }
+        last = hdr.timestamp;
+        frames[cnt].src = 0;
+        frames[cnt].offset = pos + RECORD_FRAME_HEADER_SIZE;
+        frames[cnt].len = hdr.len;
+        cnt++;
+    }
+    if (err != RECORD_OK || !cnt) {
+        fprintf(stderr, "%s: %s\n", filename, err != RECORD_OK ? record_strerror(err) : "no frames");
+        free(frames);
+        fclose(f);
+        return 2;
+    }
+
+    avi_file_t avi;
+    uint32_t usec_per_frame = cnt > 1 ? (uint32_t)((last - first) * 1000 / (cnt - 1)) : 100000;
+    cnt = avi_file_init(&avi, frames, cnt, width, height, usec_per_frame, avi_read_payload, f);
+    FILE* out = fopen(outname, "wb");
+    uint8_t* buf = malloc(AVI_BUF_SIZE);
+    int ret = out && buf ? 0 : 1;
+    for (uint32_t pos=0; !ret && pos<avi.size; ) {
+        long n = avi_file_read(&avi, pos, buf, AVI_BUF_SIZE);
+        if (n <= 0 || (size_t)n != fwrite(buf, 1, n, out)) ret = 1;
+        pos += n;
+    }
+    if (out && fclose(out)) ret = 1;
+    if (ret) perror(outname);
+    else printf("%" PRIu32 " frames, %" PRIu32 " bytes\n", cnt, avi.size);
+    free(buf);
+    free(frames);
+    fclose(f);
+    return ret;
+}
+
+static int cmd_pack(const char* filename, int fps, int argc, char** argv) {
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t ts = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+    uint32_t max_len = 0;
+    int ret = record_write_file_header(f, RECORD_FILE_HEADER_SIZE) == RECORD_OK ? 0 : 1;
+    uint32_t data_len = 0;
+    for (int i=0; !ret && i<argc; i++) {
+        size_t len = 0;
+        uint8_t* buf = read_whole_file(argv[i], &len);
+        if (!buf) {
+            perror(argv[i]);
+            ret = 1;
+            break;
+        }
+        record_frame_header_t hdr = {
+            .len = len,
+            .timestamp = ts + (uint64_t)i * 1000 / fps,
+            .format = RECORD_PIXFORMAT_JPEG,
+            .flags = RECORD_FRAME_FLAG_KEY,
+        };
+        if (record_write_frame(f, &hdr, buf) != RECORD_OK) ret = 1;
+        if (max_len < len) max_len = len;
+        data_len += RECORD_FRAME_HEADER_SIZE + len;
+        free(buf);
+    }
+    fclose(f);
+    if (!ret) {
+        f = fopen(filename, "r+b");
+        if (!f || record_update_file_header(f, max_len, data_len) != RECORD_OK) ret = 1;
+        if (f) fclose(f);
+    }
+    if (ret) fprintf(stderr, "%s: write failed\n", filename);
+    return ret;
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+// the motion thumbnails of the device (see jpeg_dc.h), timed per frame
+static int cmd_thumbs(const char* filename, const char* dir) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    record_file_header_t fhdr;
+    int err = record_read_file_header(f, &fhdr);
+    uint8_t* buf = NULL;
+    size_t size = 0;
+    uint8_t* thumb = malloc(THUMB_SIZE_MAX);
+    uint32_t frames = 0, failed = 0;
+    double total_us = 0;
+    uint64_t total_bytes = 0;
+    long end = err == RECORD_OK && fhdr.data_len ? ftell(f) + fhdr.data_len : -1;
+    record_frame_header_t hdr;
+    while (err == RECORD_OK && thumb) {
+        if (end >= 0 && ftell(f) >= end) {
+            err = RECORD_ERR_EOF;
+            break;
+        }
+        err = record_read_frame_header(f, &hdr);
+        if (err != RECORD_OK) break;
+        if (hdr.len > size) {
+            free(buf);
+            size = hdr.len;
+            buf = malloc(size);
+            if (!buf) break;
+        }
+        err = record_read_frame_payload(f, &hdr, buf, size);
+        if (err != RECORD_OK) break;
+        jpeg_dc_info_t info;
+        double start_us = now_us();
+        int jerr = jpeg_dc_thumbnail(buf, hdr.len, thumb, THUMB_SIZE_MAX, &info);
+        total_us += now_us() - start_us;
+        total_bytes += hdr.len;
+        if (jerr != JPEG_DC_OK) {
+            fprintf(stderr, "frame %" PRIu32 ": %s\n", frames, jpeg_dc_strerror(jerr));
+            failed++;
+            frames++;
+            continue;
+        }
+        char outname[4096];
+        snprintf(outname, sizeof(outname), "%s/%06" PRIu32 ".pgm", dir, frames);
+        FILE* out = fopen(outname, "wb");
+        size_t len = (size_t)info.thumb_width * info.thumb_height;
+        if (!out || fprintf(out, "P5\n%u %u\n255\n", info.thumb_width, info.thumb_height) < 0 || len != fwrite(thumb, 1, len, out)) {
+            perror(outname);
+            if (out) fclose(out);
+            err = RECORD_ERR_IO;
+            break;
+        }
+        fclose(out);
+        frames++;
+    }
+    free(thumb);
+    free(buf);
+    fclose(f);
+    printf("%" PRIu32 " frames, %" PRIu32 " failed", frames, failed);
+    if (frames) printf(", %.1f us/frame, %.1f MB/s", total_us / frames, total_us > 0 ? total_bytes / total_us : 0.0);
+    printf("\n");
+    if (err != RECORD_ERR_EOF) {
+        fprintf(stderr, "%s: %s\n", filename, record_strerror(err));
+        return 2;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && !strcmp(argv[1], "info")) return cmd_info(argv[2]);
+    if (argc == 4 && !strcmp(argv[1], "unpack")) return cmd_unpack(argv[2], argv[3]);
+    if ((argc == 3 || argc == 4) && !strcmp(argv[1], "index")) return cmd_index(argv[2], argc == 4 ? argv[3] : NULL);
+    if (argc == 4 && !strcmp(argv[1], "avi")) return cmd_avi(argv[2], argv[3]);
+    if (argc == 4 && !strcmp(argv[1], "recover")) return cmd_recover(argv[2], argv[3]);
+    if (argc == 4 && !strcmp(argv[1], "thumbs")) return cmd_thumbs(argv[2], argv[3]);
+    if (argc >= 5 && !strcmp(argv[1], "pack") && atoi(argv[3]) > 0) return cmd_pack(argv[2], atoi(argv[3]), argc - 4, argv + 4);
+    usage();
+    return 1;
+}
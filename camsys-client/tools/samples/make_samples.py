@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Writes the sample JPEGs of test_jpeg_dc and bench_jpeg_dc (needs Pillow). The
+# images are synthetic (gradients, shapes, noise) so the files stay small and the
+# output is the same on every run of the same Pillow/libjpeg.
+
+import random
+from PIL import Image, ImageDraw
+
+
+def scene(width, height, seed):
+    rnd = random.Random(seed)
+    img = Image.new("RGB", (width, height))
+    px = img.load()
+    for y in range(height):
+        for x in range(width):
+            px[x, y] = (x * 255 // width, y * 255 // height, (x + y) * 127 // (width + height) + 64)
+    draw = ImageDraw.Draw(img)
+    for _ in range(12):
+        x, y = rnd.randrange(width), rnd.randrange(height)
+        r = rnd.randrange(4, max(5, width // 4))
+        color = tuple(rnd.randrange(256) for _ in range(3))
+        if rnd.random() < 0.5:
+            draw.ellipse((x - r, y - r, x + r, y + r), fill=color)
+        else:
+            draw.rectangle((x - r, y - r // 2, x + r, y + r // 2), fill=color)
+    for _ in range(width * height // 200):
+        x, y = rnd.randrange(width), rnd.randrange(height)
+        px[x, y] = tuple(rnd.randrange(256) for _ in range(3))
+    return img
+
+
+samples = [
+    # name, width, height, options
+    ("444.jpg", 160, 120, dict(quality=90, subsampling=0)),
+    ("422.jpg", 160, 120, dict(quality=80, subsampling=1)),  # as the OV2640
+    ("420.jpg", 100, 75, dict(quality=75, subsampling=2)),   # partial MCUs
+    ("gray.jpg", 90, 70, dict(quality=85, mode="L")),
+    ("rst_blocks.jpg", 120, 90, dict(quality=80, subsampling=2, restart_marker_blocks=3)),
+    ("rst_rows.jpg", 160, 120, dict(quality=80, subsampling=1, restart_marker_rows=1)),
+    ("gray_rst.jpg", 64, 48, dict(quality=70, mode="L", restart_marker_blocks=5)),
+    ("optimized.jpg", 128, 96, dict(quality=97, subsampling=2, optimize=True)),  # long Huffman codes
+    ("low_quality.jpg", 96, 96, dict(quality=5, subsampling=2)),  # large DC quantizer
+    ("progressive.jpg", 64, 48, dict(quality=80, progressive=True)),  # not supported
+    ("vga422.jpg", 640, 480, dict(quality=80, subsampling=1)),  # bench
+]
+
+for i, (name, width, height, options) in enumerate(samples):
+    img = scene(width, height, i)
+    mode = options.pop("mode", None)
+    if mode:
+        img = img.convert(mode)
+    img.save(name, "JPEG", **options)
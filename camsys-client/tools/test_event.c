@@ -0,0 +1,191 @@
+// Host test of event.h: hand-written cases of n of m triggering, min_ms, hold_ms
+// and the cool-down, then random score sequences against a plain model of the
+// debounce rules in 64 bit time. The 32 bit clock of event_update() is started
+// shortly before its wrap around, so the wrap falls inside every round.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+
+#define FRAMES 3000
+
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static int failed;
+static int checks;
+
+static void check(int ok, const char* what, int round, long n)
+{
+    checks++;
+    if (!ok && !failed) {
+        printf("FAIL %s: round %d, %ld\n", what, round, n);
+        failed = 1;
+    }
+}
+
+static void init(event_t* ev, int n, int m, uint32_t min_ms, uint32_t hold_ms, uint32_t cooldown_ms)
+{
+    event_params_t params = { .n = n, .m = m, .min_ms = min_ms, .hold_ms = hold_ms, .cooldown_ms = cooldown_ms };
+    event_init(ev, &params);
+}
+
+static void test_cases(void)
+{
+    event_t ev;
+    uint32_t t = 0;
+
+    // 2 of 3: a single hit does not start, the second within 3 frames does
+    init(&ev, 2, 3, 0, 0, 0);
+    check(event_update(&ev, t += 100, 150) == EVENT_NONE, "n of m first hit", 0, 0);
+    check(event_update(&ev, t += 100, 0) == EVENT_NONE, "n of m miss", 0, 1);
+    check(event_update(&ev, t += 100, 0) == EVENT_NONE, "n of m miss", 0, 2);
+    check(event_update(&ev, t += 100, 120) == EVENT_NONE, "n of m hit out of window", 0, 3);
+    check(event_update(&ev, t += 100, 99) == EVENT_NONE, "n of m under the threshold", 0, 4);
+    check(event_update(&ev, t += 100, 130) == EVENT_START, "n of m start", 0, 5);
+    check(ev.active && ev.peak == 130 && ev.start_ms == t, "n of m state", 0, 6);
+
+    // min_ms keeps a short event going, hold_ms after the last hit ends it
+    t = 1000;
+    init(&ev, 1, 1, 1000, 300, 0);
+    check(event_update(&ev, t, 200) == EVENT_START, "min start", 1, 0);
+    check(event_update(&ev, t + 500, 0) == EVENT_NONE, "min not lasted", 1, 1);
+    check(event_update(&ev, t + 999, 0) == EVENT_NONE, "min not lasted", 1, 2);
+    check(event_update(&ev, t + 1000, 0) == EVENT_END && ev.duration_ms == 1000 && ev.peak == 200, "min end", 1, 3);
+
+    t = 1000;
+    init(&ev, 1, 1, 0, 300, 0);
+    check(event_update(&ev, t, 100) == EVENT_START, "hold start", 2, 0);
+    check(event_update(&ev, t + 200, 400) == EVENT_NONE && ev.peak == 400, "hold hit extends", 2, 1);
+    check(event_update(&ev, t + 499, 0) == EVENT_NONE, "hold within", 2, 2);
+    check(event_update(&ev, t + 500, 0) == EVENT_END && ev.duration_ms == 500, "hold end", 2, 3);
+    check(event_update(&ev, t + 600, 100) == EVENT_START, "no cool-down restart", 2, 4);
+
+    // hits in the cool-down are counted as suppressed, the first frame after it counts
+    t = 1000;
+    init(&ev, 1, 1, 0, 0, 2000);
+    check(event_update(&ev, t, 100) == EVENT_START, "cool-down start", 3, 0);
+    check(event_update(&ev, t + 100, 0) == EVENT_END, "cool-down end", 3, 1);
+    check(event_update(&ev, t + 200, 100) == EVENT_NONE, "cool-down suppressed", 3, 2);
+    check(event_update(&ev, t + 1000, 0) == EVENT_NONE, "cool-down miss", 3, 3);
+    check(event_update(&ev, t + 2099, 500) == EVENT_NONE && ev.suppressed == 2, "cool-down suppressed count", 3, 4);
+    check(event_update(&ev, t + 2100, 100) == EVENT_START, "after cool-down", 3, 5);
+
+    // the frames of a cool-down do not fill the window
+    t = 1000;
+    init(&ev, 2, 2, 0, 0, 1000);
+    event_update(&ev, t, 100);
+    event_update(&ev, t + 100, 100);
+    check(event_update(&ev, t + 200, 0) == EVENT_END, "window end", 4, 0);
+    check(event_update(&ev, t + 300, 100) == EVENT_NONE, "window cool-down", 4, 1);
+    check(event_update(&ev, t + 1200, 100) == EVENT_NONE, "window empty after cool-down", 4, 2);
+    check(event_update(&ev, t + 1300, 100) == EVENT_START, "window refilled", 4, 3);
+
+    // an event across the wrap around of the ms clock
+    t = 0xFFFFFF00u;
+    init(&ev, 1, 1, 500, 100, 1000);
+    check(event_update(&ev, t, 100) == EVENT_START, "wrap start", 5, 0);
+    check(event_update(&ev, t + 300, 0) == EVENT_NONE, "wrap min", 5, 1);
+    check(event_update(&ev, t + 500, 0) == EVENT_END && ev.duration_ms == 500, "wrap end", 5, 2);
+    check(event_update(&ev, t + 1499, 100) == EVENT_NONE && ev.suppressed == 1, "wrap cool-down", 5, 3);
+    check(event_update(&ev, t + 1500, 100) == EVENT_START, "wrap after cool-down", 5, 4);
+
+    // clamped parameters: n over m, m over EVENT_FRAMES_MAX
+    init(&ev, 50, 40, 0, 0, EVENT_MS_MAX + 1);
+    check(ev.params.m == EVENT_FRAMES_MAX && ev.params.n == EVENT_FRAMES_MAX && ev.params.cooldown_ms == EVENT_MS_MAX, "clamp", 6, 0);
+}
+
+// the debounce rules of event.h, times in 64 bit
+struct model_s {
+    int n, m;
+    uint64_t min_ms, hold_ms, cooldown_ms;
+    int window[EVENT_FRAMES_MAX]; // hits of the last frames counted, oldest first
+    int frames;
+    int active, cooling;
+    uint64_t start, last_hit, end;
+    uint32_t peak, suppressed;
+};
+
+typedef struct model_s model_t;
+
+static int model_update(model_t* md, uint64_t now, uint32_t score)
+{
+    int hit = score >= EVENT_SCORE_HIT;
+    if (md->cooling) {
+        if (now < md->end + md->cooldown_ms) {
+            md->suppressed += hit;
+            return EVENT_NONE;
+        }
+        md->cooling = 0;
+    }
+    if (md->active) {
+        if (hit) md->last_hit = now;
+        if (md->peak < score) md->peak = score;
+        if (hit || now < md->last_hit + md->hold_ms || now < md->start + md->min_ms) return EVENT_NONE;
+        md->active = 0;
+        md->end = now;
+        md->cooling = md->cooldown_ms > 0;
+        return EVENT_END;
+    }
+    if (md->frames == md->m) {
+        memmove(md->window, md->window + 1, (md->m - 1) * sizeof(int));
+        md->frames--;
+    }
+    md->window[md->frames++] = hit;
+    int cnt = 0;
+    for (int i = 0; i < md->frames; i++) cnt += md->window[i];
+    if (cnt < md->n) return EVENT_NONE;
+    md->frames = 0;
+    md->active = 1;
+    md->start = md->last_hit = now;
+    md->peak = score;
+    return EVENT_START;
+}
+
+static void test_model(void)
+{
+    for (int round = 0; round < 300 && !failed; round++) {
+        event_params_t params = {
+            .m = 1 + rnd() % EVENT_FRAMES_MAX,
+            .min_ms = rnd() % 4 ? rnd() % 3000 : 0,
+            .hold_ms = rnd() % 4 ? rnd() % 3000 : 0,
+            .cooldown_ms = rnd() % 3 ? rnd() % 5000 : 0,
+        };
+        params.n = 1 + rnd() % params.m;
+        event_t ev;
+        event_init(&ev, &params);
+        model_t md = {
+            .n = params.n, .m = params.m,
+            .min_ms = params.min_ms, .hold_ms = params.hold_ms, .cooldown_ms = params.cooldown_ms,
+        };
+        // the clock wraps somewhere in the first half of the round
+        uint32_t base = 0u - (rnd() % (FRAMES * 100));
+        uint64_t now = 0;
+        int hit_pct = 5 + rnd() % 90;
+        for (int i = 0; i < FRAMES && !failed; i++) {
+            now += rnd() % 4 ? 20 + rnd() % 180 : rnd() % 2000;
+            uint32_t score = (int) (rnd() % 100) < hit_pct ? EVENT_SCORE_HIT + rnd() % 400 : rnd() % EVENT_SCORE_HIT;
+            int want = model_update(&md, now, score);
+            int got = event_update(&ev, base + (uint32_t) now, score);
+            check(got == want, "model event", round, i);
+            check(ev.active == md.active && ev.suppressed == md.suppressed, "model state", round, i);
+            if (got == EVENT_END) check(ev.duration_ms == md.end - md.start && ev.peak == md.peak, "model end", round, i);
+        }
+    }
+}
+
+int main(void)
+{
+    test_cases();
+    test_model();
+    printf("%s: %d event checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
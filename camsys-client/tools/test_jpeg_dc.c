@@ -0,0 +1,279 @@
+// Host test of jpeg_dc.h: the DC thumbnail of the sample JPEGs in samples/ (see
+// make_samples.py) against the 1/8 scaled grayscale decode of libjpeg, which keeps
+// only the DC coefficient as well. The samples cover 4:4:4, 4:2:2, 4:2:0 with
+// partial MCUs, grayscale, restart intervals, optimized Huffman tables and a
+// progressive file (not supported).
+//
+// The decoder parses lengths and entropy data of untrusted frames, so every
+// truncation and many corruptions of the samples are fed to it as well: it must
+// return an error for a frame cut before its EOI and never read or write out of
+// bounds. Run it with sanitizers for the latter:
+//   make clean && make test CFLAGS="-O1 -g -fsanitize=address,undefined"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include "jpeg_dc.h"
+
+#define SAMPLES_DIR "samples/"
+#define THUMB_SIZE_MAX (256 * 256)
+#define CORRUPT_ROUNDS 3000
+
+struct sample_s {
+    const char* name;
+    int expect;  // of jpeg_dc_thumbnail()
+};
+
+typedef struct sample_s sample_t;
+
+static const sample_t samples[] = {
+    { "444.jpg", JPEG_DC_OK },
+    { "422.jpg", JPEG_DC_OK },
+    { "420.jpg", JPEG_DC_OK },
+    { "gray.jpg", JPEG_DC_OK },
+    { "rst_blocks.jpg", JPEG_DC_OK },
+    { "rst_rows.jpg", JPEG_DC_OK },
+    { "gray_rst.jpg", JPEG_DC_OK },
+    { "optimized.jpg", JPEG_DC_OK },
+    { "low_quality.jpg", JPEG_DC_OK },
+    { "vga422.jpg", JPEG_DC_OK },
+    { "progressive.jpg", JPEG_DC_ERR_FORMAT },
+};
+
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static int failed;
+static int checks;
+
+static uint8_t* load(const char* name, size_t* len)
+{
+    char path[256];
+    snprintf(path, sizeof(path), SAMPLES_DIR "%s", name);
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    uint8_t* buf = NULL;
+    if (!fseek(f, 0, SEEK_END)) {
+        long size = ftell(f);
+        if (size > 0 && !fseek(f, 0, SEEK_SET) && (buf = malloc(size))) {
+            if (fread(buf, 1, size, f) != (size_t) size) {
+                free(buf);
+                buf = NULL;
+            }
+            *len = size;
+        }
+    }
+    fclose(f);
+    return buf;
+}
+
+struct ref_error_s {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void ref_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((struct ref_error_s*) cinfo->err)->jump, 1);
+}
+
+// the 1/8 scaled grayscale decode of libjpeg, 0 if it fails
+static int ref_thumbnail(const uint8_t* jpg, size_t len, uint8_t* out, size_t size, int* width, int* height)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct ref_error_s err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = ref_error_exit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpg, len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 8;
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    if ((size_t) *width * *height > size) longjmp(err.jump, 1);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = out + (size_t) cinfo.output_scanline * *width;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return 1;
+}
+
+static uint8_t thumb[THUMB_SIZE_MAX];
+static uint8_t ref[THUMB_SIZE_MAX];
+
+static void check_reference(const sample_t* sample, const uint8_t* jpg, size_t len)
+{
+    jpeg_dc_info_t info;
+    int err = jpeg_dc_thumbnail(jpg, len, thumb, sizeof(thumb), &info);
+    checks++;
+    if (err != sample->expect) {
+        printf("FAIL %s: %s, expected %s\n", sample->name, jpeg_dc_strerror(err), jpeg_dc_strerror(sample->expect));
+        failed = 1;
+        return;
+    }
+    if (err != JPEG_DC_OK) return;
+    int width, height;
+    if (!ref_thumbnail(jpg, len, ref, sizeof(ref), &width, &height)) {
+        printf("FAIL %s: reference decode\n", sample->name);
+        failed = 1;
+        return;
+    }
+    checks++;
+    if (info.thumb_width != width || info.thumb_height != height) {
+        printf("FAIL %s: %ux%u, reference %dx%d\n", sample->name, info.thumb_width, info.thumb_height, width, height);
+        failed = 1;
+        return;
+    }
+    for (int i = 0; i < width * height; i++) {
+        if (thumb[i] != ref[i]) {
+            printf("FAIL %s: pixel %d,%d: %u != %u\n", sample->name, i % width, i / width, thumb[i], ref[i]);
+            failed = 1;
+            return;
+        }
+    }
+    // too small an output buffer
+    checks++;
+    if (jpeg_dc_thumbnail(jpg, len, thumb, (size_t) width * height - 1, &info) != JPEG_DC_ERR_SIZE) {
+        printf("FAIL %s: no size error\n", sample->name);
+        failed = 1;
+    }
+}
+
+static size_t find_eoi(const uint8_t* jpg, size_t len)
+{
+    for (size_t p = len - 2; p > 0; p--) if (jpg[p] == 0xFF && jpg[p + 1] == 0xD9) return p;
+    return 0;
+}
+
+// every length: an error before the EOI, the full thumbnail from there on
+static void check_truncated(const sample_t* sample, const uint8_t* jpg, size_t len)
+{
+    size_t eoi = find_eoi(jpg, len);
+    jpeg_dc_info_t info;
+    if (jpeg_dc_thumbnail(jpg, len, ref, sizeof(ref), &info) != JPEG_DC_OK) return;
+    size_t pixels = (size_t) info.thumb_width * info.thumb_height;
+    for (size_t cut = 0; cut <= len; cut++) {
+        // a copy of exactly cut bytes, so reads past it are caught
+        uint8_t* buf = malloc(cut ? cut : 1);
+        memcpy(buf, jpg, cut);
+        int err = jpeg_dc_thumbnail(buf, cut, thumb, sizeof(thumb), NULL);
+        free(buf);
+        checks++;
+        if (cut < eoi ? err == JPEG_DC_OK : err != JPEG_DC_OK || memcmp(thumb, ref, pixels)) {
+            printf("FAIL %s: cut at %zu of %zu (EOI at %zu): %s\n", sample->name, cut, len, eoi, jpeg_dc_strerror(err));
+            failed = 1;
+            return;
+        }
+    }
+}
+
+static void check_corrupt(const sample_t* sample, const uint8_t* jpg, size_t len)
+{
+    uint8_t* buf = malloc(len);
+    // every header byte (up to the entropy data) set to the values lengths break on
+    static const uint8_t values[] = { 0x00, 0x01, 0x02, 0x0F, 0x10, 0x7F, 0x80, 0xFE, 0xFF };
+    size_t header = 0;
+    for (size_t p = 2; p + 3 < len; p++) {
+        if (jpg[p] == 0xFF && jpg[p + 1] == 0xDA) {
+            header = p + 2 + (jpg[p + 2] << 8 | jpg[p + 3]);
+            break;
+        }
+    }
+    for (size_t p = 0; p < header; p++) {
+        for (size_t v = 0; v < sizeof(values); v++) {
+            memcpy(buf, jpg, len);
+            buf[p] = values[v];
+            int err = jpeg_dc_thumbnail(buf, len, thumb, sizeof(thumb), NULL);
+            checks++;
+            if (err > JPEG_DC_OK || err < JPEG_DC_ERR_SIZE) {
+                printf("FAIL %s: byte %zu = %02x: %d\n", sample->name, p, values[v], err);
+                failed = 1;
+            }
+        }
+    }
+    // random bytes anywhere, and random cuts of the result
+    for (int r = 0; r < CORRUPT_ROUNDS; r++) {
+        memcpy(buf, jpg, len);
+        int n = 1 + rnd() % 4;
+        for (int i = 0; i < n; i++) buf[rnd() % len] = rnd() & 1 ? rnd() : 0xFF;
+        size_t cut = r & 1 ? len : rnd() % len;
+        uint8_t* copy = malloc(cut ? cut : 1);
+        memcpy(copy, buf, cut);
+        int err = jpeg_dc_thumbnail(copy, cut, thumb, sizeof(thumb), NULL);
+        free(copy);
+        checks++;
+        if (err > JPEG_DC_OK || err < JPEG_DC_ERR_SIZE) {
+            printf("FAIL %s: corrupt round %d: %d\n", sample->name, r, err);
+            failed = 1;
+        }
+    }
+    free(buf);
+}
+
+// the codes of every Huffman table moved to a single length, most of them more
+// codes than the length has (the tables are built from these counts)
+static void check_huffman(const sample_t* sample, const uint8_t* jpg, size_t len)
+{
+    uint8_t* buf = malloc(len);
+    for (size_t p = 2; p + 4 <= len && !(jpg[p] == 0xFF && jpg[p + 1] == 0xDA); ) {
+        size_t seg = jpg[p + 2] << 8 | jpg[p + 3];
+        if (jpg[p + 1] == 0xC4) {
+            for (size_t t = p + 4; t + 17 <= p + 2 + seg; ) {
+                int count = 0;
+                for (int i = 0; i < 16; i++) count += jpg[t + 1 + i];
+                for (int l = 1; l <= 16 && count <= 255; l++) {
+                    memcpy(buf, jpg, len);
+                    memset(buf + t + 1, 0, 16);
+                    buf[t + 1 + l - 1] = count;
+                    int err = jpeg_dc_thumbnail(buf, len, thumb, sizeof(thumb), NULL);
+                    checks++;
+                    if ((sample->expect == JPEG_DC_OK && count > (1 << l) && err != JPEG_DC_ERR_DATA) || err > JPEG_DC_OK || err < JPEG_DC_ERR_SIZE) {
+                        printf("FAIL %s: table at %zu, %d codes of length %d: %s\n", sample->name, t, count, l, jpeg_dc_strerror(err));
+                        failed = 1;
+                    }
+                }
+                t += 17 + count;
+            }
+        }
+        p += 2 + seg;
+    }
+    free(buf);
+}
+
+int main(void)
+{
+    for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        size_t len;
+        uint8_t* jpg = load(samples[s].name, &len);
+        if (!jpg) {
+            printf("FAIL %s: cannot read " SAMPLES_DIR "%s\n", samples[s].name, samples[s].name);
+            failed = 1;
+            continue;
+        }
+        check_reference(&samples[s], jpg, len);
+        check_truncated(&samples[s], jpg, len);
+        check_corrupt(&samples[s], jpg, len);
+        check_huffman(&samples[s], jpg, len);
+        free(jpg);
+    }
+    printf("%s: %d jpeg_dc checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
@@ -0,0 +1,145 @@
+// Host test of the seek index of record.h after a clock step back: record_recover()
+// on unsynced segments whose timestamps jump back must index every frame that
+// starts a new run and otherwise keep the interval, and record_index_search() on
+// index files of several runs against a brute force search (the latest entry at or
+// before the time, the later one on a tie, as the index cache of the device).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "record.h"
+
+#define FRAMES_MAX 400
+#define ENTRIES_MAX 300
+#define SCAN_BUF_SIZE 256 // small, so frames span several reads
+
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static int failed;
+static int checks;
+
+static void check(int ok, const char* what, int round, long n)
+{
+    checks++;
+    if (!ok && !failed) {
+        printf("FAIL %s: round %d, %ld\n", what, round, n);
+        failed = 1;
+    }
+}
+
+// rising by up to 300 ms a frame, jumping back now and then
+static void timestamps(uint64_t* ts, int cnt)
+{
+    uint64_t t = 1600000000000ULL + rnd() % 100000;
+    for (int i = 0; i < cnt; i++) {
+        if (i && !(rnd() % 40)) t -= rnd() % 2 ? 1 + rnd() % 500 : 1 + rnd() % 3600000;
+        else if (i) t += rnd() % 300;
+        ts[i] = t;
+    }
+}
+
+static void test_recover(void)
+{
+    static uint64_t ts[FRAMES_MAX];
+    static long offsets[FRAMES_MAX];
+    static uint8_t payload[64];
+    static uint8_t buf[SCAN_BUF_SIZE];
+    for (int round = 0; round < 200 && !failed; round++) {
+        int cnt = 1 + rnd() % FRAMES_MAX;
+        uint32_t interval = 1 + rnd() % 2000;
+        timestamps(ts, cnt);
+        FILE* vid = tmpfile();
+        FILE* idx = tmpfile();
+        if (!vid || !idx) {
+            printf("FAIL tmpfile\n");
+            failed = 1;
+            return;
+        }
+        // left open: data_len 0, no index
+        int err = record_write_file_header(vid, RECORD_FILE_HEADER_SIZE);
+        for (int i = 0; i < cnt && err == RECORD_OK; i++) {
+            record_frame_header_t hdr = { .len = 1 + rnd() % sizeof(payload), .timestamp = ts[i], .format = 0 };
+            for (uint32_t k = 0; k < hdr.len; k++) payload[k] = rnd();
+            offsets[i] = ftell(vid);
+            err = record_write_frame(vid, &hdr, payload);
+        }
+        record_recover_t rec;
+        if (err == RECORD_OK) err = record_recover(vid, idx, interval, buf, sizeof(buf), &rec);
+        long count = 0;
+        if (err == RECORD_OK) err = record_read_index_header(idx, &count);
+        check(err == RECORD_OK && rec.frames == (uint32_t) cnt, "recover", round, err);
+
+        // the entries the device would have written
+        long n = 0;
+        uint64_t last = 0;
+        for (int i = 0; i < cnt && !failed; i++) {
+            if (i && ts[i] >= last && ts[i] - last < interval) continue;
+            last = ts[i];
+            record_index_entry_t entry;
+            check(n < count && RECORD_OK == record_read_index_entry(idx, n, &entry), "recover entry count", round, n);
+            if (failed) break;
+            check(entry.timestamp == ts[i] && entry.offset == (uint32_t) offsets[i] && entry.frame == (uint32_t) i,
+                "recover entry", round, n);
+            n++;
+        }
+        check(n == count, "recover entry count", round, count);
+        fclose(vid);
+        fclose(idx);
+    }
+}
+
+static long brute(const record_index_entry_t* entries, long cnt, uint64_t timestamp)
+{
+    long best = -1;
+    for (long i = 0; i < cnt; i++) {
+        if (entries[i].timestamp <= timestamp && (best < 0 || entries[i].timestamp >= entries[best].timestamp)) best = i;
+    }
+    return best;
+}
+
+static void test_search(void)
+{
+    static uint64_t ts[ENTRIES_MAX];
+    static record_index_entry_t entries[ENTRIES_MAX];
+    for (int round = 0; round < 300 && !failed; round++) {
+        long cnt = rnd() % ENTRIES_MAX;
+        timestamps(ts, cnt);
+        // some ties, within and between runs
+        for (long i = 1; i < cnt; i++) if (!(rnd() % 10)) ts[i] = ts[rnd() % i];
+        FILE* idx = tmpfile();
+        int err = idx ? record_write_index_header(idx) : RECORD_ERR_IO;
+        for (long i = 0; i < cnt && err == RECORD_OK; i++) {
+            record_index_entry_t entry = { ts[i], (uint32_t) i * 100, (uint32_t) i };
+            entries[i] = entry;
+            err = record_write_index_entries(idx, &entry, 1);
+        }
+        check(err == RECORD_OK, "search setup", round, err);
+        if (failed) break;
+        for (int q = 0; q < 200 && !failed; q++) {
+            uint64_t at = cnt && q % 3 ? ts[rnd() % cnt] + (int) (rnd() % 3) - 1 : (cnt ? ts[0] : 1600000000000ULL) - 5000 + rnd() % 10000;
+            if (q == 0) at = 0;
+            if (q == 1) at = UINT64_MAX;
+            long want = brute(entries, cnt, at);
+            record_index_entry_t entry;
+            long got = record_index_search(idx, cnt, at, &entry);
+            check(want >= 0 ? got == want && entry.frame == (uint32_t) want : got == RECORD_ERR_EOF, "search", round, q);
+        }
+        fclose(idx);
+    }
+}
+
+int main(void)
+{
+    test_recover();
+    test_search();
+    printf("%s: %d record checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
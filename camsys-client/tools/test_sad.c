@@ -0,0 +1,110 @@
+// Host test of sad.h: sad_u8() and sad_u8_floor() against their _ref versions,
+// over lengths across the word lane flush (SAD_SWAR_FLUSH_WORDS), every pair of
+// buffer alignments and the whole range of floors. The data is random, and all
+// 0 against all 255 for the largest lane sums.
+
+#include <stdio.h>
+#include <string.h>
+#include "sad.h"
+
+#define LEN_MAX (96 * 96)
+#define LEN_DENSE 1100 // every length up to this, then a few up to LEN_MAX
+
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint8_t mem_a[LEN_MAX + 8] __attribute__((aligned(4)));
+static uint8_t mem_b[LEN_MAX + 8] __attribute__((aligned(4)));
+
+static int failed;
+static int checks;
+
+static void check(const uint8_t* a, const uint8_t* b, size_t n, int floor, const char* what)
+{
+    uint32_t got, want;
+    if (floor < 0) {
+        got = sad_u8(a, b, n);
+        want = sad_u8_ref(a, b, n);
+    } else {
+        got = sad_u8_floor(a, b, n, floor);
+        want = sad_u8_floor_ref(a, b, n, floor);
+    }
+    checks++;
+    if (got != want) {
+        printf("FAIL %s: n %zu, align %u/%u, floor %d: %u != %u\n", what, n,
+            (unsigned) ((uintptr_t) a & 3), (unsigned) ((uintptr_t) b & 3), floor, got, want);
+        failed = 1;
+    }
+}
+
+static void check_all(size_t n, const char* what)
+{
+    static const int floors[] = { -1, 0, 1, 2, 7, 16, 100, 127, 128, 254, 255 };
+    for (unsigned aa = 0; aa < 4; aa++) {
+        for (unsigned ab = 0; ab < 4; ab++) {
+            for (size_t f = 0; f < sizeof(floors) / sizeof(floors[0]); f++) {
+                check(mem_a + aa, mem_b + ab, n, floors[f], what);
+            }
+        }
+    }
+}
+
+static void fill_random(int spread)
+{
+    for (size_t i = 0; i < sizeof(mem_a); i++) {
+        mem_a[i] = rnd();
+        // small differences around the floors as well as any
+        mem_b[i] = spread ? (uint8_t) rnd() : (uint8_t) (mem_a[i] + (int) (rnd() % 33) - 16);
+    }
+}
+
+int main(void)
+{
+    for (size_t n = 0; n <= LEN_DENSE && !failed; n++) {
+        fill_random(n & 1);
+        check_all(n, "random");
+    }
+    for (size_t n = LEN_DENSE; n <= LEN_MAX && !failed; n += 1 + rnd() % 509) {
+        fill_random(n & 1);
+        check_all(n, "random");
+    }
+
+    // the largest sums: every lane takes 255 per pixel
+    for (int v = 0; v < 2 && !failed; v++) {
+        memset(mem_a, v ? 0xFF : 0x00, sizeof(mem_a));
+        memset(mem_b, v ? 0x00 : 0xFF, sizeof(mem_b));
+        for (size_t n = 508; n <= 1028; n++) check_all(n, "0/255");
+        check_all(LEN_MAX, "0/255");
+    }
+
+    // every floor on every difference
+    for (int d = 0; d < 256 && !failed; d++) {
+        memset(mem_a, d, sizeof(mem_a));
+        memset(mem_b, 0, sizeof(mem_b));
+        for (int floor = 0; floor < 256; floor++) {
+            check(mem_a, mem_b, 67, floor, "difference");
+            check(mem_b + 1, mem_a + 1, 67, floor, "difference");
+        }
+    }
+
+    // the word kernels on their own (aligned, any length)
+    fill_random(1);
+    for (size_t n = 0; n <= 2100 && !failed; n++) {
+        checks += 2;
+        if (sad_u8_swar(mem_a, mem_b, n) != sad_u8_ref(mem_a, mem_b, n) ||
+            sad_u8_floor_swar(mem_a, mem_b, n, n & 255) != sad_u8_floor_ref(mem_a, mem_b, n, n & 255)) {
+            printf("FAIL swar: n %zu\n", n);
+            failed = 1;
+        }
+    }
+
+    printf("%s: %d sad checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
@@ -0,0 +1,205 @@
+// Host test of sat.h: sat_rect() against brute force summation of the clamped
+// differences, on random images of every small size and floor, on a full scale
+// image just under SAT_PIXELS_MAX (the largest sums the 32 bit entries hold),
+// and zone_set_eval_sat() against zone_set_eval() on random zones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sat.h"
+#include "zone.h"
+
+// 4103 x 4105 = 16842815 pixels, one more row is past SAT_PIXELS_MAX = 16843009
+#define FULL_WIDTH 4103
+#define FULL_HEIGHT 4105
+#define FULL_RECTS 24
+
+static uint32_t rnd_state = 88172645u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static int failed;
+static int checks;
+
+static uint64_t brute(const uint8_t* cur, const uint8_t* prev, int width, int x, int y, int w, int h, uint8_t floor)
+{
+    uint64_t sum = 0;
+    for (int r = y; r < y + h; r++) {
+        for (int c = x; c < x + w; c++) {
+            int d = cur[(size_t) r * width + c] - prev[(size_t) r * width + c];
+            d = (d < 0 ? -d : d) - floor;
+            sum += d > 0 ? d : 0;
+        }
+    }
+    return sum;
+}
+
+static void check_rect(const sat_t* sat, const uint8_t* cur, const uint8_t* prev, int x, int y, int w, int h, const char* what)
+{
+    uint64_t want = brute(cur, prev, sat->width, x, y, w, h, sat->floor);
+    uint32_t got = sat_rect(sat, x, y, w, h);
+    checks++;
+    if (got != want) {
+        printf("FAIL %s: %dx%d floor %u, rect %d,%d %dx%d: %u != %llu\n", what, sat->width, sat->height,
+            sat->floor, x, y, w, h, got, (unsigned long long) want);
+        failed = 1;
+    }
+}
+
+static void test_small(void)
+{
+    static uint8_t cur[40 * 40], prev[40 * 40];
+    static uint32_t table[SAT_TABLE_SIZE(40, 40)];
+    sat_t sat;
+    sat_init(&sat, table, SAT_TABLE_SIZE(40, 40));
+    for (int width = 1; width <= 40 && !failed; width += 1 + (width > 12) * 3) {
+        for (int height = 1; height <= 40 && !failed; height += 1 + (height > 12) * 3) {
+            for (int i = 0; i < width * height; i++) {
+                cur[i] = rnd();
+                prev[i] = width & 1 ? (uint8_t) rnd() : (uint8_t) (cur[i] + (int) (rnd() % 41) - 20);
+            }
+            uint8_t floor = (width * 7 + height * 13) % 3 ? rnd() % 24 : rnd();
+            if (!sat_build(&sat, cur, prev, width, height, floor)) {
+                printf("FAIL build %dx%d\n", width, height);
+                failed = 1;
+                return;
+            }
+            // every rectangle of the small ones, random ones of the others
+            if (width * height <= 64) {
+                for (int y = 0; y <= height; y++) for (int x = 0; x <= width; x++)
+                    for (int h = 0; y + h <= height; h++) for (int w = 0; x + w <= width; w++)
+                        check_rect(&sat, cur, prev, x, y, w, h, "small");
+            } else {
+                for (int i = 0; i < 300; i++) {
+                    int x = rnd() % (width + 1), y = rnd() % (height + 1);
+                    check_rect(&sat, cur, prev, x, y, rnd() % (width - x + 1), rnd() % (height - y + 1), "small");
+                }
+                check_rect(&sat, cur, prev, 0, 0, width, height, "small");
+            }
+        }
+    }
+}
+
+static void test_build_limits(void)
+{
+    static uint8_t img[16 * 16];
+    static uint32_t table[SAT_TABLE_SIZE(16, 16)];
+    sat_t sat;
+    sat_init(&sat, table, SAT_TABLE_SIZE(16, 16));
+    checks += 5;
+    if (sat_build(&sat, img, img, 0, 16, 0) || sat_build(&sat, img, img, 16, 0, 0) ||
+        sat_build(&sat, img, img, 17, 16, 0) || sat_build(&sat, img, img, 16, 17, 0) ||
+        !sat_build(&sat, img, img, 16, 16, 0)) {
+        printf("FAIL build limits\n");
+        failed = 1;
+    }
+    // the pixel limit holds with a table large enough
+    sat_init(&sat, table, (size_t) -1);
+    checks++;
+    if (sat_build(&sat, img, img, FULL_WIDTH, FULL_HEIGHT + 1, 0)) {
+        printf("FAIL build past SAT_PIXELS_MAX\n");
+        failed = 1;
+    }
+}
+
+static void test_full_scale(void)
+{
+    size_t pixels = (size_t) FULL_WIDTH * FULL_HEIGHT;
+    uint8_t* cur = malloc(pixels);
+    uint8_t* prev = malloc(pixels);
+    uint32_t* table = malloc(SAT_TABLE_SIZE(FULL_WIDTH, FULL_HEIGHT) * sizeof(uint32_t));
+    if (!cur || !prev || !table) {
+        printf("FAIL full scale: no memory\n");
+        failed = 1;
+        goto out;
+    }
+    sat_t sat;
+    sat_init(&sat, table, SAT_TABLE_SIZE(FULL_WIDTH, FULL_HEIGHT));
+    for (int v = 0; v < 3 && !failed; v++) {
+        // 255 everywhere (the image sums to 4294917825), then random with and without floor
+        for (size_t i = 0; i < pixels; i++) {
+            cur[i] = v ? rnd() : 255;
+            prev[i] = v ? (uint8_t) rnd() : 0;
+        }
+        if (!sat_build(&sat, cur, prev, FULL_WIDTH, FULL_HEIGHT, v == 2 ? 30 : 0)) {
+            printf("FAIL build full scale\n");
+            failed = 1;
+            break;
+        }
+        check_rect(&sat, cur, prev, 0, 0, FULL_WIDTH, FULL_HEIGHT, "full scale");
+        check_rect(&sat, cur, prev, 1, 1, FULL_WIDTH - 1, FULL_HEIGHT - 1, "full scale");
+        check_rect(&sat, cur, prev, FULL_WIDTH - 1, FULL_HEIGHT - 1, 1, 1, "full scale");
+        for (int i = 0; i < FULL_RECTS; i++) {
+            int x = rnd() % FULL_WIDTH, y = rnd() % FULL_HEIGHT;
+            check_rect(&sat, cur, prev, x, y, 1 + rnd() % (FULL_WIDTH - x), 1 + rnd() % (FULL_HEIGHT - y), "full scale");
+        }
+    }
+out:
+    free(cur);
+    free(prev);
+    free(table);
+}
+
+static void test_zones(void)
+{
+    static uint8_t cur[96 * 96], prev[96 * 96];
+    static uint32_t tables[ZONE_MAX][SAT_TABLE_SIZE(96, 96)];
+    static zone_set_t set;
+    for (int round = 0; round < 200 && !failed; round++) {
+        zone_set_init(&set);
+        int count = 1 + rnd() % ZONE_MAX;
+        for (int z = 0; z < count; z++) {
+            char def[ZONE_DEF_SIZE];
+            int x = rnd() % 90, y = rnd() % 90;
+            if (z & 1) {
+                snprintf(def, sizeof(def), "name=z%d threshold=1 sensitivity=%u ignore=%d mask=4x4:%04x", z,
+                    rnd() % 40, z == 3, (unsigned) (rnd() & 0xFFFF));
+            } else {
+                snprintf(def, sizeof(def), "name=z%d threshold=1 sensitivity=%u poly=%d,%d;%u,%d;%u,%u", z,
+                    rnd() % 40, x, y, x + 6 + rnd() % 60, y, x + rnd() % 60, y + 6 + rnd() % 60);
+            }
+            zone_t zone;
+            if (ZONE_OK != zone_parse(def, &zone) || ZONE_OK != zone_set_put(&set, &zone)) {
+                printf("FAIL zone %s\n", def);
+                failed = 1;
+                return;
+            }
+        }
+        if (ZONE_OK != zone_set_compile(&set, 96, 96)) continue;
+        for (int i = 0; i < 96 * 96; i++) {
+            cur[i] = rnd();
+            prev[i] = cur[i] + (int) (rnd() % 61) - 30;
+        }
+        sat_t sats[ZONE_MAX];
+        const sat_t* ptrs[ZONE_MAX];
+        for (int z = 0; z < set.count; z++) {
+            sat_init(&sats[z], tables[z], SAT_TABLE_SIZE(96, 96));
+            sat_build(&sats[z], cur, prev, 96, 96, set.zones[z].sensitivity);
+            ptrs[z] = round & 1 && z & 1 ? NULL : &sats[z]; // some zones summed directly
+        }
+        uint32_t want[ZONE_MAX], got[ZONE_MAX];
+        zone_set_eval(&set, cur, prev, want);
+        zone_set_eval_sat(&set, ptrs, cur, prev, got);
+        for (int z = 0; z < set.count; z++, checks++) {
+            if (got[z] != want[z]) {
+                printf("FAIL zones: round %d, zone %d: %u != %u\n", round, z, got[z], want[z]);
+                failed = 1;
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    test_small();
+    test_build_limits();
+    test_zones();
+    if (!failed) test_full_scale();
+    printf("%s: %d sat checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
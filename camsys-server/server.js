@@ -9,6 +9,7 @@ const SerialPort = require('serialport')
 const Readline = require('@serialport/parser-readline')
 
 const os = require('os');
+const { shell } = require('electron');
 
 
 // ----------------------- Storage ------------------------------
@@ -227,7 +228,7 @@ class ReplayPage {
     
     var secret = deviceSettings.secret;
     var ts = timestamp.now();
-    var uri = `http://${device.ws.ip4}/replay?secret=${secret}&ts=${ts}`;
+    var uri = `http://${device.ws.ip4}:81/replay?secret=${secret}&ts=${ts}`;
 
     var html = `
       <form name="device-replay-form">
@@ -249,6 +250,16 @@ class ReplayPage {
           <input type="button" value="<" onclick="replayPage.onRewindClick('${cid}')">
           <input type="button" value=">" onclick="replayPage.onForwardClick('${cid}')">
           <br>
+          <input name="seek-time" type="datetime-local" step="1">
+          <input type="button" value="Seek" onclick="replayPage.onSeekClick('${cid}')">
+          <input type="button" value="Download" onclick="replayPage.onDownloadClick('${cid}')">
+          <select name="speed" onchange="replayPage.onSpeedChange('${cid}')">
+            <option value="0.5">0.5x</option>
+            <option value="1" selected>1x</option>
+            <option value="2">2x</option>
+            <option value="8">8x</option>
+          </select>
+          <br>
           <input type="button" value="Stop" onclick="replayPage.onStopClick('${cid}')">
           <input type="button" value="Delete" onclick="replayPage.onDeleteClick('${cid}')">
           <input type="button" value="Back.." onclick="replayPage.onBackClick('${cid}')">
@@ -280,6 +291,33 @@ class ReplayPage {
     device.ws.send(`!INDEX ${pos}\0`);
   }
 
+  onSpeedChange(cid) {
+    var device = deviceList.devices[cid];
+    var speed = $('select[name="speed"]').val();
+    var time = new Date($('input[name="seek-time"]').val()).getTime();
+    var from = isNaN(time) ? '' : `&from=${time}`;
+    var uri = `http://${device.ws.ip4}:81/replay?secret=${deviceSettings.secret}&ts=${timestamp.now()}&speed=${speed}${from}`;
+    // the device serves one stream at a time, stop the running one first
+    device.ws.send('!STREAM STOP\0');
+    $('form[name="device-replay-form"] img.stream').attr('src', uri);
+  }
+
+  onSeekClick(cid) {
+    var time = new Date($('input[name="seek-time"]').val()).getTime();
+    if (isNaN(time)) return;
+
+    var device = deviceList.devices[cid];
+    device.ws.send(`!SEEK ${time}\0`);
+  }
+
+  onDownloadClick(cid) {
+    var device = deviceList.devices[cid];
+    var time = new Date($('input[name="seek-time"]').val()).getTime();
+    var from = isNaN(time) ? '' : `&from=${time}`;
+    var uri = `http://${device.ws.ip4}/download?secret=${deviceSettings.secret}${from}`;
+    shell.openExternal(uri);
+  }
+
   showReplayForm(cid) {
     deviceList.devices[cid].ws.send("?INDEX\0");
   }
@@ -305,6 +343,47 @@ class ReplayPage {
 
 const replayPage = new ReplayPage();
 
+// ----------------- Heatmap -----------------
+
+// Activity grid of a device, sent as binary messages (see heatmap.h of the client):
+// 'H', flags, cols, rows, then all the cells (keyframe) or a count and (index, value) pairs
+
+class Heatmap {
+
+  // returns the grid with the message applied, null if a delta has nothing to apply to
+  static apply(heatmap, data) {
+    if (data.length < 4 || data[0] != 0x48) return null;
+    var cols = data[2];
+    var rows = data[3];
+    if (data[1] & 0x01) {
+      if (data.length < 4 + cols * rows) return null;
+      return { cols: cols, rows: rows, cells: Uint8Array.from(data.slice(4, 4 + cols * rows)) };
+    }
+    if (!heatmap || heatmap.cols != cols || heatmap.rows != rows) return null;
+    var count = data[4];
+    for (var i = 0; i < count && 6 + 2 * i < data.length; i++) {
+      var index = data[5 + 2 * i];
+      if (index < heatmap.cells.length) heatmap.cells[index] = data[6 + 2 * i];
+    }
+    return heatmap;
+  }
+
+  // a red cell per grid cell, more opaque on more activity (mean difference 20 is the max)
+  static draw(canvas, heatmap) {
+    if (!canvas || !heatmap) return;
+    canvas.width = heatmap.cols;
+    canvas.height = heatmap.rows;
+    var ctx = canvas.getContext('2d');
+    var image = ctx.createImageData(heatmap.cols, heatmap.rows);
+    for (var i = 0; i < heatmap.cells.length; i++) {
+      image.data[i * 4] = 255;
+      image.data[i * 4 + 3] = Math.min(160, heatmap.cells[i] * 8);
+    }
+    ctx.putImageData(image, 0, 0);
+  }
+
+}
+
 // ----------------- DeviceView -----------------
 
 class DeviceView {
@@ -333,11 +412,25 @@ class DeviceView {
     return wstyle;
   }
 
+  // debounce of the motion events of the device (n of m frames, min/hold/cool-down)
+  getEventHtml(device) {
+    var cid = device.ws.cid;
+    var ev = device.updates.event || { n: 1, m: 1, min_ms: 0, hold_ms: 0, cooldown_ms: 0 };
+    return `
+          event <input name="event_n" type="number" min="1" max="32" value="${ev.n}">
+          of <input name="event_m" type="number" min="1" max="32" value="${ev.m}"> frames,
+          min (ms) <input name="event_min" type="number" min="0" max="600000" value="${ev.min_ms}">
+          hold (ms) <input name="event_hold" type="number" min="0" max="600000" value="${ev.hold_ms}">
+          cool-down (ms) <input name="event_cooldown" type="number" min="0" max="600000" value="${ev.cooldown_ms}">
+          <input type="button" value="Apply event" onclick="deviceView.onEventClick('${cid}')">
+    `;
+  }
+
   getDeviceMotionHtml(device) {
     var cid = device.ws.cid;
     var secret = deviceSettings.secret;
     var ts = timestamp.now();
-    var uri = `http://${device.ws.ip4}/stream?secret=${secret}&ts=${ts}`;
+    var uri = `http://${device.ws.ip4}:81/stream?secret=${secret}&ts=${ts}`;
     var wstyle = this.getWStyle(device);
     this.device = device;
     var html = `
@@ -350,6 +443,7 @@ class DeviceView {
             ${device.alert ? 'alert' : ''}">
           <div class="frame" onclick="deviceView.onMotionStreamClick('${cid}', this, event)">
             <img class="stream" src="${uri}">
+            <canvas class="heatmap"></canvas>
             <div class="watcher" style="${wstyle}"></div>
           </div>
           <div class="clear"></div>
@@ -361,6 +455,15 @@ class DeviceView {
           <div class="slider threshold"></div>
           value (<span class="motion-value">?</span>)
           <div class="slider value"></div>
+          method <select name="method" onchange="deviceView.onDetectChange('${cid}')">
+            <option value="diff" ${device.updates.watcher.method == 'bg' ? '' : 'selected'}>frame difference</option>
+            <option value="bg" ${device.updates.watcher.method == 'bg' ? 'selected' : ''}>background model</option>
+          </select>
+          foreground pixels <input name="pixels" type="number" min="1" max="6400" value="${device.updates.watcher.pixels}" onchange="deviceView.onDetectChange('${cid}')">
+          (<span class="motion-fg">?</span>)
+          heat map (ms) <input name="heatmap" type="number" min="0" max="10000" value="${device.updates.heatmap ? device.updates.heatmap.ms : 0}" onchange="deviceView.onHeatmapChange('${cid}')">
+          <br>
+          ${this.getEventHtml(device)}
         </div>
 
         <br class="clear">
@@ -381,7 +484,7 @@ class DeviceView {
     var cid = device.ws.cid;
     var secret = deviceSettings.secret;
     var ts = timestamp.now();
-    var uri = `http://${device.ws.ip4}/stream?secret=${secret}&ts=${ts}`;
+    var uri = `http://${device.ws.ip4}:81/stream?secret=${secret}&ts=${ts}`;
     var html = `
       <form name="device-view-form">
         <input type="hidden" name="cid" value="${cid}">
@@ -390,12 +493,28 @@ class DeviceView {
 
         <div class="device ${device.updates.mode}">
           <div class="frame center">
-            <img class="stream" src="${uri}">
+            <span class="stream-box">
+              <img class="stream" src="${uri}">
+              <canvas class="heatmap"></canvas>
+            </span>
           </div>
         </div>
 
         <br class="clear">
         <div class="center">
+          <select name="framesize">
+            ${['QQVGA', 'QVGA', 'CIF', 'VGA', 'SVGA', 'XGA', 'HD', 'SXGA', 'UXGA'].map((name) =>
+              `<option value="${name}" ${device.updates.camera.framesize == name ? 'selected' : ''}>${name}</option>`).join('')}
+          </select>
+          quality <input name="quality" type="number" min="4" max="63" value="${device.updates.camera.quality}">
+          fps <input name="fps" type="number" min="0" max="30" value="${device.updates.camera.fps}">
+          max. latency (ms) <input name="abr" type="number" min="0" max="5000" value="${device.updates.camera.abr.target_ms}">
+          motion check (ms) <input name="motion" type="number" min="0" max="10000" value="${device.updates.camera.motion_ms}">
+          <input type="button" value="Apply" onclick="deviceView.onConfigClick('${cid}')">
+          heat map (ms) <input name="heatmap" type="number" min="0" max="10000" value="${device.updates.heatmap ? device.updates.heatmap.ms : 0}" onchange="deviceView.onHeatmapChange('${cid}')">
+          <br>
+          ${this.getEventHtml(device)}
+          <br>
           <input type="button" value="Stop stream" onclick="deviceView.onStreamStopClick('${cid}')">
           <input type="button" value="Reset device" onclick="deviceView.onResetClick('${cid}')">
           
@@ -429,6 +548,7 @@ class DeviceView {
       var html = this.getDeviceHtml(device);
       var cid = device.ws.cid;
       $('.page.device-view').html(html);
+      Heatmap.draw($('.page.device-view canvas.heatmap')[0], device.heatmap);
       if (device.updates && device.updates.mode == 'motion') {
         $('.page.device-view .slider.size').slider({min: 1, max: 20, value: device.updates.watcher.size, change: (event, ui) => { deviceView.onSizeSliderChange(cid, event, ui); }});
         $('.page.device-view .slider.raster').slider({min: 1, max: 20, value: device.updates.watcher.raster, change: (event, ui) => { deviceView.onRasterSliderChange(cid, event, ui); }});
@@ -487,6 +607,16 @@ class DeviceView {
     this.showUpdatedWatcher(cid);
   }
 
+  onConfigClick(cid) {
+    var $form = $('form[name="device-view-form"]');
+    var framesize = $form.find('select[name="framesize"]').val();
+    var quality = parseInt($form.find('input[name="quality"]').val());
+    var fps = parseInt($form.find('input[name="fps"]').val());
+    var abr = parseInt($form.find('input[name="abr"]').val());
+    var motion = parseInt($form.find('input[name="motion"]').val());
+    deviceList.devices[cid].ws.send(`!CONFIG framesize=${framesize} quality=${quality} fps=${fps} abr=${abr} motion=${motion}\0`);
+  }
+
   onStreamStopClick(cid) {
     deviceList.devices[cid].ws.send('!STREAM STOP\0', () => {
       pages.show('device-list');
@@ -519,11 +649,40 @@ class DeviceView {
     if (deviceList.devices[cid] && deviceList.devices[cid].ws.cid === ws.cid) {
       $('.page.device-view .motion-value').html(updates.watcher.diff_sum_max);
       $('.page.device-view .slider.value').slider( "option", "value", updates.watcher.diff_sum_max);
+      $('.page.device-view .motion-fg').html(updates.watcher.fg_max);
     }
   }
 
+  onDeviceHeatmap(ws, heatmap) {
+    if ($('form[name="device-view-form"] input[name="cid"]').val() !== ws.cid) return;
+    Heatmap.draw($('.page.device-view canvas.heatmap')[0], heatmap);
+  }
+
+  onHeatmapChange(cid) {
+    var ms = parseInt($('form[name="device-view-form"] input[name="heatmap"]').val());
+    deviceList.devices[cid].ws.send(`!HEATMAP ms=${ms}\0`);
+  }
+
+  onEventClick(cid) {
+    var $form = $('form[name="device-view-form"]');
+    var n = parseInt($form.find('input[name="event_n"]').val());
+    var m = parseInt($form.find('input[name="event_m"]').val());
+    var min = parseInt($form.find('input[name="event_min"]').val());
+    var hold = parseInt($form.find('input[name="event_hold"]').val());
+    var cooldown = parseInt($form.find('input[name="event_cooldown"]').val());
+    deviceList.devices[cid].ws.send(`!EVENT n=${n} m=${m} min=${min} hold=${hold} cooldown=${cooldown}\0`);
+  }
+
+  onDetectChange(cid) {
+    var $form = $('form[name="device-view-form"]');
+    var method = $form.find('select[name="method"]').val();
+    var pixels = parseInt($form.find('input[name="pixels"]').val());
+    deviceList.devices[cid].ws.send(`!DETECT method=${method} pixels=${pixels}\0`);
+  }
+
   onAlertClick(cid) {
     deviceList.devices[cid].alert = true;
+    system.manual = true;
     system.onDeviceAlert(cid, {});
     pages.show('device-list');
   }
@@ -583,6 +742,10 @@ class DeviceList {
                 (device.updates && device.updates.camera.recording) ? 
                   'red' : '')}"></span>
           <span class="name" onclick="deviceList.onDeviceNameClick('${device.ws.cid}')">${device.name}</span>
+          ${(device.alert && device.alertZones && device.alertZones.length ? 
+              `<span class="zones">(${device.alertZones.join(', ')})</span>` : '')}
+          ${(device.alert && device.event && !device.event.active ?
+              `<span class="zones">peak ${device.event.peak}%, ${(device.event.duration_ms / 1000).toFixed(1)} s</span>` : '')}
         </div>
         <div class="title hidden">Device '${device.name}' from IP:${device.ws.ip4} has mode '${mode}' and now is ${(device.connected ? 'connected' : 'disconnected')}</div>
       </div>`;
@@ -622,6 +785,8 @@ class DeviceList {
       connected: true,
     }
     this.showDeviceListHtml();
+    // the device has no clock of its own, its recordings are stamped with this time
+    ws.send(`!TIME ${Date.now()}\0`);
     ws.send("?UPDATE\0");
   }
 
@@ -647,6 +812,16 @@ class DeviceList {
     this.showDeviceListHtml();
   }
 
+  // the grid is kept, a view shows the latest one right away
+  onDeviceHeatmap(ws, data) {
+    var device = this.devices[ws.cid];
+    if (!device) return;
+    var heatmap = Heatmap.apply(device.heatmap, data);
+    if (!heatmap) return;
+    device.heatmap = heatmap;
+    if (pages.is('device-view')) deviceView.onDeviceHeatmap(ws, heatmap);
+  }
+
   onDeviceDisconnect(ws) {
     this.devices[ws.cid].ws = ws;
     this.devices[ws.cid].connected = false;
@@ -691,13 +866,34 @@ class System {
   
   constructor() {
     this.alert = false;
+    this.manual = false; // raised by hand, not by a motion event
   }
   
   onDeviceAlert(ws, message) {
     var cid = ws.cid;
+    // the watch window ("watch") and the zones that saw motion
+    if (cid && deviceList.devices[cid] && message.zones) {
+      deviceList.devices[cid].alertZones = message.zones;
+      deviceList.devices[cid].event = { active: true, peak: message.score };
+    }
     this.alertStart(cid);
   }
 
+  // the motion event of the device is over: the cameras stop recording once no event
+  // is active any more (unless the alert was raised by hand), the alert stays until
+  // Alert OFF
+  onDeviceAlertEnd(ws, message) {
+    var cid = ws.cid;
+    if (!cid || !deviceList.devices[cid]) return;
+    deviceList.devices[cid].event = { active: false, peak: message.peak, duration_ms: message.duration_ms };
+    if (pages.is('device-list')) deviceList.showDeviceListHtml();
+    for (var id in deviceList.devices) {
+      var event = deviceList.devices[id].event;
+      if (event && event.active) return;
+    }
+    if (!this.manual) this.sendRecordStopBroadcast();
+  }
+
   alertStart(cid) {
     $('body').addClass('alert');
     this.alert = true;
@@ -710,11 +906,12 @@ class System {
   alertStop() {
     $('body').removeClass('alert');
     this.alert = false;
+    this.manual = false;
+    // cameras detect motion too
     for (var cid in deviceList.devices) {
-      var device = deviceList.devices[cid];
-      if (device.updates && device.updates.mode == 'motion') {
-        deviceList.devices[cid].alert = false;
-      }
+      deviceList.devices[cid].alert = false;
+      deviceList.devices[cid].alertZones = [];
+      deviceList.devices[cid].event = null;
     }
     this.sendRecordStopBroadcast();
     this.sendStreamStopBroadcast();
@@ -774,10 +971,15 @@ class App {
       if (pages.is('device-view')) deviceView.onDeviceUpdated(ws, message);
       break;
 
-      case 'alert':
+      case 'alert': // firmware without motion events
+      case 'alert_start':
       system.onDeviceAlert(ws, message);
       break;
 
+      case 'alert_end':
+      system.onDeviceAlertEnd(ws, message);
+      break;
+
       case 'index':
       if (pages.is('device-replay')) replayPage.onIndexRetrieved(ws, message);
       break;
@@ -791,6 +993,17 @@ class App {
     }
   }
 
+  onClientBinary(ws, data) {
+    switch (data[0]) {
+      case 0x48: // 'H'
+      deviceList.onDeviceHeatmap(ws, data);
+      break;
+
+      default:
+        console.error('Unknown websocket binary message: ' + data[0]);
+    }
+  }
+
   onClientDisconnect(ws) {
     deviceList.onDeviceDisconnect(ws);
   }
@@ -845,6 +1058,9 @@ wss.on('connection', (ws, req) => {
         ws.terminate();
         return;
       }
+    } else if (typeof message !== 'string') {
+      // binary messages are not JSON (heat map)
+      app.onClientBinary(ws, message);
     } else {
       var ok = true;
       try {
@@ -36,6 +36,9 @@
 #include "esp_camera.h"
 #include "camera_common.h"
 #include "xclk.h"
+
+#define DMA_FILTER_ATTR IRAM_ATTR
+#include "dma_filter.h"
 #if CONFIG_OV2640_SUPPORT
 #include "ov2640.h"
 #endif
@@ -682,20 +685,15 @@ static void IRAM_ATTR dma_finish_frame()
             if(s_state->fb->len) {
                 //find the end marker for JPEG. Data after that can be discarded
                 if(s_state->fb->format == PIXFORMAT_JPEG){
-                    uint8_t * dptr = &s_state->fb->buf[s_state->fb->len - 1];
-                    while(dptr > s_state->fb->buf){
-                        if(dptr[0] == 0xFF && dptr[1] == 0xD9 && dptr[2] == 0x00 && dptr[3] == 0x00){
-                            dptr += 2;
-                            s_state->fb->len = dptr - s_state->fb->buf;
-                            if((s_state->fb->len & 0x1FF) == 0){
-                                s_state->fb->len += 1;
-                            }
-                            if((s_state->fb->len % 100) == 0){
-                                s_state->fb->len += 1;
-                            }
-                            break;
+                    size_t eoi = dma_jpeg_find_eoi(s_state->fb->buf, s_state->fb->len);
+                    if(eoi){
+                        s_state->fb->len = eoi;
+                        if((s_state->fb->len & 0x1FF) == 0){
+                            s_state->fb->len += 1;
+                        }
+                        if((s_state->fb->len % 100) == 0){
+                            s_state->fb->len += 1;
                         }
-                        dptr--;
                     }
                 }
                 //send out the frame
@@ -773,171 +771,65 @@ static void IRAM_ATTR dma_filter_task(void *pvParameters)
 
 static void IRAM_ATTR dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-    // manually unrolling 4 iterations of the loop here
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = src[0].sample1;
-        dst[1] = src[1].sample1;
-        dst[2] = src[2].sample1;
-        dst[3] = src[3].sample1;
-        src += 4;
-        dst += 4;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_jpeg_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_jpeg_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_grayscale(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-    for (size_t i = 0; i < end; ++i) {
-        // manually unrolling 4 iterations of the loop here
-        dst[0] = src[0].sample1;
-        dst[1] = src[1].sample1;
-        dst[2] = src[2].sample1;
-        dst[3] = src[3].sample1;
-        src += 4;
-        dst += 4;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_grayscale_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_grayscale_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_grayscale_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 8;
-    for (size_t i = 0; i < end; ++i) {
-        // manually unrolling 4 iterations of the loop here
-        dst[0] = src[0].sample1;
-        dst[1] = src[2].sample1;
-        dst[2] = src[4].sample1;
-        dst[3] = src[6].sample1;
-        src += 8;
-        dst += 4;
-    }
-    // the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
-    if ((dma_desc->length & 0x7) != 0) {
-        dst[0] = src[0].sample1;
-        dst[1] = src[2].sample1;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_grayscale_highspeed_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_grayscale_highspeed_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_yuyv(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = src[0].sample1;//y0
-        dst[1] = src[0].sample2;//u
-        dst[2] = src[1].sample1;//y1
-        dst[3] = src[1].sample2;//v
-
-        dst[4] = src[2].sample1;//y0
-        dst[5] = src[2].sample2;//u
-        dst[6] = src[3].sample1;//y1
-        dst[7] = src[3].sample2;//v
-        src += 4;
-        dst += 8;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_yuyv_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_yuyv_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_yuyv_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 8;
-    for (size_t i = 0; i < end; ++i) {
-        dst[0] = src[0].sample1;//y0
-        dst[1] = src[1].sample1;//u
-        dst[2] = src[2].sample1;//y1
-        dst[3] = src[3].sample1;//v
-
-        dst[4] = src[4].sample1;//y0
-        dst[5] = src[5].sample1;//u
-        dst[6] = src[6].sample1;//y1
-        dst[7] = src[7].sample1;//v
-        src += 8;
-        dst += 8;
-    }
-    if ((dma_desc->length & 0x7) != 0) {
-        dst[0] = src[0].sample1;//y0
-        dst[1] = src[1].sample1;//u
-        dst[2] = src[2].sample1;//y1
-        dst[3] = src[2].sample2;//v
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_yuyv_highspeed_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_yuyv_highspeed_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_rgb888(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 4;
-    uint8_t lb, hb;
-    for (size_t i = 0; i < end; ++i) {
-        hb = src[0].sample1;
-        lb = src[0].sample2;
-        dst[0] = (lb & 0x1F) << 3;
-        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[2] = hb & 0xF8;
-
-        hb = src[1].sample1;
-        lb = src[1].sample2;
-        dst[3] = (lb & 0x1F) << 3;
-        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[5] = hb & 0xF8;
-
-        hb = src[2].sample1;
-        lb = src[2].sample2;
-        dst[6] = (lb & 0x1F) << 3;
-        dst[7] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[8] = hb & 0xF8;
-
-        hb = src[3].sample1;
-        lb = src[3].sample2;
-        dst[9] = (lb & 0x1F) << 3;
-        dst[10] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[11] = hb & 0xF8;
-        src += 4;
-        dst += 12;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_rgb888_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_rgb888_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 static void IRAM_ATTR dma_filter_rgb888_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst)
 {
-    size_t end = dma_desc->length / sizeof(dma_elem_t) / 8;
-    uint8_t lb, hb;
-    for (size_t i = 0; i < end; ++i) {
-        hb = src[0].sample1;
-        lb = src[1].sample1;
-        dst[0] = (lb & 0x1F) << 3;
-        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[2] = hb & 0xF8;
-
-        hb = src[2].sample1;
-        lb = src[3].sample1;
-        dst[3] = (lb & 0x1F) << 3;
-        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[5] = hb & 0xF8;
-
-        hb = src[4].sample1;
-        lb = src[5].sample1;
-        dst[6] = (lb & 0x1F) << 3;
-        dst[7] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[8] = hb & 0xF8;
-
-        hb = src[6].sample1;
-        lb = src[7].sample1;
-        dst[9] = (lb & 0x1F) << 3;
-        dst[10] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[11] = hb & 0xF8;
-
-        src += 8;
-        dst += 12;
-    }
-    if ((dma_desc->length & 0x7) != 0) {
-        hb = src[0].sample1;
-        lb = src[1].sample1;
-        dst[0] = (lb & 0x1F) << 3;
-        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[2] = hb & 0xF8;
-
-        hb = src[2].sample1;
-        lb = src[2].sample2;
-        dst[3] = (lb & 0x1F) << 3;
-        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
-        dst[5] = hb & 0xF8;
-    }
+#if CONFIG_CAMERA_DMA_FILTER_WORDS
+    dma_filter_rgb888_highspeed_words(&src->val, dma_desc->length, dst);
+#else
+    dma_filter_rgb888_highspeed_bytes((const dma_filter_elem_t*) src, dma_desc->length, dst);
+#endif
 }
 
 /*
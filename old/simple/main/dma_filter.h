@@ -0,0 +1,461 @@
+// Copyright 2015-2016 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+/*
+ * I2S DMA sample unpackers.
+ *
+ * Every DMA element is a 32 bit word holding up to two camera samples:
+ *   byte 0: sample2, byte 1: unused, byte 2: sample1, byte 3: unused
+ * The filters read whole words and, when dst is word aligned, pack four
+ * output bytes into a single 32 bit store instead of four byte stores.
+ * The output is the same as the byte-by-byte filters below (see test/).
+ *
+ * This header has no ESP-IDF dependencies, define DMA_FILTER_ATTR (IRAM_ATTR
+ * in the driver) before including it.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef DMA_FILTER_ATTR
+#define DMA_FILTER_ATTR
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error dma_filter.h packs words little-endian
+#endif
+
+#define DMA_SAMPLE1(w) ((uint8_t)((w) >> 16))
+#define DMA_SAMPLE2(w) ((uint8_t)(w))
+
+// sample1 of w0..w3 as one little-endian word
+#define DMA_PACK_SAMPLE1(w0, w1, w2, w3) \
+    ((((w0) >> 16) & 0x000000FFu) | (((w1) >> 8) & 0x0000FF00u) | \
+     ((w2) & 0x00FF0000u) | (((w3) << 8) & 0xFF000000u))
+
+// sample1, sample2 of w0 and w1 as one little-endian word
+#define DMA_PACK_SAMPLES(w0, w1) \
+    ((((w0) >> 16) & 0x000000FFu) | (((w0) << 8) & 0x0000FF00u) | \
+     ((w1) & 0x00FF0000u) | (((w1) << 24) & 0xFF000000u))
+
+static inline bool dma_filter_aligned(const uint8_t* dst)
+{
+    return ((uintptr_t)dst & 0x3) == 0;
+}
+
+/* camera sends s1, s2, ...; fifo receives 00 s1 00 s2, 00 s3 00 s4 (only s1 is used)
+ * length: bytes of DMA data */
+static inline void DMA_FILTER_ATTR dma_filter_sample1(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 4;
+    if (dma_filter_aligned(dst)) {
+        uint32_t* out = (uint32_t*) dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[i] = DMA_PACK_SAMPLE1(src[0], src[1], src[2], src[3]);
+            src += 4;
+        }
+        return;
+    }
+    for (size_t i = 0; i < end; ++i) {
+        dst[0] = DMA_SAMPLE1(src[0]);
+        dst[1] = DMA_SAMPLE1(src[1]);
+        dst[2] = DMA_SAMPLE1(src[2]);
+        dst[3] = DMA_SAMPLE1(src[3]);
+        src += 4;
+        dst += 4;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_jpeg_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    dma_filter_sample1(src, length, dst);
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_grayscale_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    dma_filter_sample1(src, length, dst);
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_grayscale_highspeed_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 8;
+    if (dma_filter_aligned(dst)) {
+        uint32_t* out = (uint32_t*) dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[i] = DMA_PACK_SAMPLE1(src[0], src[2], src[4], src[6]);
+            src += 8;
+        }
+        dst += end * 4;
+    } else {
+        for (size_t i = 0; i < end; ++i) {
+            dst[0] = DMA_SAMPLE1(src[0]);
+            dst[1] = DMA_SAMPLE1(src[2]);
+            dst[2] = DMA_SAMPLE1(src[4]);
+            dst[3] = DMA_SAMPLE1(src[6]);
+            src += 8;
+            dst += 4;
+        }
+    }
+    // the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
+    if ((length & 0x7) != 0) {
+        dst[0] = DMA_SAMPLE1(src[0]);
+        dst[1] = DMA_SAMPLE1(src[2]);
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_yuyv_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 4;
+    if (dma_filter_aligned(dst)) {
+        uint32_t* out = (uint32_t*) dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[0] = DMA_PACK_SAMPLES(src[0], src[1]); // y0 u y1 v
+            out[1] = DMA_PACK_SAMPLES(src[2], src[3]);
+            src += 4;
+            out += 2;
+        }
+        return;
+    }
+    for (size_t i = 0; i < end; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            dst[2 * j] = DMA_SAMPLE1(src[j]);
+            dst[2 * j + 1] = DMA_SAMPLE2(src[j]);
+        }
+        src += 4;
+        dst += 8;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_yuyv_highspeed_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 8;
+    if (dma_filter_aligned(dst)) {
+        uint32_t* out = (uint32_t*) dst;
+        for (size_t i = 0; i < end; ++i) {
+            out[0] = DMA_PACK_SAMPLE1(src[0], src[1], src[2], src[3]);
+            out[1] = DMA_PACK_SAMPLE1(src[4], src[5], src[6], src[7]);
+            src += 8;
+            out += 2;
+        }
+        dst += end * 8;
+    } else {
+        for (size_t i = 0; i < end; ++i) {
+            for (int j = 0; j < 8; ++j) {
+                dst[j] = DMA_SAMPLE1(src[j]);
+            }
+            src += 8;
+            dst += 8;
+        }
+    }
+    if ((length & 0x7) != 0) {
+        dst[0] = DMA_SAMPLE1(src[0]);//y0
+        dst[1] = DMA_SAMPLE1(src[1]);//u
+        dst[2] = DMA_SAMPLE1(src[2]);//y1
+        dst[3] = DMA_SAMPLE2(src[2]);//v
+    }
+}
+
+// RGB565 (hb, lb) to RGB888 as one word, the 4th byte is zero
+#define DMA_RGB565_TO_888(hb, lb) \
+    ((((lb) & 0x1Fu) << 3) | ((((hb) & 0x07u) << 5 | ((lb) & 0xE0u) >> 3) << 8) | (((hb) & 0xF8u) << 16))
+
+/* four pixels (12 bytes) are packed into three words, dst must be word aligned */
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_pack(uint8_t* dst, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+    uint32_t* out = (uint32_t*) dst;
+    out[0] = p0 | (p1 << 24);
+    out[1] = (p1 >> 8) | (p2 << 16);
+    out[2] = (p2 >> 16) | (p3 << 8);
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_store(uint8_t* dst, uint32_t p)
+{
+    dst[0] = p;
+    dst[1] = p >> 8;
+    dst[2] = p >> 16;
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 4;
+    if (dma_filter_aligned(dst)) {
+        for (size_t i = 0; i < end; ++i) {
+            dma_filter_rgb888_pack(dst,
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[0]), DMA_SAMPLE2(src[0])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[1]), DMA_SAMPLE2(src[1])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[2]), DMA_SAMPLE2(src[2])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[3]), DMA_SAMPLE2(src[3])));
+            src += 4;
+            dst += 12;
+        }
+        return;
+    }
+    for (size_t i = 0; i < end * 4; ++i) {
+        dma_filter_rgb888_store(dst, DMA_RGB565_TO_888(DMA_SAMPLE1(src[0]), DMA_SAMPLE2(src[0])));
+        src += 1;
+        dst += 3;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_highspeed_words(const uint32_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(uint32_t) / 8;
+    if (dma_filter_aligned(dst)) {
+        for (size_t i = 0; i < end; ++i) {
+            dma_filter_rgb888_pack(dst,
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[0]), DMA_SAMPLE1(src[1])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[2]), DMA_SAMPLE1(src[3])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[4]), DMA_SAMPLE1(src[5])),
+                DMA_RGB565_TO_888(DMA_SAMPLE1(src[6]), DMA_SAMPLE1(src[7])));
+            src += 8;
+            dst += 12;
+        }
+    } else {
+        for (size_t i = 0; i < end * 4; ++i) {
+            dma_filter_rgb888_store(dst, DMA_RGB565_TO_888(DMA_SAMPLE1(src[0]), DMA_SAMPLE1(src[1])));
+            src += 2;
+            dst += 3;
+        }
+    }
+    if ((length & 0x7) != 0) {
+        dma_filter_rgb888_store(dst, DMA_RGB565_TO_888(DMA_SAMPLE1(src[0]), DMA_SAMPLE1(src[1])));
+        dma_filter_rgb888_store(dst + 3, DMA_RGB565_TO_888(DMA_SAMPLE1(src[2]), DMA_SAMPLE2(src[2])));
+    }
+}
+
+/*
+ * The byte by byte filters of the driver, the reference of the word filters
+ * (used when CONFIG_CAMERA_DMA_FILTER_WORDS is off). dma_filter_elem_t is the
+ * dma_elem_t of camera_common.h.
+ */
+
+typedef union {
+    struct {
+        uint8_t sample2;
+        uint8_t unused2;
+        uint8_t sample1;
+        uint8_t unused1;
+    };
+    uint32_t val;
+} dma_filter_elem_t;
+
+static inline void DMA_FILTER_ATTR dma_filter_jpeg_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 4;
+    // manually unrolling 4 iterations of the loop here
+    for (size_t i = 0; i < end; ++i) {
+        dst[0] = src[0].sample1;
+        dst[1] = src[1].sample1;
+        dst[2] = src[2].sample1;
+        dst[3] = src[3].sample1;
+        src += 4;
+        dst += 4;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_grayscale_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 4;
+    for (size_t i = 0; i < end; ++i) {
+        // manually unrolling 4 iterations of the loop here
+        dst[0] = src[0].sample1;
+        dst[1] = src[1].sample1;
+        dst[2] = src[2].sample1;
+        dst[3] = src[3].sample1;
+        src += 4;
+        dst += 4;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_grayscale_highspeed_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 8;
+    for (size_t i = 0; i < end; ++i) {
+        // manually unrolling 4 iterations of the loop here
+        dst[0] = src[0].sample1;
+        dst[1] = src[2].sample1;
+        dst[2] = src[4].sample1;
+        dst[3] = src[6].sample1;
+        src += 8;
+        dst += 4;
+    }
+    // the final sample of a line in SM_0A0B_0B0C sampling mode needs special handling
+    if ((length & 0x7) != 0) {
+        dst[0] = src[0].sample1;
+        dst[1] = src[2].sample1;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_yuyv_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 4;
+    for (size_t i = 0; i < end; ++i) {
+        dst[0] = src[0].sample1;//y0
+        dst[1] = src[0].sample2;//u
+        dst[2] = src[1].sample1;//y1
+        dst[3] = src[1].sample2;//v
+
+        dst[4] = src[2].sample1;//y0
+        dst[5] = src[2].sample2;//u
+        dst[6] = src[3].sample1;//y1
+        dst[7] = src[3].sample2;//v
+        src += 4;
+        dst += 8;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_yuyv_highspeed_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 8;
+    for (size_t i = 0; i < end; ++i) {
+        dst[0] = src[0].sample1;//y0
+        dst[1] = src[1].sample1;//u
+        dst[2] = src[2].sample1;//y1
+        dst[3] = src[3].sample1;//v
+
+        dst[4] = src[4].sample1;//y0
+        dst[5] = src[5].sample1;//u
+        dst[6] = src[6].sample1;//y1
+        dst[7] = src[7].sample1;//v
+        src += 8;
+        dst += 8;
+    }
+    if ((length & 0x7) != 0) {
+        dst[0] = src[0].sample1;//y0
+        dst[1] = src[1].sample1;//u
+        dst[2] = src[2].sample1;//y1
+        dst[3] = src[2].sample2;//v
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 4;
+    uint8_t lb, hb;
+    for (size_t i = 0; i < end; ++i) {
+        hb = src[0].sample1;
+        lb = src[0].sample2;
+        dst[0] = (lb & 0x1F) << 3;
+        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[2] = hb & 0xF8;
+
+        hb = src[1].sample1;
+        lb = src[1].sample2;
+        dst[3] = (lb & 0x1F) << 3;
+        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[5] = hb & 0xF8;
+
+        hb = src[2].sample1;
+        lb = src[2].sample2;
+        dst[6] = (lb & 0x1F) << 3;
+        dst[7] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[8] = hb & 0xF8;
+
+        hb = src[3].sample1;
+        lb = src[3].sample2;
+        dst[9] = (lb & 0x1F) << 3;
+        dst[10] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[11] = hb & 0xF8;
+        src += 4;
+        dst += 12;
+    }
+}
+
+static inline void DMA_FILTER_ATTR dma_filter_rgb888_highspeed_bytes(const dma_filter_elem_t* src, size_t length, uint8_t* dst)
+{
+    size_t end = length / sizeof(dma_filter_elem_t) / 8;
+    uint8_t lb, hb;
+    for (size_t i = 0; i < end; ++i) {
+        hb = src[0].sample1;
+        lb = src[1].sample1;
+        dst[0] = (lb & 0x1F) << 3;
+        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[2] = hb & 0xF8;
+
+        hb = src[2].sample1;
+        lb = src[3].sample1;
+        dst[3] = (lb & 0x1F) << 3;
+        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[5] = hb & 0xF8;
+
+        hb = src[4].sample1;
+        lb = src[5].sample1;
+        dst[6] = (lb & 0x1F) << 3;
+        dst[7] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[8] = hb & 0xF8;
+
+        hb = src[6].sample1;
+        lb = src[7].sample1;
+        dst[9] = (lb & 0x1F) << 3;
+        dst[10] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[11] = hb & 0xF8;
+
+        src += 8;
+        dst += 12;
+    }
+    if ((length & 0x7) != 0) {
+        hb = src[0].sample1;
+        lb = src[1].sample1;
+        dst[0] = (lb & 0x1F) << 3;
+        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[2] = hb & 0xF8;
+
+        hb = src[2].sample1;
+        lb = src[2].sample2;
+        dst[3] = (lb & 0x1F) << 3;
+        dst[4] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[5] = hb & 0xF8;
+    }
+}
+
+/* JPEG end of image: the sensor pads the frame after FF D9 with zeros.
+ * Returns the frame length up to and including the last FF D9 00 00 marker
+ * found in buf[1 .. len - 4], 0 if there is none. The scan goes backward a
+ * word at a time and only looks at the bytes of words holding an 0xFF, so
+ * the zero padding at the end of a large buffer is skipped 4 bytes per step. */
+static inline size_t DMA_FILTER_ATTR dma_jpeg_find_eoi(const uint8_t* buf, size_t len)
+{
+    if (len < 5) {
+        return 0;
+    }
+    size_t p = len - 4; // last candidate position
+    // unaligned head (the highest positions) byte by byte
+    while (p > 0 && ((uintptr_t)(buf + p + 1) & 0x3) != 0) {
+        if (buf[p] == 0xFF && buf[p + 1] == 0xD9 && buf[p + 2] == 0x00 && buf[p + 3] == 0x00) {
+            return p + 2;
+        }
+        p--;
+    }
+    // buf + p + 1 is word aligned: the word ending at p holds candidates p - 3 .. p
+    while (p >= 4) {
+        uint32_t w = *(const uint32_t*)(buf + p - 3);
+        uint32_t ff = ~w;
+        if (((ff - 0x01010101u) & ~ff & 0x80808080u) != 0) { // some byte is 0xFF
+            for (size_t q = p; q > p - 4; q--) {
+                if (buf[q] == 0xFF && buf[q + 1] == 0xD9 && buf[q + 2] == 0x00 && buf[q + 3] == 0x00) {
+                    return q + 2;
+                }
+            }
+        }
+        p -= 4;
+    }
+    for (; p > 0; p--) {
+        if (buf[p] == 0xFF && buf[p + 1] == 0xD9 && buf[p + 2] == 0x00 && buf[p + 3] == 0x00) {
+            return p + 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Host micro-benchmark of dma_filter.h: word against byte by byte filters on
+// one DMA buffer (aligned destination), in ns per KB of DMA data. The host does
+// not model the ESP32 (IRAM, no SIMD), the numbers only compare the two.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "dma_filter.h"
+
+#define LENGTH 4096  // bytes of DMA data
+#define ROUNDS 20000
+
+typedef void (*filter_words_t)(const uint32_t* src, size_t length, uint8_t* dst);
+typedef void (*filter_bytes_t)(const dma_filter_elem_t* src, size_t length, uint8_t* dst);
+
+struct filter_pair_s {
+    const char* name;
+    filter_words_t words;
+    filter_bytes_t bytes;
+};
+
+typedef struct filter_pair_s filter_pair_t;
+
+static const filter_pair_t pairs[] = {
+    { "jpeg", dma_filter_jpeg_words, dma_filter_jpeg_bytes },
+    { "grayscale_highspeed", dma_filter_grayscale_highspeed_words, dma_filter_grayscale_highspeed_bytes },
+    { "yuyv", dma_filter_yuyv_words, dma_filter_yuyv_bytes },
+    { "yuyv_highspeed", dma_filter_yuyv_highspeed_words, dma_filter_yuyv_highspeed_bytes },
+    { "rgb888", dma_filter_rgb888_words, dma_filter_rgb888_bytes },
+    { "rgb888_highspeed", dma_filter_rgb888_highspeed_words, dma_filter_rgb888_highspeed_bytes },
+};
+
+static uint32_t src[LENGTH / 4 + 8];
+static uint8_t dst[LENGTH * 3] __attribute__((aligned(4)));
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// keeps the compiler from dropping the filter calls
+static volatile uint8_t sink;
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(src) / sizeof(src[0]); i++) src[i] = i * 2654435761u;
+    printf("%-22s %12s %12s\n", "filter (ns/KB)", "bytes", "words");
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+        double t0 = now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            pairs[p].bytes((const dma_filter_elem_t*) src, LENGTH, dst);
+            sink = dst[r & 255];
+        }
+        double t1 = now_ns();
+        for (int r = 0; r < ROUNDS; r++) {
+            pairs[p].words(src, LENGTH, dst);
+            sink = dst[r & 255];
+        }
+        double t2 = now_ns();
+        double kb = (double) ROUNDS * LENGTH / 1024;
+        printf("%-22s %12.1f %12.1f\n", pairs[p].name, (t1 - t0) / kb, (t2 - t1) / kb);
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Host micro-benchmark of dma_jpeg_find_eoi() against the old byte loop, on a
+// 24 KB frame followed by zero padding (as with a large frame buffer).
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "dma_filter.h"
+
+#define ROUNDS 2000
+
+static size_t eoi_old(const uint8_t* buf, size_t len)
+{
+    const uint8_t* dptr = &buf[len - 1];
+    while (dptr > buf) {
+        if (dptr[0] == 0xFF && dptr[1] == 0xD9 && dptr[2] == 0x00 && dptr[3] == 0x00) {
+            return dptr + 2 - buf;
+        }
+        dptr--;
+    }
+    return 0;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint8_t buf[256 * 1024 + 4] __attribute__((aligned(4)));
+static volatile size_t sink;
+
+int main(void)
+{
+    static const size_t paddings[] = { 0, 4 * 1024, 32 * 1024, 200 * 1024 };
+    const size_t frame = 24 * 1024;
+    for (size_t i = 0; i < frame; i++) buf[i] = (i * 2654435761u) >> 24 | 0x01; // no FF D9 00 00
+    buf[0] = 0xFF;
+    buf[1] = 0xD8;
+    buf[frame - 2] = 0xFF;
+    buf[frame - 1] = 0xD9;
+    printf("%-16s %12s %12s\n", "padding (us)", "old", "new");
+    for (size_t p = 0; p < sizeof(paddings) / sizeof(paddings[0]); p++) {
+        size_t len = frame + paddings[p] + 4;
+        memset(buf + frame, 0, len - frame + 4);
+        double t0 = now_ns();
+        for (int r = 0; r < ROUNDS; r++) sink = eoi_old(buf, len);
+        double t1 = now_ns();
+        for (int r = 0; r < ROUNDS; r++) sink = dma_jpeg_find_eoi(buf, len);
+        double t2 = now_ns();
+        printf("%-16zu %12.2f %12.2f\n", paddings[p], (t1 - t0) / ROUNDS / 1000, (t2 - t1) / ROUNDS / 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Host test of dma_filter.h: the word filters against the byte by byte filters,
+// over DMA lengths (with the odd line tails of the highspeed modes) and every
+// destination alignment. Output and the bytes around it have to be the same.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma_filter.h"
+
+#define SRC_WORDS_MAX 1040  // lengths up to 4096 bytes, plus the tail reads
+#define DST_SIZE (SRC_WORDS_MAX * 4 + 64)
+#define GUARD 0xA5
+
+typedef void (*filter_words_t)(const uint32_t* src, size_t length, uint8_t* dst);
+typedef void (*filter_bytes_t)(const dma_filter_elem_t* src, size_t length, uint8_t* dst);
+
+struct filter_pair_s {
+    const char* name;
+    filter_words_t words;
+    filter_bytes_t bytes;
+};
+
+typedef struct filter_pair_s filter_pair_t;
+
+static const filter_pair_t pairs[] = {
+    { "jpeg", dma_filter_jpeg_words, dma_filter_jpeg_bytes },
+    { "grayscale", dma_filter_grayscale_words, dma_filter_grayscale_bytes },
+    { "grayscale_highspeed", dma_filter_grayscale_highspeed_words, dma_filter_grayscale_highspeed_bytes },
+    { "yuyv", dma_filter_yuyv_words, dma_filter_yuyv_bytes },
+    { "yuyv_highspeed", dma_filter_yuyv_highspeed_words, dma_filter_yuyv_highspeed_bytes },
+    { "rgb888", dma_filter_rgb888_words, dma_filter_rgb888_bytes },
+    { "rgb888_highspeed", dma_filter_rgb888_highspeed_words, dma_filter_rgb888_highspeed_bytes },
+};
+
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint32_t src[SRC_WORDS_MAX];
+static uint8_t dst_words[DST_SIZE] __attribute__((aligned(4)));
+static uint8_t dst_bytes[DST_SIZE] __attribute__((aligned(4)));
+
+// the DMA lengths of the driver are whole words, 8 word multiples plus a tail
+static int check(const filter_pair_t* pair, size_t length, size_t align)
+{
+    memset(dst_words, GUARD, DST_SIZE);
+    memset(dst_bytes, GUARD, DST_SIZE);
+    pair->words(src, length, dst_words + align);
+    pair->bytes((const dma_filter_elem_t*) src, length, dst_bytes + align);
+    for (size_t i = 0; i < DST_SIZE; i++) {
+        if (dst_words[i] != dst_bytes[i]) {
+            printf("FAIL %s: length %zu, align %zu, byte %zu: %02x != %02x\n",
+                pair->name, length, align, i, dst_words[i], dst_bytes[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    int failed = 0, checks = 0;
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+        for (size_t words = 0; words <= 1024 && !failed; words++) {
+            for (size_t i = 0; i < SRC_WORDS_MAX; i++) src[i] = rnd();
+            for (size_t align = 0; align < 4; align++, checks++) {
+                failed |= check(&pairs[p], words * sizeof(uint32_t), align);
+            }
+        }
+    }
+    // all samples 0x00 and 0xFF, the pack masks must not leak
+    for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]) && !failed; p++) {
+        for (int v = 0; v < 2; v++) {
+            memset(src, v ? 0xFF : 0x00, sizeof(src));
+            for (size_t align = 0; align < 4; align++, checks++) {
+                failed |= check(&pairs[p], 1021 * sizeof(uint32_t), align);
+            }
+        }
+    }
+    printf("%s: %d checks\n", failed ? "FAIL" : "OK", checks);
+    return failed;
+}
@@ -0,0 +1,161 @@
+// Host test of dma_jpeg_find_eoi() against the byte loop it replaced in
+// dma_finish_frame(), on synthetic OV2640-like frames: SOI, tables, entropy
+// data with stuffed FF 00 and restart markers, EOI, then zero padding up to a
+// whole number of DMA lines, and stale bytes of an older frame past len.
+//
+// Behaviour change at the buffer tail: the old loop started at buf[len - 1] and
+// also read the 3 bytes past len, so it could take an FF D9 whose 00 00 (or
+// D9 00 00) were stale bytes past the frame. The new search only takes markers
+// that lie inside buf[0 .. len). The test checks the new result against the old
+// loop limited to such markers, and counts the frames where the two differ.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dma_filter.h"
+
+#define FRAME_MAX (96 * 1024)
+#define STALE 8 // bytes past len the old loop may read
+
+static uint32_t rnd_state = 88172645u;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+// the loop of dma_finish_frame() before dma_jpeg_find_eoi()
+static size_t eoi_old(const uint8_t* buf, size_t len)
+{
+    const uint8_t* dptr = &buf[len - 1];
+    while (dptr > buf) {
+        if (dptr[0] == 0xFF && dptr[1] == 0xD9 && dptr[2] == 0x00 && dptr[3] == 0x00) {
+            return dptr + 2 - buf;
+        }
+        dptr--;
+    }
+    return 0;
+}
+
+// the same, only markers inside buf[0 .. len)
+static size_t eoi_old_inside(const uint8_t* buf, size_t len)
+{
+    if (len < 5) return 0;
+    for (size_t p = len - 4; p > 0; p--) {
+        if (buf[p] == 0xFF && buf[p + 1] == 0xD9 && buf[p + 2] == 0x00 && buf[p + 3] == 0x00) {
+            return p + 2;
+        }
+    }
+    return 0;
+}
+
+static size_t put_marker(uint8_t* out, uint8_t marker, size_t payload)
+{
+    size_t n = 0;
+    out[n++] = 0xFF;
+    out[n++] = marker;
+    out[n++] = (payload + 2) >> 8;
+    out[n++] = (payload + 2) & 0xFF;
+    for (size_t i = 0; i < payload; i++) out[n++] = rnd() & 0x7F;
+    return n;
+}
+
+// a frame of about data bytes of entropy data, zero padded to a multiple of
+// line bytes, returns len (the filtered DMA data)
+static size_t make_frame(uint8_t* out, size_t data, size_t line, int zero_rate)
+{
+    size_t n = 0;
+    out[n++] = 0xFF;
+    out[n++] = 0xD8;
+    n += put_marker(out + n, 0xDB, 65);
+    n += put_marker(out + n, 0xC0, 15);
+    n += put_marker(out + n, 0xC4, 60);
+    n += put_marker(out + n, 0xDA, 10);
+    int rst = 0;
+    for (size_t i = 0; i < data; i++) {
+        uint8_t b = rnd() % zero_rate ? rnd() : 0x00;
+        out[n++] = b;
+        if (b == 0xFF) out[n++] = 0x00; // stuffing
+        if ((i & 1023) == 1023) {
+            out[n++] = 0xFF;
+            out[n++] = 0xD0 + (rst++ & 7);
+        }
+    }
+    out[n++] = 0xFF;
+    out[n++] = 0xD9;
+    size_t len = (n + line - 1) / line * line;
+    memset(out + n, 0, len - n);
+    return len;
+}
+
+static uint8_t mem[FRAME_MAX + STALE + 4];
+
+static int failed;
+static int checks;
+static int changed;
+
+static void check(const uint8_t* buf, size_t len, const char* what)
+{
+    size_t got = dma_jpeg_find_eoi(buf, len);
+    size_t want = eoi_old_inside(buf, len);
+    checks++;
+    if (got != want) {
+        printf("FAIL %s: len %zu, align %u: %zu != %zu\n", what, len, (unsigned) ((uintptr_t) buf & 3), got, want);
+        failed = 1;
+    }
+    if (eoi_old(buf, len) != got) changed++;
+}
+
+int main(void)
+{
+    static const size_t lines[] = { 1, 4, 160, 800, 1600 };
+    for (int f = 0; f < 400 && !failed; f++) {
+        size_t line = lines[f % 5];
+        size_t data = 1000 + rnd() % (FRAME_MAX / 2);
+        int zero_rate = 2 + f % 7;
+        for (unsigned align = 0; align < 4; align++) {
+            uint8_t* buf = mem + align;
+            size_t len = make_frame(buf, data, line, zero_rate);
+            if (len > FRAME_MAX) continue;
+            // stale bytes of an older frame: zeros (an old EOI padding) or random
+            for (int i = 0; i < STALE; i++) buf[len + i] = f & 1 ? 0 : rnd();
+            check(buf, len, "frame");
+            // every cut of the frame tail, so the marker ends at and past len
+            for (size_t cut = 1; cut < 8 && cut < len; cut++) {
+                check(buf, len - cut, "cut frame");
+            }
+        }
+    }
+
+    // short and degenerate buffers
+    for (size_t len = 0; len < 16; len++) {
+        for (unsigned align = 0; align < 4; align++) {
+            uint8_t* buf = mem + align;
+            memset(buf, 0, len + STALE);
+            if (len >= 5) {
+                buf[len - 4] = 0xFF;
+                buf[len - 3] = 0xD9;
+            }
+            if (len) check(buf, len, "short");
+            memset(buf, 0xFF, len + STALE);
+            if (len) check(buf, len, "all FF");
+        }
+    }
+
+    // the marker exactly at the end: FF D9 are the last bytes, 00 00 are stale
+    uint8_t* buf = mem;
+    size_t len = make_frame(buf, 5000, 1, 3); // no padding
+    memset(buf + len, 0, STALE);
+    size_t old = eoi_old(buf, len), now = dma_jpeg_find_eoi(buf, len);
+    checks++;
+    if (old != len || now == len) {
+        printf("FAIL tail: old %zu, new %zu, len %zu\n", old, now, len);
+        failed = 1;
+    }
+
+    printf("%s: %d checks, %d where the old loop took a marker past len\n", failed ? "FAIL" : "OK", checks, changed);
+    return failed;
+}